@@ -0,0 +1,88 @@
+/*
+ * arena.c: per-context scratch buffer arena
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+#include "log.h"
+
+#define ARENA_ALIGN 8
+
+int arena_init(fwloader_arena *arena, size_t size) {
+	memset(arena, 0, sizeof(*arena));
+
+	arena->base = malloc(size);
+	if (!arena->base) {
+		_e("failed to allocate %zu bytes for the buffer arena", size);
+		return -ENOMEM;
+	}
+
+	arena->size = size;
+
+	return 0;
+}
+
+void arena_free(fwloader_arena *arena) {
+	if (arena->base) {
+		free(arena->base);
+	}
+	arena->base = NULL;
+	arena->size = 0;
+	arena->used = 0;
+}
+
+void *arena_claim(fwloader_arena *arena, size_t size) {
+	size_t aligned = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (aligned > arena->size - arena->used) {
+		_e("arena exhausted: need %zu bytes, %zu of %zu free", size,
+			arena->size - arena->used, arena->size);
+		arena->overflows++;
+		return NULL;
+	}
+
+	void *ptr = arena->base + arena->used;
+	arena->used += aligned;
+	arena->claims++;
+
+	if (arena->used > arena->peak) {
+		arena->peak = arena->used;
+	}
+
+	return ptr;
+}
+
+size_t arena_mark(fwloader_arena *arena) {
+	return arena->used;
+}
+
+void arena_release(fwloader_arena *arena, size_t mark) {
+	if (mark <= arena->used) {
+		arena->used = mark;
+	}
+}
+
+void arena_report(fwloader_arena *arena) {
+	_r("buffer arena: %zu bytes, peak %zu, %u claims, %u overflows, "
+		"%u heap allocations", arena->size, arena->peak,
+		arena->claims, arena->overflows, arena->heap_allocs);
+}
@@ -0,0 +1,97 @@
+/*
+ * arena.h: per-context scratch buffer arena
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "common.h"
+
+/*
+ * A bump allocator sized once at boot for the largest command and ACK
+ * buffers a board can see. Protocol functions claim scratch space from
+ * it and give it back with a mark/release pair, so the upload itself
+ * never touches the heap.
+ */
+typedef struct {
+	char *base;
+	size_t size;
+	size_t used;
+	size_t peak;
+	unsigned claims;
+	unsigned overflows;
+	//heap allocations of the last boot, see heap_count.h
+	unsigned heap_allocs;
+} fwloader_arena;
+
+/*
+ * @brief Allocates the arena backing store
+ *
+ * @param arena [out] the arena to initialize
+ * @param size [in] the size of the arena in bytes
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int arena_init(fwloader_arena *arena, size_t size);
+
+/*
+ * @brief Frees the arena backing store
+ *
+ * @param arena [in] the arena to free
+ */
+void arena_free(fwloader_arena *arena);
+
+/*
+ * @brief Claims scratch space from the arena
+ *
+ * @param arena [in] the arena to claim from
+ * @param size [in] the number of bytes needed
+ * @return NULL if the arena is exhausted
+ * @return pointer to the claimed (uninitialized) space
+ */
+void *arena_claim(fwloader_arena *arena, size_t size);
+
+/*
+ * @brief Returns the current arena position for arena_release()
+ *
+ * @param arena [in] the arena
+ * @return opaque arena position
+ */
+size_t arena_mark(fwloader_arena *arena);
+
+/*
+ * @brief Releases everything claimed after the given mark
+ *
+ * @param arena [in] the arena
+ * @param mark [in] position returned by arena_mark()
+ */
+void arena_release(fwloader_arena *arena, size_t mark);
+
+/*
+ * @brief Prints the arena usage statistics
+ *
+ * @param arena [in] the arena
+ */
+void arena_report(fwloader_arena *arena);
+
+#endif //__ARENA_H__
@@ -0,0 +1,245 @@
+/*
+ * bundle.c: prebuilt boot bundle with pre-framed bootloader commands
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bundle.h"
+#include "io_helpers.h"
+#include "log.h"
+
+#define BUNDLE_MAGIC 0x424d4d58 //"XMMB"
+#define BUNDLE_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	char board[16];
+	uint64_t size;
+	uint64_t sample_hash;
+	uint32_t block_size;
+	uint32_t frame_count;
+	uint64_t index_offset;
+} __attribute__((packed)) bundle_header_t;
+
+int bundle_create(boot_bundle *bundle, const char *path, const char *board,
+	const radio_fingerprint *fp, uint32_t block_size)
+{
+	memset(bundle, 0, sizeof(*bundle));
+	bundle->map = MAP_FAILED;
+	snprintf(bundle->board, sizeof(bundle->board), "%s", board);
+	bundle->fp = *fp;
+	bundle->block_size = block_size;
+
+	snprintf(bundle->tmp_path, sizeof(bundle->tmp_path), "%s.tmp", path);
+	bundle->fd = open(bundle->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (bundle->fd < 0) {
+		_e("failed to create bundle %s: %s", bundle->tmp_path, strerror(errno));
+		bundle->tmp_path[0] = '\0';
+		return -errno;
+	}
+
+	if (lseek(bundle->fd, BUNDLE_DATA_OFFSET, SEEK_SET) < 0) {
+		_e("failed to seek in bundle %s: %s", bundle->tmp_path, strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+int bundle_append(boot_bundle *bundle, const bundle_frame *frame,
+	const struct iovec *iov, int iovcnt)
+{
+	struct iovec pieces[iovcnt];
+	size_t length = 0;
+	ssize_t ret;
+	int i;
+
+	if (bundle->frame_count == bundle->frames_allocated) {
+		size_t count = bundle->frames_allocated ? 2 * bundle->frames_allocated
+			: 1024;
+		bundle_frame *frames = realloc(bundle->frames,
+			count * sizeof(*frames));
+		if (!frames) {
+			_e("failed to grow the bundle index to %zu frames", count);
+			return -ENOMEM;
+		}
+		bundle->frames = frames;
+		bundle->frames_allocated = count;
+	}
+
+	//write_iov() consumes the list it is given
+	for (i = 0; i < iovcnt; i++) {
+		pieces[i] = iov[i];
+		length += iov[i].iov_len;
+	}
+
+	if ((ret = write_iov(bundle->fd, pieces, iovcnt)) < 0) {
+		return ret;
+	}
+
+	bundle_frame *entry = bundle->frames + bundle->frame_count++;
+	*entry = *frame;
+	entry->offset = bundle->data_size;
+	entry->length = length;
+	bundle->data_size += length;
+	return 0;
+}
+
+int bundle_finish(boot_bundle *bundle, const char *path) {
+	size_t index_size = bundle->frame_count * sizeof(bundle_frame);
+	bundle_header_t hdr = {
+		.magic = BUNDLE_MAGIC,
+		.version = BUNDLE_VERSION,
+		.size = bundle->fp.size,
+		.sample_hash = bundle->fp.sample_hash,
+		.block_size = bundle->block_size,
+		.frame_count = bundle->frame_count,
+		.index_offset = BUNDLE_DATA_OFFSET + bundle->data_size,
+	};
+	memcpy(hdr.board, bundle->board, sizeof(hdr.board));
+
+	bool ok = write_all(bundle->fd, bundle->frames, index_size)
+		== (ssize_t)index_size;
+	ok = ok && pwrite(bundle->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+	ok = ok && fsync(bundle->fd) == 0;
+
+	if (!ok || rename(bundle->tmp_path, path) < 0) {
+		_e("failed to write bundle %s: %s", path, strerror(errno));
+		return -EIO;
+	}
+	bundle->tmp_path[0] = '\0';
+
+	_d("saved bundle %s", path);
+	return 0;
+}
+
+int bundle_open(boot_bundle *bundle, const char *path) {
+	bundle_header_t hdr;
+	struct stat st;
+	unsigned i;
+
+	memset(bundle, 0, sizeof(*bundle));
+	bundle->map = MAP_FAILED;
+	bundle->fd = open(path, O_RDONLY);
+	if (bundle->fd < 0) {
+		_e("failed to open bundle %s: %s", path, strerror(errno));
+		return -errno;
+	}
+
+	if (fstat(bundle->fd, &st) < 0
+		|| pread(bundle->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+	{
+		_e("failed to read bundle %s", path);
+		goto fail;
+	}
+
+	if (hdr.magic != BUNDLE_MAGIC || hdr.version != BUNDLE_VERSION) {
+		_i("bundle %s has an unknown format", path);
+		goto fail;
+	}
+
+	size_t index_size = hdr.frame_count * sizeof(bundle_frame);
+	if (hdr.index_offset < BUNDLE_DATA_OFFSET
+		|| hdr.index_offset + index_size != (uint64_t)st.st_size)
+	{
+		_e("bundle %s is truncated", path);
+		goto fail;
+	}
+
+	bundle->frames = malloc(index_size);
+	if (!bundle->frames || pread(bundle->fd, bundle->frames, index_size,
+		hdr.index_offset) != (ssize_t)index_size)
+	{
+		_e("failed to read the index of bundle %s", path);
+		goto fail;
+	}
+
+	uint64_t data_size = hdr.index_offset - BUNDLE_DATA_OFFSET;
+	for (i = 0; i < hdr.frame_count; i++) {
+		const bundle_frame *frame = bundle->frames + i;
+		if (frame->offset + frame->length > data_size
+			|| frame->image >= XMM6260_IMAGE_MAX)
+		{
+			_e("bundle %s: frame %u is out of bounds", path, i);
+			goto fail;
+		}
+	}
+
+	bundle->map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, bundle->fd, 0);
+	if (bundle->map == MAP_FAILED) {
+		_e("failed to mmap bundle %s: %s", path, strerror(errno));
+		goto fail;
+	}
+	bundle->map_size = st.st_size;
+
+	memcpy(bundle->board, hdr.board, sizeof(bundle->board));
+	bundle->board[sizeof(bundle->board) - 1] = '\0';
+	bundle->fp.size = hdr.size;
+	bundle->fp.sample_hash = hdr.sample_hash;
+	bundle->block_size = hdr.block_size;
+	bundle->frame_count = hdr.frame_count;
+	bundle->data_size = data_size;
+	return 0;
+
+fail:
+	bundle_close(bundle);
+	return -EINVAL;
+}
+
+void bundle_close(boot_bundle *bundle) {
+	if (bundle->tmp_path[0]) {
+		unlink(bundle->tmp_path);
+		bundle->tmp_path[0] = '\0';
+	}
+
+	if (bundle->map != MAP_FAILED) {
+		munmap(bundle->map, bundle->map_size);
+	}
+	bundle->map = MAP_FAILED;
+
+	if (bundle->fd >= 0) {
+		close(bundle->fd);
+	}
+	bundle->fd = -1;
+
+	free(bundle->frames);
+	bundle->frames = NULL;
+	bundle->frame_count = 0;
+}
+
+unsigned bundle_find(const boot_bundle *bundle, enum xmm6260_image type,
+	unsigned *first)
+{
+	unsigned i, count = 0;
+
+	for (i = 0; i < bundle->frame_count; i++) {
+		if (bundle->frames[i].image != type) {
+			continue;
+		}
+		if (!count) {
+			*first = i;
+		}
+		count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,147 @@
+/*
+ * bundle.h: prebuilt boot bundle with pre-framed bootloader commands
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include "common.h"
+#include "manifest.h"
+
+#include <limits.h>
+
+/*
+ * A bundle holds the bootloader commands of the secure image upload
+ * (ReqSecStart, ReqFlashSetAddress and every ReqFlashWriteBlock) fully
+ * framed, in the order they are sent. The frames of one image are
+ * contiguous so several of them go out with a single write, the index
+ * tells where each frame starts and which ACK it expects. Only the ACK
+ * command code is stored: the ACK bytes of a real modem have not been
+ * captured, so ACKs are still parsed and checked when the bundle plays.
+ *
+ * Layout: header, frame data from BUNDLE_DATA_OFFSET, index at the end.
+ */
+
+#define BUNDLE_DATA_OFFSET 4096
+
+//the frame has to be ACKed before the next one may be sent
+#define BUNDLE_FRAME_SYNC 1
+
+typedef struct {
+	//where the frame starts, relative to BUNDLE_DATA_OFFSET
+	uint64_t offset;
+	uint32_t length;
+	//modem address the payload is written to, for rewinding
+	uint32_t addr;
+	//command code the ACK has to carry
+	uint16_t ack_code;
+	uint8_t image;
+	uint8_t flags;
+	uint32_t padding;
+} __attribute__((packed)) bundle_frame;
+
+typedef struct {
+	char board[16];
+	radio_fingerprint fp;
+	uint32_t block_size;
+	uint32_t frame_count;
+	bundle_frame *frames;
+	int fd;
+	//read-only mapping of the whole file for fds without sendfile()
+	char *map;
+	size_t map_size;
+	//only used while packing: frame data written so far, file to rename
+	uint64_t data_size;
+	size_t frames_allocated;
+	char tmp_path[PATH_MAX];
+} boot_bundle;
+
+/*
+ * @brief Starts writing a bundle
+ *
+ * The bundle is created next to path and renamed into place by
+ * bundle_finish().
+ *
+ * @param bundle [out] the bundle being written
+ * @param path [in] path of the bundle file
+ * @param board [in] board the frames are built for
+ * @param fp [in] fingerprint of the radio partition
+ * @param block_size [in] ReqFlashWriteBlock payload size
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int bundle_create(boot_bundle *bundle, const char *path, const char *board,
+	const radio_fingerprint *fp, uint32_t block_size);
+
+/*
+ * @brief Appends one frame, given as the pieces it is sent in
+ *
+ * @param bundle [in,out] the bundle being written
+ * @param frame [in] index entry, offset and length are filled in
+ * @param iov [in] the pieces of the frame
+ * @param iovcnt [in] number of pieces
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int bundle_append(boot_bundle *bundle, const bundle_frame *frame,
+	const struct iovec *iov, int iovcnt);
+
+/*
+ * @brief Writes the index and moves the bundle into place
+ *
+ * @param bundle [in] the bundle being written, still to be closed
+ * @param path [in] path given to bundle_create()
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int bundle_finish(boot_bundle *bundle, const char *path);
+
+/*
+ * @brief Opens a bundle and loads its index
+ *
+ * @param bundle [out] the bundle
+ * @param path [in] path of the bundle file
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int bundle_open(boot_bundle *bundle, const char *path);
+
+/*
+ * @brief Closes a bundle, also drops one that was never finished
+ *
+ * @param bundle [in] the bundle
+ */
+void bundle_close(boot_bundle *bundle);
+
+/*
+ * @brief Finds the frames of an image
+ *
+ * @param bundle [in] the bundle
+ * @param type [in] the image
+ * @param first [out] index of its first frame
+ * @return number of frames, zero when the bundle does not carry the image
+ */
+unsigned bundle_find(const boot_bundle *bundle, enum xmm6260_image type,
+	unsigned *first);
+
+#endif //__BUNDLE_H__
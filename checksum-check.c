@@ -0,0 +1,113 @@
+/*
+ * checksum-check.c: compares every checksum kernel with the scalar one
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Run by "make check". Every kernel set the CPU can run is compared
+ * with the scalar kernels for all lengths up to CHECK_MAX_LENGTH and
+ * for the real FIRMWARE and ReqFlashWriteBlock sizes, each at every
+ * alignment up to CHECK_ALIGNMENTS. Random bytes catch a wrong fold,
+ * 0xff bytes catch a lane that overflows.
+ */
+
+#include "common.h"
+#include "checksum.h"
+
+#define CHECK_MAX_LENGTH 4099
+#define CHECK_ALIGNMENTS 16
+#define CHECK_FIRMWARE_SIZE 0x9d8000
+#define CHECK_SEC_CHUNK 0xdfc2
+
+static unsigned check_failures;
+
+static void check_one(const checksum_kernel *kernel, const char *fill,
+	const uint8_t *buf, size_t align, size_t length)
+{
+	const uint8_t *data = buf + align;
+	uint8_t xor8 = kernel->xor8(data, length);
+	uint8_t xor8_want = checksum_xor8_scalar(data, length);
+	uint32_t sum8 = kernel->sum8(data, length);
+	uint32_t sum8_want = checksum_sum8_scalar(data, length);
+
+	if (xor8 != xor8_want) {
+		fprintf(stderr, "%s xor8 %s align=%zu length=%zu: 0x%02x, want 0x%02x\n",
+			kernel->name, fill, align, length, xor8, xor8_want);
+		check_failures++;
+	}
+	if (sum8 != sum8_want) {
+		fprintf(stderr, "%s sum8 %s align=%zu length=%zu: 0x%08x, want 0x%08x\n",
+			kernel->name, fill, align, length, sum8, sum8_want);
+		check_failures++;
+	}
+}
+
+static void check_kernel(const checksum_kernel *kernel, const char *fill,
+	const uint8_t *buf)
+{
+	static const size_t sizes[] = { CHECK_SEC_CHUNK, CHECK_FIRMWARE_SIZE };
+	size_t align, length, i;
+
+	for (align = 0; align < CHECK_ALIGNMENTS; align++) {
+		for (length = 0; length <= CHECK_MAX_LENGTH; length++) {
+			check_one(kernel, fill, buf, align, length);
+		}
+		for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+			check_one(kernel, fill, buf, align, sizes[i]);
+		}
+	}
+}
+
+int main(void) {
+	const checksum_kernel *kernels;
+	unsigned i, failures, count = checksum_kernels(&kernels);
+	size_t size = CHECK_FIRMWARE_SIZE + CHECK_ALIGNMENTS;
+	uint32_t seed = 0x12345678;
+	uint8_t *buf;
+	size_t j;
+
+	//malloc alignment is at least 8, the offsets cover the rest
+	if (!(buf = malloc(size))) {
+		fprintf(stderr, "failed to allocate %zu bytes\n", size);
+		return 1;
+	}
+
+	//the scalar kernels are the reference
+	for (i = 1; i < count; i++) {
+		failures = check_failures;
+
+		for (j = 0; j < size; j++) {
+			seed = seed * 1103515245 + 12345;
+			buf[j] = seed >> 16;
+		}
+		check_kernel(kernels + i, "random", buf);
+
+		memset(buf, 0xff, size);
+		check_kernel(kernels + i, "0xff", buf);
+
+		printf("checksum kernels %s: %s\n", kernels[i].name,
+			check_failures == failures ? "ok" : "FAILED");
+	}
+
+	free(buf);
+	return check_failures ? 1 : 0;
+}
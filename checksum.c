@@ -0,0 +1,284 @@
+/*
+ * checksum.c: checksum kernels for the XMM6260 boot protocol
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum.h"
+#include "log.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#define HAVE_NEON_KERNELS
+	#include <arm_neon.h>
+	#if defined(__arm__)
+		#include <sys/auxv.h>
+		#include <asm/hwcap.h>
+	#endif
+#endif
+
+//bytes used to cross-check a kernel against the scalar version
+#define SELF_CHECK_SIZE 4099
+
+typedef uint8_t (*xor8_fn)(const void *data, size_t length);
+typedef uint32_t (*sum8_fn)(const void *data, size_t length);
+
+static xor8_fn xor8_impl;
+static sum8_fn sum8_impl;
+static const char *kernel_name = "scalar";
+
+uint8_t checksum_xor8_scalar(const void *data, size_t length) {
+	const uint8_t *ptr = (const uint8_t*)data;
+	uint8_t crc = 0;
+
+	while (length--) {
+		crc ^= *ptr++;
+	}
+
+	return crc;
+}
+
+uint32_t checksum_sum8_scalar(const void *data, size_t length) {
+	const uint8_t *ptr = (const uint8_t*)data;
+	uint32_t sum = 0;
+
+	while (length--) {
+		sum += *ptr++;
+	}
+
+	return sum;
+}
+
+static inline uint64_t load64(const uint8_t *ptr) {
+	uint64_t word;
+	memcpy(&word, ptr, sizeof(word));
+	return word;
+}
+
+static uint8_t checksum_xor8_word(const void *data, size_t length) {
+	const uint8_t *ptr = (const uint8_t*)data;
+	uint64_t acc = 0;
+	uint8_t crc;
+
+	while (length >= 4 * sizeof(uint64_t)) {
+		acc ^= load64(ptr) ^ load64(ptr + 8) ^ load64(ptr + 16) ^
+			load64(ptr + 24);
+		ptr += 4 * sizeof(uint64_t);
+		length -= 4 * sizeof(uint64_t);
+	}
+
+	while (length >= sizeof(uint64_t)) {
+		acc ^= load64(ptr);
+		ptr += sizeof(uint64_t);
+		length -= sizeof(uint64_t);
+	}
+
+	acc ^= acc >> 32;
+	acc ^= acc >> 16;
+	acc ^= acc >> 8;
+	crc = acc & 0xff;
+
+	return crc ^ checksum_xor8_scalar(ptr, length);
+}
+
+/*
+ * Adds the bytes pairwise into four 16-bit lanes. A lane grows by at
+ * most 2 * 0xff per word, so 128 words fit before it has to be folded.
+ */
+#define SUM8_WORD_BATCH 128
+#define SUM8_LANE_MASK 0x00ff00ff00ff00ffULL
+
+static uint32_t checksum_sum8_word(const void *data, size_t length) {
+	const uint8_t *ptr = (const uint8_t*)data;
+	uint32_t sum = 0;
+
+	while (length >= sizeof(uint64_t)) {
+		uint64_t lanes = 0;
+		unsigned n = 0;
+
+		while (n < SUM8_WORD_BATCH && length >= sizeof(uint64_t)) {
+			uint64_t word = load64(ptr);
+			lanes += (word & SUM8_LANE_MASK) + ((word >> 8) & SUM8_LANE_MASK);
+			ptr += sizeof(uint64_t);
+			length -= sizeof(uint64_t);
+			n++;
+		}
+
+		sum += (lanes & 0xffff) + ((lanes >> 16) & 0xffff) +
+			((lanes >> 32) & 0xffff) + (lanes >> 48);
+	}
+
+	return sum + checksum_sum8_scalar(ptr, length);
+}
+
+#ifdef HAVE_NEON_KERNELS
+static uint8_t checksum_xor8_neon(const void *data, size_t length) {
+	const uint8_t *ptr = (const uint8_t*)data;
+	uint8x16_t acc = vdupq_n_u8(0);
+	uint8_t lanes[16];
+	uint8_t crc = 0;
+	unsigned i;
+
+	while (length >= 16) {
+		acc = veorq_u8(acc, vld1q_u8(ptr));
+		ptr += 16;
+		length -= 16;
+	}
+
+	vst1q_u8(lanes, acc);
+	for (i = 0; i < sizeof(lanes); i++) {
+		crc ^= lanes[i];
+	}
+
+	return crc ^ checksum_xor8_scalar(ptr, length);
+}
+
+//same bound as the word kernel: 8 lanes of 16 bits, 2 * 0xff per step
+static uint32_t checksum_sum8_neon(const void *data, size_t length) {
+	const uint8_t *ptr = (const uint8_t*)data;
+	uint32_t sum = 0;
+
+	while (length >= 16) {
+		uint16x8_t acc = vdupq_n_u16(0);
+		unsigned n = 0;
+
+		while (n < SUM8_WORD_BATCH && length >= 16) {
+			acc = vpadalq_u8(acc, vld1q_u8(ptr));
+			ptr += 16;
+			length -= 16;
+			n++;
+		}
+
+		uint64x2_t wide = vpaddlq_u32(vpaddlq_u16(acc));
+		sum += vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+	}
+
+	return sum + checksum_sum8_scalar(ptr, length);
+}
+
+static bool cpu_has_neon(void) {
+#if defined(__arm__)
+	return getauxval(AT_HWCAP) & HWCAP_NEON;
+#else
+	return true;
+#endif
+}
+#endif
+
+static bool kernel_matches(xor8_fn xor8, sum8_fn sum8) {
+	static uint8_t buf[SELF_CHECK_SIZE];
+	uint32_t seed = 0x12345678;
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	//odd offsets and lengths exercise the unaligned head and the tail
+	for (i = 0; i < 8; i++) {
+		size_t len = sizeof(buf) - i * 3;
+		if (xor8(buf + i, len) != checksum_xor8_scalar(buf + i, len)) {
+			return false;
+		}
+		if (sum8(buf + i, len) != checksum_sum8_scalar(buf + i, len)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void checksum_init(void) {
+	xor8_fn xor8 = checksum_xor8_scalar;
+	sum8_fn sum8 = checksum_sum8_scalar;
+	const char *name = "scalar";
+
+	if (kernel_matches(checksum_xor8_word, checksum_sum8_word)) {
+		xor8 = checksum_xor8_word;
+		sum8 = checksum_sum8_word;
+		name = "word";
+	}
+	else {
+		_e("word checksum kernels failed the self-check");
+	}
+
+#ifdef HAVE_NEON_KERNELS
+	if (cpu_has_neon()) {
+		if (kernel_matches(checksum_xor8_neon, checksum_sum8_neon)) {
+			xor8 = checksum_xor8_neon;
+			sum8 = checksum_sum8_neon;
+			name = "neon";
+		}
+		else {
+			_e("NEON checksum kernels failed the self-check");
+		}
+	}
+#endif
+
+	kernel_name = name;
+	sum8_impl = sum8;
+	xor8_impl = xor8;
+	_d("using %s checksum kernels", kernel_name);
+}
+
+unsigned checksum_kernels(const checksum_kernel **kernels) {
+	static const checksum_kernel table[] = {
+		{ "scalar", checksum_xor8_scalar, checksum_sum8_scalar },
+		{ "word", checksum_xor8_word, checksum_sum8_word },
+#ifdef HAVE_NEON_KERNELS
+		{ "neon", checksum_xor8_neon, checksum_sum8_neon },
+#endif
+	};
+	unsigned count = ARRAY_SIZE(table);
+
+#ifdef HAVE_NEON_KERNELS
+	if (!cpu_has_neon()) {
+		count--;
+	}
+#endif
+
+	*kernels = table;
+	return count;
+}
+
+const char *checksum_kernel_name(void) {
+	if (!xor8_impl) {
+		checksum_init();
+	}
+
+	return kernel_name;
+}
+
+uint8_t checksum_xor8(const void *data, size_t length) {
+	if (!xor8_impl) {
+		checksum_init();
+	}
+
+	return xor8_impl(data, length);
+}
+
+uint32_t checksum_sum8(const void *data, size_t length) {
+	if (!sum8_impl) {
+		checksum_init();
+	}
+
+	return sum8_impl(data, length);
+}
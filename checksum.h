@@ -0,0 +1,96 @@
+/*
+ * checksum.h: checksum kernels for the XMM6260 boot protocol
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include "common.h"
+
+/*
+ * The boot protocol uses two checksums over the image data:
+ * a XOR of all bytes (PSI/EBL CRC) and an additive sum of all bytes
+ * (bootloader command checksum, truncated to 16 bits by the caller).
+ *
+ * Each has a scalar reference kernel, a word-wide kernel and, where
+ * the compiler targets it, a NEON kernel. The fastest kernel which
+ * matches the scalar one on a self-check buffer is picked at runtime.
+ */
+
+/*
+ * @brief XOR of all bytes, using the selected kernel
+ *
+ * @param data [in] the data to checksum
+ * @param length [in] length of data in bytes
+ * @return XOR of all bytes
+ */
+uint8_t checksum_xor8(const void *data, size_t length);
+
+/*
+ * @brief Sum of all bytes modulo 2^32, using the selected kernel
+ *
+ * @param data [in] the data to checksum
+ * @param length [in] length of data in bytes
+ * @return sum of all bytes
+ */
+uint32_t checksum_sum8(const void *data, size_t length);
+
+/*
+ * @brief Reference byte-at-a-time kernels
+ */
+uint8_t checksum_xor8_scalar(const void *data, size_t length);
+uint32_t checksum_sum8_scalar(const void *data, size_t length);
+
+/*
+ * A kernel set as listed by checksum_kernels()
+ */
+typedef struct {
+	const char *name;
+	uint8_t (*xor8)(const void *data, size_t length);
+	uint32_t (*sum8)(const void *data, size_t length);
+} checksum_kernel;
+
+/*
+ * @brief Lists every kernel set this CPU can run, used by "make check"
+ *
+ * @param kernels [out] the kernel sets, scalar first
+ * @return number of kernel sets
+ */
+unsigned checksum_kernels(const checksum_kernel **kernels);
+
+/*
+ * @brief Selects the kernels used by checksum_xor8()/checksum_sum8()
+ *
+ * Called implicitly on first use, may be called early to keep the
+ * self-check out of the timed boot phases.
+ */
+void checksum_init(void);
+
+/*
+ * @brief Returns the name of the selected kernel set
+ *
+ * @return "neon", "word" or "scalar"
+ */
+const char *checksum_kernel_name(void);
+
+#endif //__CHECKSUM_H__
@@ -0,0 +1,93 @@
+/*
+ * checksum_worker.c: background checksum computation
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum_worker.h"
+#include "timing.h"
+#include "log.h"
+
+static void *checksum_worker_main(void *arg) {
+	checksum_worker *worker = (checksum_worker*)arg;
+	//in the order the upload needs them
+	static const enum xmm6260_image order[] = {
+		PSI, EBL, SECURE_IMAGE, FIRMWARE, NVDATA,
+	};
+	uint64_t start = timing_now_us();
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(order); i++) {
+		if (__atomic_load_n(&worker->stop, __ATOMIC_RELAXED)) {
+			break;
+		}
+
+		if (manifest_part_valid(worker->sums, order[i])) {
+			continue;
+		}
+
+		manifest_build_part(worker->sums, worker->data, worker->parts,
+			order[i]);
+		worker->parts_built++;
+	}
+
+	worker->busy_us = timing_now_us() - start;
+
+	return NULL;
+}
+
+int checksum_worker_start(checksum_worker *worker, image_checksums *sums,
+	char *const *data, const struct xmm6260_offset *parts)
+{
+	int ret;
+
+	memset(worker, 0, sizeof(*worker));
+	worker->sums = sums;
+	worker->data = data;
+	worker->parts = parts;
+
+	if ((ret = pthread_create(&worker->thread, NULL, checksum_worker_main,
+		worker)) != 0)
+	{
+		_e("failed to start checksum worker: %s", strerror(ret));
+		return -ret;
+	}
+
+	worker->running = true;
+
+	return 0;
+}
+
+void checksum_worker_join(checksum_worker *worker, bool cancel) {
+	if (!worker->running) {
+		return;
+	}
+
+	if (cancel) {
+		__atomic_store_n(&worker->stop, true, __ATOMIC_RELAXED);
+	}
+
+	pthread_join(worker->thread, NULL);
+	worker->running = false;
+
+	_i("checksum worker built %u parts in %llu us", worker->parts_built,
+		(unsigned long long)worker->busy_us);
+}
@@ -0,0 +1,74 @@
+/*
+ * checksum_worker.h: background checksum computation
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHECKSUM_WORKER_H__
+#define __CHECKSUM_WORKER_H__
+
+#include "common.h"
+#include "manifest.h"
+
+#include <pthread.h>
+
+/*
+ * Fills the checksum tables on a helper thread while the main thread
+ * is busy resetting the modem and doing the handshake. Every component
+ * is published as soon as it is complete (manifest_part_valid()); the
+ * upload uses the published values and computes the rest inline, so it
+ * never waits for the worker.
+ */
+typedef struct {
+	pthread_t thread;
+	bool running;
+	bool stop;
+
+	image_checksums *sums;
+	char *const *data;
+	const struct xmm6260_offset *parts;
+
+	uint64_t busy_us;
+	unsigned parts_built;
+} checksum_worker;
+
+/*
+ * @brief Starts computing all checksum tables not yet valid
+ *
+ * @param worker [out] the worker state
+ * @param sums [in] the checksum tables to fill
+ * @param data [in] mapping of every component, by enum xmm6260_image
+ * @param parts [in] the board firmware component table
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int checksum_worker_start(checksum_worker *worker, image_checksums *sums,
+	char *const *data, const struct xmm6260_offset *parts);
+
+/*
+ * @brief Waits for the worker to finish
+ *
+ * @param worker [in] the worker state
+ * @param cancel [in] stop after the component currently being built
+ */
+void checksum_worker_join(checksum_worker *worker, bool cancel);
+
+#endif //__CHECKSUM_WORKER_H__
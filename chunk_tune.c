@@ -0,0 +1,156 @@
+/*
+ * chunk_tune.c: per board tuning of the secure image block size
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_tune.h"
+#include "log.h"
+
+int chunk_tune_init(chunk_tune *tune, const char *path,
+	const uint32_t *sizes, unsigned count)
+{
+	struct utsname uts;
+	unsigned i;
+
+	memset(tune, 0, sizeof(*tune));
+
+	if (!count || count > CHUNK_TUNE_MAX_SIZES) {
+		_e("invalid number of chunk sizes %u", count);
+		return -EINVAL;
+	}
+
+	snprintf(tune->path, sizeof(tune->path), "%s", path);
+	if (uname(&uts) == 0) {
+		snprintf(tune->kernel, sizeof(tune->kernel), "%s", uts.release);
+	}
+	else {
+		snprintf(tune->kernel, sizeof(tune->kernel), "unknown");
+	}
+
+	tune->count = count;
+	for (i = 0; i < count; i++) {
+		tune->samples[i].size = sizes[i];
+	}
+
+	return 0;
+}
+
+uint32_t chunk_tune_load(chunk_tune *tune) {
+	uint32_t fallback = tune->samples[0].size;
+	char kernel[sizeof(tune->kernel)];
+	unsigned size;
+	unsigned i;
+
+	FILE *file = fopen(tune->path, "r");
+	if (!file) {
+		_d("no tuned chunk size in %s", tune->path);
+		return fallback;
+	}
+
+	int count = fscanf(file, "%64s %u", kernel, &size);
+	fclose(file);
+
+	if (count != 2) {
+		_e("malformed chunk size file %s", tune->path);
+		return fallback;
+	}
+
+	if (strcmp(kernel, tune->kernel)) {
+		_i("chunk size was tuned on kernel %s, running %s", kernel,
+			tune->kernel);
+		return fallback;
+	}
+
+	for (i = 0; i < tune->count; i++) {
+		if (tune->samples[i].size == size) {
+			_d("using tuned chunk size 0x%x", size);
+			return size;
+		}
+	}
+
+	_e("tuned chunk size 0x%x is not accepted by the bootloader", size);
+	return fallback;
+}
+
+void chunk_tune_record(chunk_tune *tune, unsigned index,
+	uint64_t bytes, uint64_t time_us)
+{
+	if (index >= tune->count) {
+		return;
+	}
+
+	tune->samples[index].bytes += bytes;
+	tune->samples[index].time_us += time_us;
+}
+
+int chunk_tune_save(chunk_tune *tune) {
+	char tmp_path[PATH_MAX + sizeof(".tmp")];
+	chunk_sample *best = NULL;
+	unsigned i;
+
+	_r("chunk size calibration (kernel %s)", tune->kernel);
+	_r("  %-10s %12s %12s %10s", "chunk", "bytes", "took ms", "kB/s");
+	for (i = 0; i < tune->count; i++) {
+		chunk_sample *s = tune->samples + i;
+		if (!s->time_us) {
+			continue;
+		}
+
+		uint64_t rate = s->bytes * 1000 / s->time_us;
+		_r("  0x%-8x %12llu %8llu.%03llu %10llu", s->size,
+			(unsigned long long)s->bytes,
+			(unsigned long long)(s->time_us / 1000),
+			(unsigned long long)(s->time_us % 1000),
+			(unsigned long long)rate);
+
+		//compare bytes per time without dividing: a/b > c/d
+		if (!best || s->bytes * best->time_us > best->bytes * s->time_us) {
+			best = s;
+		}
+	}
+
+	if (!best) {
+		_e("no chunk size was measured");
+		return -EINVAL;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", tune->path);
+	FILE *file = fopen(tmp_path, "w");
+	if (!file) {
+		_e("failed to create %s: %s", tmp_path, strerror(errno));
+		return -errno;
+	}
+
+	bool ok = fprintf(file, "%s %u\n", tune->kernel, best->size) > 0;
+	ok = (fflush(file) == 0) && ok;
+	ok = (fsync(fileno(file)) == 0) && ok;
+	fclose(file);
+
+	if (!ok || rename(tmp_path, tune->path) < 0) {
+		_e("failed to store chunk size in %s", tune->path);
+		unlink(tmp_path);
+		return -EIO;
+	}
+
+	_i("stored chunk size 0x%x in %s", best->size, tune->path);
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * chunk_tune.h: per board tuning of the secure image block size
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHUNK_TUNE_H__
+#define __CHUNK_TUNE_H__
+
+#include "common.h"
+
+#include <limits.h>
+#include <sys/utsname.h>
+
+#define CHUNK_TUNE_MAX_SIZES 8
+
+/*
+ * How the ReqFlashWriteBlock size is chosen
+ */
+enum chunk_mode {
+	CHUNK_MODE_DEFAULT, //same as CHUNK_MODE_TUNED
+	CHUNK_MODE_FIXED, //always use the board default
+	CHUNK_MODE_TUNED, //use the calibrated size if one is stored
+	CHUNK_MODE_CALIBRATE, //measure every size during the FIRMWARE upload
+};
+
+typedef struct {
+	uint32_t size;
+	uint64_t bytes;
+	uint64_t time_us;
+} chunk_sample;
+
+typedef struct {
+	char path[PATH_MAX];
+	char kernel[sizeof(((struct utsname*)0)->release)];
+	unsigned count;
+	chunk_sample samples[CHUNK_TUNE_MAX_SIZES];
+} chunk_tune;
+
+/* 
+ * @brief Prepares the tuning state of a board
+ *
+ * @param tune [out] tuning state
+ * @param path [in] file the tuned size is stored in
+ * @param sizes [in] block sizes the bootloader accepts, the first one
+ *                   is the board default
+ * @param count [in] number of entries in sizes
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int chunk_tune_init(chunk_tune *tune, const char *path,
+	const uint32_t *sizes, unsigned count);
+
+/* 
+ * @brief Returns the stored block size for the running kernel
+ *
+ * The stored value is ignored if it was measured on another kernel
+ * or is not one of the accepted sizes.
+ *
+ * @param tune [in] tuning state
+ * @return the tuned block size or the board default
+ */
+uint32_t chunk_tune_load(chunk_tune *tune);
+
+/* 
+ * @brief Adds a measurement for one of the sizes
+ *
+ * @param tune [in] tuning state
+ * @param index [in] index into the sizes passed to chunk_tune_init
+ * @param bytes [in] how much data was sent
+ * @param time_us [in] how long it took including the ACKs
+ */
+void chunk_tune_record(chunk_tune *tune, unsigned index,
+	uint64_t bytes, uint64_t time_us);
+
+/* 
+ * @brief Prints the measurements and stores the fastest size
+ *
+ * @param tune [in] tuning state
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int chunk_tune_save(chunk_tune *tune);
+
+#endif //__CHUNK_TUNE_H__
@@ -25,7 +25,6 @@
  * I9100 specific implementation
  */
 #define RADIO_IMAGE "/dev/block/mmcblk0p8"
-#define NVDATA_IMAGE "/efs/nv_data.bin"
 #define I9100_EHCI_PATH "/sys/devices/platform/s5p-ehci/ehci_power"
 
 #define LINK_POLL_DELAY_US (50 * 1000)
@@ -43,8 +42,17 @@
 #define BL_RESET_MAGIC "\x01\x10\x11\x00" 
 #define BL_RESET_MAGIC_LEN 4
 
+#define I9100_IMAGE_CHUNK 0x10000
 #define SEC_DOWNLOAD_CHUNK 16384
+
+//every frame is padded to the 0x4000 ReqFlashWriteBlock size anyway
+static const uint32_t i9100_sec_chunks[] = {
+	SEC_DOWNLOAD_CHUNK,
+};
 #define SEC_DOWNLOAD_DELAY_US (500 * 1000)
+//ReqFlashWriteBlock is not ACKed here and nothing else tells when the
+//modem is done, so the full delay stays the default; -w select is opt-in
+#define I9100_SEC_WAIT_MODE SEC_WAIT_DELAY
 
 #define POST_BOOT_TIMEOUT_US (600 * 1000)
 
@@ -54,10 +62,7 @@
 /*
  * Locations of the firmware components in the Samsung firmware
  */
-static struct xmm6260_offset {
-	size_t offset;
-	size_t length;
-} i9100_radio_parts[] = {
+static const struct xmm6260_offset i9100_radio_parts[XMM6260_IMAGE_MAX] = {
 	[PSI] = {
 		.offset = 0,
 		.length = 0xf000,
@@ -117,6 +122,13 @@ struct {
 	},
 };
 
+#define I9100_CMD_SIZE_MAX 0x4000
+
+static const char i9100_cmd_padding[I9100_CMD_SIZE_MAX];
+
+//only the reply of a single command is ever held
+#define I9100_ARENA_SIZE I9100_CMD_SIZE_MAX
+
 typedef struct {
 	uint8_t magic;
 	uint16_t length;
@@ -142,27 +154,20 @@ static int send_image(fwloader_context *ctx, enum xmm6260_image type) {
 	}
 
 	size_t length = i9100_radio_parts[type].length;
-	size_t offset = i9100_radio_parts[type].offset;
 
-	size_t start = offset;
-	size_t end = length + start;
+	unsigned char crc = 0;
 
 	//dump some image bytes
 	_d("image start");
-	hexdump(ctx->radio_data + start, length);
+	hexdump(ctx->part_data[type], length);
 
-	while (start < end) {
-		ret = write(ctx->boot_fd, ctx->radio_data + start, end - start);
-		if (ret < 0) {
-			_d("failed to write image chunk");
-			goto fail;
-		}
-		start += ret;
+	if ((ret = modemctl_send_raw_image(ctx, type, I9100_IMAGE_CHUNK, &crc)) < 0)
+	{
+		_d("failed to write image");
+		goto fail;
 	}
 
-	unsigned char crc = calculateCRC(ctx->radio_data, offset, length);
-
-	if ((ret = write(ctx->boot_fd, &crc, 1)) < 1) {
+	if ((ret = write_all(ctx->boot_fd, &crc, 1)) < 1) {
 		_d("failed to write CRC");
 		goto fail;
 	}
@@ -186,7 +191,7 @@ static int send_PSI(fwloader_context *ctx) {
 	};
 	int ret = -1;
 	
-	if ((ret = write(ctx->boot_fd, &hdr, sizeof(hdr))) != sizeof(hdr)) {
+	if ((ret = write_all(ctx->boot_fd, &hdr, sizeof(hdr))) != sizeof(hdr)) {
 		_d("%s: failed to write header, ret %d", __func__, ret);
 		goto fail;
 	}
@@ -196,27 +201,28 @@ static int send_PSI(fwloader_context *ctx) {
 		goto fail;
 	}
 
+	char acks[22];
+	if ((ret = receive_exact(&ctx->boot_rx, acks, sizeof(acks))) < 0) {
+		_d("failed to read PSI ACK bytes");
+		goto fail;
+	}
+
 	int i;
-	for (i = 0; i < 22; i++) {
-		char ack;
-		if (receive(ctx->boot_fd, &ack, 1) < 1) {
-			_d("failed to read ACK byte %d", i);
-			goto fail;
-		}
-		_d("%02x ", ack);
+	for (i = 0; i < sizeof(acks); i++) {
+		_d("%02x ", acks[i]);
 	}
 
-	if ((ret = expect_data(ctx->boot_fd, "\x1", 1)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, "\x1", 1)) < 0) {
 		_d("failed to wait for first ACK");
 		goto fail;
 	}
 
-	if ((ret = expect_data(ctx->boot_fd, "\x1", 1)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, "\x1", 1)) < 0) {
 		_d("failed to wait for second ACK");
 		goto fail;
 	}
 	
-	if ((ret = expect_data(ctx->boot_fd, PSI_ACK_MAGIC, 2)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, PSI_ACK_MAGIC, 2)) < 0) {
 		_e("failed to receive PSI ACK");
 		goto fail;
 	}
@@ -235,12 +241,12 @@ static int send_EBL(fwloader_context *ctx) {
 	int fd = ctx->boot_fd;
 	unsigned length = i9100_radio_parts[EBL].length;
 
-	if ((ret = write(fd, &length, sizeof(length))) < 0) {
+	if ((ret = write_all(fd, &length, sizeof(length))) < 0) {
 		_e("failed to write EBL length");
 		goto fail;
 	}
 
-	if ((ret = expect_data(fd, EBL_HDR_ACK_MAGIC, 2)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, EBL_HDR_ACK_MAGIC, 2)) < 0) {
 		_e("failed to wait for EBL header ACK");
 		goto fail;
 	}
@@ -250,7 +256,7 @@ static int send_EBL(fwloader_context *ctx) {
 		goto fail;
 	}
 	
-	if ((ret = expect_data(fd, EBL_IMG_ACK_MAGIC, 2)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, EBL_IMG_ACK_MAGIC, 2)) < 0) {
 		_e("failed to wait for EBL image ACK");
 		goto fail;
 	}
@@ -261,11 +267,17 @@ fail:
 	return ret;
 }
 
-static int bootloader_cmd(fwloader_context *ctx, enum xmm6260_boot_cmd cmd,
-	void *data, size_t data_size)
+/*
+ * data_sum is the byte sum of data when it is already known
+ * (checksum cache), otherwise it is computed here
+ */
+static int bootloader_cmd_sum(fwloader_context *ctx,
+	enum xmm6260_boot_cmd cmd, void *data, size_t data_size,
+	const uint16_t *data_sum)
 {
 	int ret = 0;
 	char *cmd_data = 0;
+	size_t arena_pos = arena_mark(&ctx->arena);
 	if (cmd >= ARRAY_SIZE(i9100_boot_cmd_desc)) {
 		_e("bad command %x\n", cmd);
 		goto done_or_fail;
@@ -274,11 +286,7 @@ static int bootloader_cmd(fwloader_context *ctx, enum xmm6260_boot_cmd cmd,
 	unsigned cmd_code = i9100_boot_cmd_desc[cmd].code;
 
 	uint16_t magic = (data_size & 0xffff) + cmd_code;
-	unsigned char *ptr = (unsigned char*)data;
-	size_t i;
-	for (i = 0; i < data_size; i++) {
-		magic += ptr[i];
-	}
+	magic += data_sum ? *data_sum : checksum_sum8(data, data_size);
 
 	bootloader_cmd_t header = {
 		.check = magic,
@@ -289,20 +297,24 @@ static int bootloader_cmd(fwloader_context *ctx, enum xmm6260_boot_cmd cmd,
 	size_t cmd_size = i9100_boot_cmd_desc[cmd].data_size;
 	size_t buf_size = cmd_size + sizeof(header);
 
-	cmd_data = (char*)malloc(buf_size);
-	if (!cmd_data) {
-		_e("failed to allocate command buffer");
-		ret = -ENOMEM;
+	if (data_size > cmd_size) {
+		_e("command %x data size %zu exceeds %zu", cmd_code, data_size, cmd_size);
+		ret = -EINVAL;
 		goto done_or_fail;
 	}
-	memset(cmd_data, 0, buf_size);
-	memcpy(cmd_data, &header, sizeof(header));
-	memcpy(cmd_data + sizeof(header), data, data_size);
+
+	//the frame is zero padded to the fixed command size
+	struct iovec iov[] = {
+		{ .iov_base = &header, .iov_len = sizeof(header), },
+		{ .iov_base = data, .iov_len = data_size, },
+		{ .iov_base = (void*)i9100_cmd_padding, .iov_len = cmd_size - data_size, },
+	};
 
 	_d("bootloader cmd packet");
-	hexdump(cmd_data, buf_size);
+	hexdump(&header, sizeof(header));
+	hexdump(data, data_size);
 
-	if ((ret = write(ctx->boot_fd, cmd_data, buf_size)) < 0) {
+	if ((ret = write_iov(ctx->boot_fd, iov, ARRAY_SIZE(iov))) < 0) {
 		_e("failed to write command to socket");
 		goto done_or_fail;
 	}
@@ -320,10 +332,17 @@ static int bootloader_cmd(fwloader_context *ctx, enum xmm6260_boot_cmd cmd,
 		goto done_or_fail;
 	}
 
+	cmd_data = (char*)arena_claim(&ctx->arena, cmd_size);
+	if (!cmd_data) {
+		_e("failed to claim reply buffer");
+		ret = -ENOMEM;
+		goto done_or_fail;
+	}
+
 	bootloader_cmd_t ack = {
 		.check = 0,
 	};
-	if ((ret = receive(ctx->boot_fd, &ack, sizeof(ack))) < 0) {
+	if ((ret = receive_exact(&ctx->boot_rx, &ack, sizeof(ack))) < 0) {
 		_e("failed to receive ack for cmd %x", header.cmd);
 		goto done_or_fail;
 	}
@@ -342,7 +361,7 @@ static int bootloader_cmd(fwloader_context *ctx, enum xmm6260_boot_cmd cmd,
 		goto done_or_fail;
 	}
 
-	if ((ret = receive(ctx->boot_fd, cmd_data, cmd_size)) < 0) {
+	if ((ret = receive_exact(&ctx->boot_rx, cmd_data, cmd_size)) < 0) {
 		_e("failed to receive reply data");
 		goto done_or_fail;
 	}
@@ -355,19 +374,22 @@ static int bootloader_cmd(fwloader_context *ctx, enum xmm6260_boot_cmd cmd,
 	hexdump(cmd_data, cmd_size);
 
 done_or_fail:
-
-	if (cmd_data) {
-		free(cmd_data);
-	}
+	arena_release(&ctx->arena, arena_pos);
 
 	return ret;
 }
 
+static int bootloader_cmd(fwloader_context *ctx, enum xmm6260_boot_cmd cmd,
+	void *data, size_t data_size)
+{
+	return bootloader_cmd_sum(ctx, cmd, data, data_size, NULL);
+}
+
 static int ack_BootInfo(fwloader_context *ctx) {
 	int ret;
 	boot_info_t info;
 	
-	if ((ret = receive(ctx->boot_fd, &info, sizeof(info))) != sizeof(info)) {
+	if ((ret = receive_exact(&ctx->boot_rx, &info, sizeof(info))) != sizeof(info)) {
 		_e("failed to receive Boot Info ret=%d", ret);
 		ret = -1;
 		goto fail;
@@ -391,6 +413,54 @@ fail:
 	return ret;
 }
 
+/*
+ * Sends the blocks stop-and-wait. A block that cannot be sent or is
+ * not ACKed is resent after a new ReqFlashSetAddress, up to
+ * SEC_BLOCK_RETRY_MAX times per image.
+ */
+static int send_secure_blocks(fwloader_context *ctx,
+	enum xmm6260_image type, size_t from, size_t to, uint32_t max_chunk)
+{
+	int ret = 0;
+	char *image = ctx->part_data[type];
+	char *start = image + from;
+	char *end = image + to;
+	unsigned retries = 0;
+
+	while (start < end) {
+		unsigned rest = end - start;
+		unsigned chunk = rest < max_chunk ? rest : max_chunk;
+		size_t block = start - image;
+		uint16_t sum = modemctl_block_sum(ctx, type, block, chunk);
+
+		ret = bootloader_cmd_sum(ctx, ReqFlashWriteBlock, start, chunk, &sum);
+		while (ret < 0) {
+			_e("failed to send data chunk");
+			if ((ret = modemctl_block_retry(ctx, type, block, &retries,
+				ret)) < 0)
+			{
+				goto fail;
+			}
+
+			uint32_t addr = ctx->sec_load_addr + block;
+			if ((ret = bootloader_cmd(ctx, ReqFlashSetAddress, &addr, 4)) == 0) {
+				ret = bootloader_cmd_sum(ctx, ReqFlashWriteBlock, start,
+					chunk, &sum);
+			}
+		}
+
+		timing_block(&ctx->timing);
+		start += chunk;
+	}
+
+fail:
+	return ret;
+}
+
+static int i9100_set_address(fwloader_context *ctx, uint32_t addr) {
+	return bootloader_cmd(ctx, ReqFlashSetAddress, &addr, 4);
+}
+
 static int send_image_addr(fwloader_context *ctx, uint32_t addr,
 	enum xmm6260_image type)
 {
@@ -402,27 +472,15 @@ static int send_image_addr(fwloader_context *ctx, uint32_t addr,
 	else {
 		_d("sent ReqFlashSetAddress");
 	}
+	ctx->sec_load_addr = addr;
 
-	uint32_t offset = i9100_radio_parts[type].offset;
-	uint32_t length = i9100_radio_parts[type].length;
-
-	char *start = ctx->radio_data + offset;
-	char *end = start + length;
-
-	while (start < end) {
-		unsigned rest = end - start;
-		unsigned chunk = rest < SEC_DOWNLOAD_CHUNK ? rest : SEC_DOWNLOAD_CHUNK;
-
-		ret = bootloader_cmd(ctx, ReqFlashWriteBlock, start, chunk);
-		if (ret < 0) {
-			_e("failed to send data chunk");
-			goto fail;
-		}
-
-		start += chunk;
+	if ((ret = modemctl_send_secure_blocks(ctx, type, send_secure_blocks,
+		i9100_set_address)) < 0)
+	{
+		goto fail;
 	}
 
-	usleep(SEC_DOWNLOAD_DELAY_US);
+	ret = modemctl_wait_sec_download(ctx, SEC_DOWNLOAD_DELAY_US);
 
 fail:
 	return ret;
@@ -431,18 +489,23 @@ fail:
 static int send_SecureImage(fwloader_context *ctx) {
 	int ret = 0;
 
-	uint32_t sec_off = i9100_radio_parts[SECURE_IMAGE].offset;
 	uint32_t sec_len = i9100_radio_parts[SECURE_IMAGE].length;
-	void *sec_img = ctx->radio_data + sec_off;
+	void *sec_img = ctx->part_data[SECURE_IMAGE];
 	
-	if ((ret = bootloader_cmd(ctx, ReqSecStart, sec_img, sec_len)) < 0) {
+	timing_begin(&ctx->timing, PHASE_SEC_START);
+	uint16_t sec_sum = modemctl_block_sum(ctx, SECURE_IMAGE, 0, sec_len);
+	if ((ret = bootloader_cmd_sum(ctx, ReqSecStart, sec_img, sec_len,
+		&sec_sum)) < 0)
+	{
 		_e("failed to write ReqSecStart");
 		goto fail;
 	}
 	else {
 		_d("sent ReqSecStart");
 	}
+	timing_end(&ctx->timing, PHASE_SEC_START);
 
+	timing_begin(&ctx->timing, PHASE_FIRMWARE);
 	if ((ret = send_image_addr(ctx, FW_LOAD_ADDR, FIRMWARE)) < 0) {
 		_e("failed to send FIRMWARE image");
 		goto fail;
@@ -450,7 +513,9 @@ static int send_SecureImage(fwloader_context *ctx) {
 	else {
 		_d("sent FIRMWARE image");
 	}
+	timing_end(&ctx->timing, PHASE_FIRMWARE);
 	
+	timing_begin(&ctx->timing, PHASE_NVDATA);
 	if ((ret = send_image_addr(ctx, NVDATA_LOAD_ADDR, NVDATA)) < 0) {
 		_e("failed to send NVDATA image");
 		goto fail;
@@ -458,7 +523,9 @@ static int send_SecureImage(fwloader_context *ctx) {
 	else {
 		_d("sent NVDATA image");
 	}
+	timing_end(&ctx->timing, PHASE_NVDATA);
 
+	timing_begin(&ctx->timing, PHASE_SEC_END);
 	if ((ret = bootloader_cmd(ctx, ReqSecEnd,
 		BL_END_MAGIC, BL_END_MAGIC_LEN)) < 0)
 	{
@@ -478,6 +545,7 @@ static int send_SecureImage(fwloader_context *ctx) {
 	else {
 		_d("sent ReqForceHwReset");
 	}
+	timing_end(&ctx->timing, PHASE_SEC_END);
 
 fail:
 	return ret;
@@ -490,19 +558,20 @@ fail:
 /*
  * Power management
  */
-static int i9100_ehci_setpower(bool enabled) {
+static int i9100_ehci_setpower(fwloader_context *ctx, bool enabled) {
 	int ret = -1;
+	const char *path = modemctl_path(ctx, FWLOADER_PATH_EHCI, I9100_EHCI_PATH);
 	
 	_d("%s: enabled=%d", __func__, enabled);
 	
-	int ehci_fd = open(I9100_EHCI_PATH, O_RDWR);
+	int ehci_fd = open(path, O_RDWR);
 	if (ehci_fd < 0) {
 		_e("failed to open EHCI fd");
 		ret = -ENODEV;
 		goto fail;
 	}
 	else {
-		_d("opened EHCI %s: fd=%d", I9100_EHCI_PATH, ehci_fd);
+		_d("opened EHCI %s: fd=%d", path, ehci_fd);
 	}
 
 	ret = write(ehci_fd, enabled ? "1" : "0", 1);
@@ -558,7 +627,7 @@ static int reboot_modem_i9100(fwloader_context *ctx, bool hard) {
 		_d("disabled I9100 HSIC link");
 	}
 	
-	if ((ret = i9100_ehci_setpower(false)) < 0) {
+	if ((ret = i9100_ehci_setpower(ctx, false)) < 0) {
 		_e("failed to disable I9100 EHCI");
 		goto fail;
 	}
@@ -586,7 +655,7 @@ static int reboot_modem_i9100(fwloader_context *ctx, bool hard) {
 		_d("enabled I9100 HSIC link");
 	}
 	
-	if ((ret = i9100_ehci_setpower(true)) < 0) {
+	if ((ret = i9100_ehci_setpower(ctx, true)) < 0) {
 		_e("failed to enable I9100 EHCI");
 		goto fail;
 	}
@@ -624,142 +693,166 @@ fail:
 	return ret;
 }
 
-int boot_modem_i9100(void) {
-	int ret = 0;
-	fwloader_context ctx;
-	memset(&ctx, 0, sizeof(ctx));
+int i9100_write_block(fwloader_context *ctx, void *data, size_t size) {
+	return bootloader_cmd(ctx, ReqFlashWriteBlock, data, size);
+}
 
-	ctx.radio_fd = open(RADIO_IMAGE, O_RDONLY);
-	if (ctx.radio_fd < 0) {
-		_e("failed to open radio firmware");
-		goto fail;
+static int i9100_setup(fwloader_context *ctx) {
+	int ret;
+	const fwloader_options *opts = ctx->opts;
+	ctx->parts = i9100_radio_parts;
+	ctx->sec_wait = opts->sec_wait ? opts->sec_wait : I9100_SEC_WAIT_MODE;
+
+	if ((ret = arena_init(&ctx->arena, I9100_ARENA_SIZE
+		+ modemctl_erased_table_size(i9100_radio_parts, i9100_sec_chunks,
+		ARRAY_SIZE(i9100_sec_chunks)))) < 0)
+	{
+		return ret;
+	}
+
+	const char *link_path = modemctl_path(ctx, FWLOADER_PATH_LINK, LINK_PM);
+	ctx->link_fd = open(link_path, O_RDWR);
+	if (ctx->link_fd < 0) {
+		_e("failed to open link device");
+		return -errno;
 	}
 	else {
-		_d("opened radio image %s, fd=%d", RADIO_IMAGE, ctx.radio_fd);
+		_d("opened link device %s, fd=%d", link_path, ctx->link_fd);
 	}
 
-	if (fstat(ctx.radio_fd, &ctx.radio_stat) < 0) {
-		_e("failed to stat radio image, error %s", strerror(errno));
-		goto fail;
-	}
+	return 0;
+}
 
-	ctx.radio_data = mmap(0, RADIO_MAP_SIZE, PROT_READ, MAP_SHARED,
-		ctx.radio_fd, 0);
-	if (ctx.radio_data == MAP_FAILED) {
-		_e("failed to mmap radio image, error %s", strerror(errno));
-		goto fail;
-	}
+/*
+ * With the HSIC link still connected, EHCI stays up and the modem only
+ * has to enumerate again after its reset line was pulsed
+ */
+static int i9100_warm_reset(fwloader_context *ctx) {
+	int ret;
 
-	ctx.boot_fd = open(BOOT_DEV, O_RDWR | O_NOCTTY | O_NONBLOCK);
-	if (ctx.boot_fd < 0) {
-		_e("failed to open boot device");
-		goto fail;
-	}
-	else {
-		_d("opened boot device %s, fd=%d", BOOT_DEV, ctx.boot_fd);
+	if ((ret = modemctl_link_set_active(ctx, false)) < 0) {
+		_e("failed to deactivate I9100 HSIC link");
+		return ret;
 	}
 
-	ctx.link_fd = open(LINK_PM, O_RDWR);
-	if (ctx.link_fd < 0) {
-		_e("failed to open link device");
-		goto fail;
+	if ((ret = modemctl_modem_reset(ctx)) < 0) {
+		_e("failed to reset xmm6260");
+		return ret;
 	}
 	else {
-		_d("opened link device %s, fd=%d", LINK_PM, ctx.link_fd);
+		_d("reset xmm6260");
 	}
 
-	if (reboot_modem_i9100(&ctx, true)) {
-		_e("failed to hard reset modem");
-		goto fail;
+	if ((ret = modemctl_link_set_active(ctx, true)) < 0) {
+		_e("failed to activate I9100 HSIC link");
+		return ret;
 	}
-	else {
-		_d("modem hard reset done");
+
+	if ((ret = modemctl_wait_link_ready(ctx)) < 0) {
+		_e("link did not come back after the reset");
+		return ret;
 	}
 
-	/*
-	 * Now, actually load the firmware
-	 */
-	if (write(ctx.boot_fd, "ATAT", 4) != 4) {
+	return 0;
+}
+
+static int i9100_cold_reset(fwloader_context *ctx) {
+	return reboot_modem_i9100(ctx, true);
+}
+
+static int i9100_hard_reset(fwloader_context *ctx) {
+	return modemctl_hard_reset(ctx, i9100_warm_reset, i9100_cold_reset);
+}
+
+static int i9100_atat(fwloader_context *ctx) {
+	int ret;
+	if ((ret = write_all(ctx->boot_fd, "ATAT", 4)) != 4) {
 		_e("failed to write ATAT to boot socket");
-		goto fail;
+		return ret;
 	}
 	else {
 		_d("written ATAT to boot socket, waiting for ACK");
 	}
 
 	char buf[2];
-	if (receive(ctx.boot_fd, buf, 1) < 0) {
-		_e("failed to receive bootloader ACK");
-		goto fail;
-	}
-	if (receive(ctx.boot_fd, buf + 1, 1) < 0) {
-		_e("failed to receive chip IP ACK");
-		goto fail;
+	if ((ret = receive_exact(&ctx->boot_rx, buf, sizeof(buf))) < 0) {
+		_e("failed to receive bootloader and chip ID ACK");
+		return ret;
 	}
 	_i("receive ID: [%02x %02x]", buf[0], buf[1]);
 
-	if ((ret = send_PSI(&ctx)) < 0) {
-		_e("failed to upload PSI");
-		goto fail;
-	}
-	else {
-		_d("PSI download complete");
-	}
+	return 0;
+}
 
-	if ((ret = send_EBL(&ctx)) < 0) {
-		_e("failed to upload EBL");
-		goto fail;
+static int i9100_wait_online(fwloader_context *ctx) {
+	int ret;
+	usleep(POST_BOOT_TIMEOUT_US);
+
+	if ((ret = reboot_modem_i9100(ctx, false))) {
+		_e("failed to soft reset modem");
+		return ret < 0 ? ret : -EIO;
 	}
 	else {
-		_d("EBL download complete");
+		_d("modem soft reset done");
 	}
 
-	if ((ret = ack_BootInfo(&ctx)) < 0) {
-		_e("failed to receive Boot Info");
-		goto fail;
-	}
-	else {
-		_d("Boot Info ACK done");
+	return 0;
+}
+
+static const fwloader_step i9100_steps[] = {
+	{ PHASE_HARD_RESET, "hard reset", i9100_hard_reset },
+	{ PHASE_ATAT, "ATAT handshake", i9100_atat },
+	{ PHASE_PSI, "PSI upload", send_PSI },
+	{ PHASE_EBL, "EBL upload", send_EBL },
+	{ PHASE_BOOT_INFO, "Boot Info", ack_BootInfo },
+	//times its own FIRMWARE/NVDATA phases
+	{ PHASE_MAX, "Secure Image", send_SecureImage, true },
+	{ PHASE_WAIT_ONLINE, "wait online", i9100_wait_online },
+};
+
+static int i9100_boot(fwloader_context *ctx) {
+	int ret = -1;
+	timing_init(&ctx->timing);
+	ctx->boot_rx.reads = 0;
+
+	//left open by the previous boot to watch the modem status
+	if (ctx->boot_fd >= 0) {
+		close(ctx->boot_fd);
 	}
 
-	if ((ret = send_SecureImage(&ctx)) < 0) {
-		_e("failed to upload Secure Image");
+	const char *boot_path = modemctl_path(ctx, FWLOADER_PATH_BOOT, BOOT_DEV);
+	ctx->boot_fd = open(boot_path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (ctx->boot_fd < 0) {
+		_e("failed to open boot device");
 		goto fail;
 	}
 	else {
-		_d("Secure Image download complete");
+		_d("opened boot device %s, fd=%d", boot_path, ctx->boot_fd);
 	}
+	rx_buffer_init(&ctx->boot_rx, ctx->boot_fd);
 
-	usleep(POST_BOOT_TIMEOUT_US);
-
-	if ((ret = reboot_modem_i9100(&ctx, false))) {
-		_e("failed to soft reset modem");
+	if ((ret = modemctl_run_steps(ctx, i9100_steps,
+		ARRAY_SIZE(i9100_steps))) < 0)
+	{
 		goto fail;
 	}
-	else {
-		_d("modem soft reset done");
-	}
 
 	_i("online");
-	ret = 0;
 
 fail:
-	if (ctx.radio_data != MAP_FAILED) {
-		munmap(ctx.radio_data, RADIO_MAP_SIZE);
-	}
-
-	if (ctx.link_fd >= 0) {
-		close(ctx.link_fd);
-	}
-
-	if (ctx.radio_fd >= 0) {
-		close(ctx.radio_fd);
-	}
-
-	if (ctx.boot_fd >= 0) {
-		close(ctx.boot_fd);
-	}
-
 	return ret;
 }
 
+static const fwloader_board i9100_board = {
+	.name = "i9100",
+	.title = "I9100",
+	.radio_path = RADIO_IMAGE,
+	.chunks = i9100_sec_chunks,
+	.chunk_count = ARRAY_SIZE(i9100_sec_chunks),
+	.setup = i9100_setup,
+	.boot = i9100_boot,
+};
+
+int boot_modem_i9100(const fwloader_options *opts) {
+	return modemctl_run(&i9100_board, opts);
+}
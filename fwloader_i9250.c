@@ -30,6 +30,21 @@
 #define I9250_BOOT_LAST_MARKER 0x0030ffff
 #define I9250_BOOT_REPLY_MAX 20
 
+/*
+ * ATAT is resent after each of these waits (ms) until the boot ROM
+ * answers, so a ROM that is already up costs one round trip and one
+ * that is still starting is polled often at first
+ */
+static const unsigned i9250_atat_retry_ms[] = { 2, 5, 10, 20, 50, 100, 200, };
+
+/*
+ * Scratch space: the Boot Info stays claimed while the SetPortConf
+ * ACK is received, nothing else is held across commands
+ */
+#define I9250_BOOT_INFO_MAX 0x1000
+#define I9250_ACK_MAX 0x1000
+#define I9250_ARENA_SIZE (I9250_BOOT_INFO_MAX + I9250_ACK_MAX + 16)
+
 #define I9250_GENERAL_ACK "\x02\x00\x00\x00"
 
 #define I9250_PSI_START_MAGIC "\xff\xf0\x00\x30"
@@ -44,8 +59,19 @@
 #define I9250_MPS_LOAD_ADDR 0x61080000
 #define I9250_MPS_LENGTH 3
 
+#define I9250_IMAGE_CHUNK 0xdfc
 #define SEC_DOWNLOAD_CHUNK 0xdfc2
+
+//ReqFlashWriteBlock sizes tried by the calibration, the default first
+static const uint32_t i9250_sec_chunks[] = {
+	SEC_DOWNLOAD_CHUNK, 0x4000, 0x8000, 0xc000,
+};
 #define SEC_DOWNLOAD_DELAY_US (500 * 1000)
+//the last ReqFlashWriteBlock ACK may well mean the image is in, but
+//until that is proven on a device -w ack is opt-in and the delay stays
+#define I9250_SEC_WAIT_MODE SEC_WAIT_DELAY
+//largest number of ReqFlashWriteBlock commands in flight
+#define I9250_SEC_WINDOW_MAX 8
 
 	#define FW_LOAD_ADDR 0x60300000
 #define NVDATA_LOAD_ADDR 0x60e80000
@@ -87,10 +113,7 @@ bootloader_cmd_tail_t name = {\
 /*
  * Locations of the firmware components in the Samsung firmware
  */
-static struct xmm6260_offset {
-	size_t offset;
-	size_t length;
-} i9250_radio_parts[] = {
+static const struct xmm6260_offset i9250_radio_parts[XMM6260_IMAGE_MAX] = {
 	[PSI] = {
 		.offset = 0,
 		.length = 0xf000,
@@ -206,33 +229,22 @@ static int send_image_i9250(fwloader_context *ctx, enum xmm6260_image type) {
 	}
 
 	size_t length = i9250_radio_parts[type].length;
-	size_t offset = i9250_radio_parts[type].offset;
 
-	size_t start = offset;
-	size_t end = length + start;
-	
-	unsigned char crc = calculateCRC(ctx->radio_data, offset, length);
+	unsigned char crc = 0;
 
 	//dump some image bytes
 	_d("image start");
-	hexdump(ctx->radio_data + start, length);
-
-	size_t chunk_size = 0xdfc;
+	hexdump(ctx->part_data[type], length);
 
-	while (start < end) {
-		size_t remaining = end - start;
-		size_t curr_chunk = chunk_size < remaining ? chunk_size : remaining;
-		ret = write(ctx->boot_fd, ctx->radio_data + start, curr_chunk);
-		if (ret < 0) {
-			_e("failed to write image chunk");
-			goto fail;
-		}
-		start += ret;
+	if ((ret = modemctl_send_raw_image(ctx, type, I9250_IMAGE_CHUNK, &crc)) < 0)
+	{
+		_e("failed to write image");
+		goto fail;
 	}
 	_d("sent image type=%d", type);
 
 	if (type == EBL) {
-		if ((ret = write(ctx->boot_fd, &crc, 1)) < 1) {
+		if ((ret = write_all(ctx->boot_fd, &crc, 1)) < 1) {
 			_e("failed to write EBL CRC");
 			goto fail;
 		}
@@ -243,7 +255,7 @@ static int send_image_i9250(fwloader_context *ctx, enum xmm6260_image type) {
 	}
 
 	uint32_t crc32 = (crc << 24) | 0xffffff;
-	if ((ret = write(ctx->boot_fd, &crc32, 4)) != 4) {
+	if ((ret = write_all(ctx->boot_fd, &crc32, 4)) != 4) {
 		_e("failed to write CRC");
 		goto fail;
 	}
@@ -261,7 +273,7 @@ fail:
 static int send_PSI_i9250(fwloader_context *ctx) {
 	int ret = -1;
 
-	if ((ret = write(ctx->boot_fd, I9250_PSI_START_MAGIC, 4)) < 0) {
+	if ((ret = write_all(ctx->boot_fd, I9250_PSI_START_MAGIC, 4)) < 0) {
 		_d("%s: failed to write header, ret %d", __func__, ret);
 		goto fail;
 	}
@@ -280,7 +292,7 @@ static int send_PSI_i9250(fwloader_context *ctx) {
 	
 	unsigned i;
 	for (i = 0; i < ARRAY_SIZE(expected_acks); i++) {
-		ret = expect_data(ctx->boot_fd, expected_acks[i], 4);
+		ret = expect_sequence(&ctx->boot_rx, expected_acks[i], 4);
 		if (ret < 0) {
 			_d("failed to wait for ack %d", i);
 			goto fail;
@@ -299,28 +311,28 @@ static int send_EBL_i9250(fwloader_context *ctx) {
 	int fd = ctx->boot_fd;
 	unsigned length = i9250_radio_parts[EBL].length;
 	
-	if ((ret = write(fd, "\x04\x00\x00\x00", 4)) != 4) {
+	if ((ret = write_all(fd, "\x04\x00\x00\x00", 4)) != 4) {
 		_e("failed to write length of EBL length ('4') ");
 		goto fail;
 	}
 
-	if ((ret = write(fd, &length, sizeof(length))) != sizeof(length)) {
+	if ((ret = write_all(fd, &length, sizeof(length))) != sizeof(length)) {
 		_e("failed to write EBL length");
 		goto fail;
 	}
 
-	if ((ret = expect_data(fd, I9250_GENERAL_ACK, 4)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, I9250_GENERAL_ACK, 4)) < 0) {
 		_e("failed to wait for EBL length ACK");
 		goto fail;
 	}
 
-	if ((ret = expect_data(fd, I9250_EBL_HDR_ACK_MAGIC, 4)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, I9250_EBL_HDR_ACK_MAGIC, 4)) < 0) {
 		_e("failed to wait for EBL header ACK");
 		goto fail;
 	}
 	
 	length++;
-	if ((ret = write(fd, &length, sizeof(length))) != sizeof(length)) {
+	if ((ret = write_all(fd, &length, sizeof(length))) != sizeof(length)) {
 		_e("failed to write EBL length + 1");
 		goto fail;
 	}
@@ -333,12 +345,12 @@ static int send_EBL_i9250(fwloader_context *ctx) {
 		_d("sent EBL image, waiting for ACK");
 	}
 
-	if ((ret = expect_data(fd, I9250_GENERAL_ACK, 4)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, I9250_GENERAL_ACK, 4)) < 0) {
 		_e("failed to wait for EBL image general ACK");
 		goto fail;
 	}
 
-	if ((ret = expect_data(fd, I9250_EBL_IMG_ACK_MAGIC, 4)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, I9250_EBL_IMG_ACK_MAGIC, 4)) < 0) {
 		_e("failed to wait for EBL image ACK");
 		goto fail;
 	}
@@ -352,147 +364,224 @@ fail:
 	return ret;
 }
 
-static int bootloader_cmd(fwloader_context *ctx,
-	enum xmm6260_boot_cmd cmd, void *data, size_t data_size)
+/*
+ * Lays out a command frame in three pieces: header and tail are built
+ * in the caller's storage, the payload is referenced in place.
+ * data_sum is the byte sum of data when it is already known
+ * (checksum cache), otherwise it is computed here
+ */
+static size_t bootloader_cmd_frame(enum xmm6260_boot_cmd cmd, void *data,
+	size_t data_size, const uint16_t *data_sum, bootloader_cmd_hdr_t *hdr,
+	bootloader_cmd_tail_t *tl, struct iovec iov[3])
 {
-	int ret = 0;
-	char *cmd_data = 0;
-	if (cmd >= ARRAY_SIZE(i9250_boot_cmd_desc)) {
-		_e("bad command %x\n", cmd);
-		goto done_or_fail;
-	}
-
 	unsigned cmd_code = i9250_boot_cmd_desc[cmd].code;
 
 	uint16_t checksum = (data_size & 0xffff) + cmd_code;
-	unsigned char *ptr = (unsigned char*)data;
-	size_t i;
-	for (i = 0; i < data_size; i++) {
-		checksum += ptr[i];
-	}
+	checksum += data_sum ? *data_sum : checksum_sum8(data, data_size);
 
 	DECLARE_BOOT_CMD_HEADER(header, cmd_code, data_size);
 	DECLARE_BOOT_TAIL_HEADER(tail, checksum);
+	*hdr = header;
+	*tl = tail;
 
 	size_t tail_size = sizeof(tail);
 	if (!i9250_boot_cmd_desc[cmd].long_tail) {
 		tail_size -= 2;
 	}
 
-	size_t cmd_buffer_size = data_size + sizeof(header) + tail_size;
-	_d("data_size %d [%d] checksum 0x%x", data_size, cmd_buffer_size, checksum);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(*hdr);
+	iov[1].iov_base = data;
+	iov[1].iov_len = data_size;
+	iov[2].iov_base = tl;
+	iov[2].iov_len = tail_size;
 
-	cmd_data = (char*)malloc(cmd_buffer_size);
-	if (!cmd_data) {
-		_e("failed to allocate command buffer");
-		ret = -ENOMEM;
-		goto done_or_fail;
+	_d("data_size %zu checksum 0x%x", data_size, checksum);
+	return sizeof(*hdr) + data_size + tail_size;
+}
+
+/*
+ * Writes a command frame without waiting for the ACK
+ */
+static int bootloader_cmd_send(fwloader_context *ctx,
+	enum xmm6260_boot_cmd cmd, void *data, size_t data_size,
+	const uint16_t *data_sum)
+{
+	int ret = 0;
+	if (cmd >= ARRAY_SIZE(i9250_boot_cmd_desc)) {
+		_e("bad command %x\n", cmd);
+		return -EINVAL;
 	}
-	memset(cmd_data, 0, cmd_buffer_size);
-	memcpy(cmd_data, &header, sizeof(header));
-	memcpy(cmd_data + sizeof(header), data, data_size);
-	memcpy(cmd_data + sizeof(header) + data_size, &tail, tail_size);
+
+	//header and tail live on the stack, the payload is sent in place
+	bootloader_cmd_hdr_t header;
+	bootloader_cmd_tail_t tail;
+	struct iovec iov[3];
+	size_t cmd_buffer_size = bootloader_cmd_frame(cmd, data, data_size,
+		data_sum, &header, &tail, iov);
 
 	_d("bootloader cmd packet");
-	hexdump(cmd_data, cmd_buffer_size);
-	hexdump(cmd_data + cmd_buffer_size - 16, 16);
+	hexdump(&header, sizeof(header));
+	hexdump(data, data_size);
+	hexdump(&tail, iov[2].iov_len);
 
-	if ((ret = write(ctx->boot_fd, cmd_data, cmd_buffer_size)) < 0) {
+	if ((ret = write_iov(ctx->boot_fd, iov, ARRAY_SIZE(iov))) < 0) {
 		_e("failed to write command to socket");
-		goto done_or_fail;
+		return ret;
 	}
 
 	if ((unsigned)ret < cmd_buffer_size) {
 		_e("written %d bytes of %d", ret, cmd_buffer_size);
-		ret = -EINVAL;
-		goto done_or_fail;
+		return -EINVAL;
 	}
 
 	_d("sent command %x", header.cmd);
-	if (i9250_boot_cmd_desc[cmd].no_ack) {
-		_i("not waiting for ACK");
-		goto done_or_fail;
-	}
+	return 0;
+}
+
+/*
+ * Receives the ACK of a command. Returns -EPROTO if it is for another
+ * command and -EBADMSG if the ACK frame fails its own checksum.
+ */
+static int bootloader_ack_code(fwloader_context *ctx, unsigned cmd_code) {
+	int ret = 0;
+	char *cmd_data = 0;
+	size_t arena_pos = arena_mark(&ctx->arena);
 
 	uint32_t ack_length;
-	if ((ret = receive(ctx->boot_fd, &ack_length, 4)) < 0) {
+	if ((ret = receive_exact(&ctx->boot_rx, &ack_length, 4)) < 0) {
 		_e("failed to receive ack header length");
 		goto done_or_fail;
 	}
 
-	if (ack_length + 4 > cmd_buffer_size) {
-		free(cmd_data);
-		cmd_data = NULL;
-		cmd_data = malloc(ack_length + 4);
-		if (!cmd_data) {
-			_e("failed to allocate the buffer for ack data");
-			goto done_or_fail;
-		}
+	//the ACK is read in 4 byte words, round the buffer up
+	size_t ack_buffer_size = 4 + ((ack_length + 3) & ~3);
+	cmd_data = arena_claim(&ctx->arena, ack_buffer_size);
+	if (!cmd_data) {
+		_e("ack length 0x%x does not fit the ack buffer", ack_length);
+		ret = -ENOMEM;
+		goto done_or_fail;
 	}
-	memset(cmd_data, 0, ack_length);
+	memset(cmd_data, 0, ack_buffer_size);
 	memcpy(cmd_data, &ack_length, 4);
-	for (i = 0; i < (ack_length + 3) / 4; i++) {
-		if ((ret = receive(ctx->boot_fd, cmd_data + ((i + 1) << 2), 4)) < 0) {
-			_e("failed to receive ack chunk");
-			goto done_or_fail;
-		}
+	if ((ret = receive_exact(&ctx->boot_rx, cmd_data + 4,
+		ack_buffer_size - 4)) < 0) {
+		_e("failed to receive ack body");
+		goto done_or_fail;
 	}
 
 	_d("received ack");
 	hexdump(cmd_data, ack_length + 4);
 
 	bootloader_cmd_hdr_t *ack_hdr = (bootloader_cmd_hdr_t*)cmd_data;
-	bootloader_cmd_tail_t *ack_tail = (bootloader_cmd_tail_t*)
-		(cmd_data + ack_length + 4 - sizeof(bootloader_cmd_tail_t));
-	
-	_d("ack code 0x%x checksum 0x%x", ack_hdr->cmd, ack_tail->checksum);
-	if (ack_hdr->cmd != header.cmd) {
+	if (ack_length + 4 < sizeof(*ack_hdr)) {
+		_e("ack of 0x%x bytes is too short", ack_length);
+		ret = -EPROTO;
+		goto done_or_fail;
+	}
+
+	_d("ack code 0x%x", ack_hdr->cmd);
+	if (ack_hdr->cmd != cmd_code) {
 		_e("request and ack command codes do not match");
-		ret = -1;
+		ret = -EPROTO;
+		goto done_or_fail;
+	}
+
+	//the checksum follows the ACK payload like in the request
+	uint16_t ack_checksum;
+	size_t ack_data_size = ack_hdr->data_size;
+	if (sizeof(*ack_hdr) + ack_data_size + 2 > ack_length + 4) {
+		_e("ack payload of 0x%zx bytes overruns the ack", ack_data_size);
+		ret = -EBADMSG;
+		goto done_or_fail;
+	}
+	memcpy(&ack_checksum, cmd_data + sizeof(*ack_hdr) + ack_data_size, 2);
+
+	uint16_t checksum = ack_data_size + ack_hdr->cmd
+		+ checksum_sum8(cmd_data + sizeof(*ack_hdr), ack_data_size);
+	if (checksum != ack_checksum) {
+		_e("ack checksum 0x%x, expected 0x%x", ack_checksum, checksum);
+		ret = -EBADMSG;
 		goto done_or_fail;
 	}
 
 	ret = 0;
 
 done_or_fail:
+	arena_release(&ctx->arena, arena_pos);
+
+	return ret;
+}
+
+static int bootloader_cmd_ack(fwloader_context *ctx, enum xmm6260_boot_cmd cmd) {
+	return bootloader_ack_code(ctx, i9250_boot_cmd_desc[cmd].code);
+}
 
-	if (cmd_data) {
-		free(cmd_data);
+static int bootloader_cmd_sum(fwloader_context *ctx,
+	enum xmm6260_boot_cmd cmd, void *data, size_t data_size,
+	const uint16_t *data_sum)
+{
+	int ret;
+	if ((ret = bootloader_cmd_send(ctx, cmd, data, data_size, data_sum)) < 0) {
+		return ret;
+	}
+
+	if (i9250_boot_cmd_desc[cmd].no_ack) {
+		_i("not waiting for ACK");
+		return 0;
+	}
+
+	//stop-and-wait never checked the ACK checksum, keep tolerating it
+	ret = bootloader_cmd_ack(ctx, cmd);
+	if (ret == -EBADMSG) {
+		ret = 0;
 	}
 
 	return ret;
 }
 
+static int bootloader_cmd(fwloader_context *ctx,
+	enum xmm6260_boot_cmd cmd, void *data, size_t data_size)
+{
+	return bootloader_cmd_sum(ctx, cmd, data, data_size, NULL);
+}
+
 static int ack_BootInfo_i9250(fwloader_context *ctx) {
 	int ret = -1;
 	uint32_t boot_info_length;
 	char *boot_info = 0;
+	size_t arena_pos = arena_mark(&ctx->arena);
 
-
-	if ((ret = receive(ctx->boot_fd, &boot_info_length, 4)) < 0) {
+	if ((ret = receive_exact(&ctx->boot_rx, &boot_info_length, 4)) < 0) {
 		_e("failed to receive boot info length");
 		goto fail;
 	}
 
 	_d("Boot Info length=0x%x", boot_info_length);
 
-	boot_info = (char*)malloc(boot_info_length);
+	size_t boot_chunk = 4;
+	size_t boot_chunk_count = (boot_info_length + boot_chunk - 1) / boot_chunk;
+
+	if (boot_info_length > I9250_BOOT_INFO_MAX) {
+		_e("Boot Info length 0x%x exceeds 0x%x", boot_info_length,
+			I9250_BOOT_INFO_MAX);
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	boot_info = (char*)arena_claim(&ctx->arena, boot_chunk_count * boot_chunk);
 	if (!boot_info) {
-		_e("failed to allocate memory for boot info");
+		_e("failed to claim memory for boot info");
+		ret = -ENOMEM;
 		goto fail;
 	}
 	
-	memset(boot_info, 0, boot_info_length);
+	memset(boot_info, 0, boot_chunk_count * boot_chunk);
 
-	size_t boot_chunk = 4;
-	size_t boot_chunk_count = (boot_info_length + boot_chunk - 1) / boot_chunk;
-	unsigned i;
-	for (i = 0; i < boot_chunk_count; i++) {
-		ret = receive(ctx->boot_fd, boot_info + (i * boot_chunk), boot_chunk);
-		if (ret < 0) {
-			_e("failed to receive Boot Info chunk %i ret=%d", i, ret);
-			goto fail;
-		}
+	ret = receive_exact(&ctx->boot_rx, boot_info, boot_chunk_count * boot_chunk);
+	if (ret < 0) {
+		_e("failed to receive Boot Info ret=%d", ret);
+		goto fail;
 	}
 	
 	_d("received Boot Info");
@@ -510,17 +599,130 @@ static int ack_BootInfo_i9250(fwloader_context *ctx) {
 	ret = 0;
 
 fail:
-	if (boot_info) {
-		free(boot_info);
+	arena_release(&ctx->arena, arena_pos);
+
+	return ret;
+}
+
+/*
+ * Sends the blocks with up to ctx->sec_window of them in flight.
+ * An ACK that fails its checksum drops the window to one for good, see
+ * modemctl_window_disable(), and the blocks starting with the affected
+ * one are resent after a new ReqFlashSetAddress. A block that cannot
+ * be sent or is not ACKed is resent the same way, up to
+ * SEC_BLOCK_RETRY_MAX times per image.
+ */
+static int send_secure_blocks(fwloader_context *ctx,
+	enum xmm6260_image type, size_t from, size_t to, uint32_t max_chunk)
+{
+	int ret = 0;
+	char *image = ctx->part_data[type];
+	struct {
+		size_t offset;
+		unsigned length;
+	} inflight[I9250_SEC_WINDOW_MAX];
+	unsigned head = 0, count = 0, retries = 0;
+	size_t pos = from;
+	size_t block;
+
+	while (pos < to || count) {
+		while (count < ctx->sec_window && pos < to) {
+			unsigned rest = to - pos;
+			unsigned chunk = rest < max_chunk ? rest : max_chunk;
+			uint16_t sum = modemctl_block_sum(ctx, type, pos, chunk);
+
+			ret = bootloader_cmd_send(ctx, ReqFlashWriteBlock, image + pos,
+				chunk, &sum);
+			if (ret < 0) {
+				_e("failed to send data chunk");
+				block = count ? inflight[head].offset : pos;
+				goto retry;
+			}
+
+			unsigned slot = (head + count) % I9250_SEC_WINDOW_MAX;
+			inflight[slot].offset = pos;
+			inflight[slot].length = chunk;
+			count++;
+			pos += chunk;
+		}
+
+		block = inflight[head].offset;
+		head = (head + 1) % I9250_SEC_WINDOW_MAX;
+		count--;
+
+		ret = bootloader_cmd_ack(ctx, ReqFlashWriteBlock);
+		if (ret == -EBADMSG && ctx->sec_window > 1) {
+			_e("bad ACK for block 0x%zx, falling back to stop-and-wait", block);
+
+			//the blocks behind it get resent, their ACKs only need to go
+			for (; count; count--) {
+				if ((ret = bootloader_cmd_ack(ctx, ReqFlashWriteBlock)) < 0
+					&& ret != -EBADMSG)
+				{
+					goto retry;
+				}
+			}
+
+			modemctl_window_disable(ctx);
+			uint32_t addr = ctx->sec_load_addr + block;
+			if ((ret = bootloader_cmd(ctx, ReqFlashSetAddress, &addr, 4)) < 0) {
+				_e("failed to rewind to 0x%x", addr);
+				goto retry;
+			}
+			pos = block;
+			continue;
+		}
+
+		if (ret == -EBADMSG) {
+			_d("ignoring ACK checksum of block 0x%zx", block);
+		}
+		else if (ret < 0) {
+			_e("failed to receive ACK of block 0x%zx", block);
+			goto retry;
+		}
+		timing_block(&ctx->timing);
+		continue;
+
+retry:
+		//ACKs carry no offset, resume at the oldest unacknowledged block
+		do {
+			if ((ret = modemctl_block_retry(ctx, type, block, &retries,
+				ret)) < 0)
+			{
+				goto fail;
+			}
+
+			uint32_t addr = ctx->sec_load_addr + block;
+			ret = bootloader_cmd(ctx, ReqFlashSetAddress, &addr, 4);
+		} while (ret < 0);
+
+		head = 0;
+		count = 0;
+		pos = block;
 	}
 
+	ret = 0;
+
+fail:
 	return ret;
 }
 
+static int i9250_set_address(fwloader_context *ctx, uint32_t addr) {
+	return bootloader_cmd(ctx, ReqFlashSetAddress, &addr, 4);
+}
+
 static int send_secure_image(fwloader_context *ctx, uint32_t addr,
 	enum xmm6260_image type)
 {
-	int ret = 0;
+	int ret = modemctl_play_bundle(ctx, type, bootloader_ack_code,
+		i9250_set_address);
+	if (ret == 0) {
+		goto wait;
+	}
+	if (ret != -ENOENT) {
+		goto fail;
+	}
+
 	if ((ret = bootloader_cmd(ctx, ReqFlashSetAddress, &addr, 4)) < 0) {
 		_e("failed to send ReqFlashSetAddress");
 		goto fail;
@@ -528,27 +730,16 @@ static int send_secure_image(fwloader_context *ctx, uint32_t addr,
 	else {
 		_d("sent ReqFlashSetAddress");
 	}
+	ctx->sec_load_addr = addr;
 
-	uint32_t offset = i9250_radio_parts[type].offset;
-	uint32_t length = i9250_radio_parts[type].length;
-
-	char *start = ctx->radio_data + offset;
-	char *end = start + length;
-
-	while (start < end) {
-		unsigned rest = end - start;
-		unsigned chunk = rest < SEC_DOWNLOAD_CHUNK ? rest : SEC_DOWNLOAD_CHUNK;
-
-		ret = bootloader_cmd(ctx, ReqFlashWriteBlock, start, chunk);
-		if (ret < 0) {
-			_e("failed to send data chunk");
-			goto fail;
-		}
-
-		start += chunk;
+	if ((ret = modemctl_send_secure_blocks(ctx, type, send_secure_blocks,
+		i9250_set_address)) < 0)
+	{
+		goto fail;
 	}
 
-	usleep(SEC_DOWNLOAD_DELAY_US);
+wait:
+	ret = modemctl_wait_sec_download(ctx, SEC_DOWNLOAD_DELAY_US);
 
 fail:
 	return ret;
@@ -560,7 +751,8 @@ static int send_mps_data(fwloader_context *ctx) {
 	char mps_data[I9250_MPS_LENGTH] = {};
 	uint32_t addr = I9250_MPS_LOAD_ADDR;
 
-	mps_fd = open(I9250_MPS_IMAGE_PATH, O_RDONLY);
+	mps_fd = open(modemctl_path(ctx, FWLOADER_PATH_MPS, I9250_MPS_IMAGE_PATH),
+		O_RDONLY);
 	if (mps_fd < 0) {
 		_e("failed to open MPS data");
 	}
@@ -594,18 +786,26 @@ fail:
 static int send_SecureImage_i9250(fwloader_context *ctx) {
 	int ret = 0;
 
-	uint32_t sec_off = i9250_radio_parts[SECURE_IMAGE].offset;
 	uint32_t sec_len = i9250_radio_parts[SECURE_IMAGE].length;
-	void *sec_img = ctx->radio_data + sec_off;
+	void *sec_img = ctx->part_data[SECURE_IMAGE];
 	
-	if ((ret = bootloader_cmd(ctx, ReqSecStart, sec_img, sec_len)) < 0) {
+	timing_begin(&ctx->timing, PHASE_SEC_START);
+	ret = modemctl_play_bundle(ctx, SECURE_IMAGE, bootloader_ack_code,
+		i9250_set_address);
+	if (ret == -ENOENT) {
+		uint16_t sec_sum = modemctl_block_sum(ctx, SECURE_IMAGE, 0, sec_len);
+		ret = bootloader_cmd_sum(ctx, ReqSecStart, sec_img, sec_len, &sec_sum);
+	}
+	if (ret < 0) {
 		_e("failed to write ReqSecStart");
 		goto fail;
 	}
 	else {
 		_d("sent ReqSecStart");
 	}
+	timing_end(&ctx->timing, PHASE_SEC_START);
 
+	timing_begin(&ctx->timing, PHASE_FIRMWARE);
 	if ((ret = send_secure_image(ctx, FW_LOAD_ADDR, FIRMWARE)) < 0) {
 		_e("failed to send FIRMWARE image");
 		goto fail;
@@ -613,7 +813,9 @@ static int send_SecureImage_i9250(fwloader_context *ctx) {
 	else {
 		_d("sent FIRMWARE image");
 	}
+	timing_end(&ctx->timing, PHASE_FIRMWARE);
 	
+	timing_begin(&ctx->timing, PHASE_NVDATA);
 	if ((ret = send_secure_image(ctx, NVDATA_LOAD_ADDR, NVDATA)) < 0) {
 		_e("failed to send NVDATA image");
 		goto fail;
@@ -621,7 +823,9 @@ static int send_SecureImage_i9250(fwloader_context *ctx) {
 	else {
 		_d("sent NVDATA image");
 	}
+	timing_end(&ctx->timing, PHASE_NVDATA);
 
+	timing_begin(&ctx->timing, PHASE_MPS);
 	if ((ret = send_mps_data(ctx)) < 0) {
 		_e("failed to send MPS data");
 		goto fail;
@@ -629,7 +833,9 @@ static int send_SecureImage_i9250(fwloader_context *ctx) {
 	else {
 		_d("sent MPS data");
 	}
+	timing_end(&ctx->timing, PHASE_MPS);
 
+	timing_begin(&ctx->timing, PHASE_SEC_END);
 	if ((ret = bootloader_cmd(ctx, ReqSecEnd,
 		BL_END_MAGIC, BL_END_MAGIC_LEN)) < 0)
 	{
@@ -649,186 +855,319 @@ static int send_SecureImage_i9250(fwloader_context *ctx) {
 	else {
 		_d("sent ReqForceHwReset");
 	}
+	timing_end(&ctx->timing, PHASE_SEC_END);
 
 fail:
 	return ret;
 }
 
-int boot_modem_i9250(void) {
-	int ret = -1;
-	fwloader_context ctx;
-	memset(&ctx, 0, sizeof(ctx));
+int i9250_write_block(fwloader_context *ctx, void *data, size_t size) {
+	return bootloader_cmd_send(ctx, ReqFlashWriteBlock, data, size, NULL);
+}
+
+static int i9250_pack_cmd(boot_bundle *bundle, enum xmm6260_boot_cmd cmd,
+	void *data, size_t data_size, uint16_t data_sum, enum xmm6260_image type,
+	uint32_t addr, unsigned flags)
+{
+	bootloader_cmd_hdr_t header;
+	bootloader_cmd_tail_t tail;
+	struct iovec iov[3];
+	bundle_frame frame = {
+		.addr = addr,
+		.ack_code = i9250_boot_cmd_desc[cmd].code,
+		.image = type,
+		.flags = flags,
+	};
+
+	bootloader_cmd_frame(cmd, data, data_size, &data_sum, &header, &tail, iov);
+	return bundle_append(bundle, &frame, iov, ARRAY_SIZE(iov));
+}
+
+/*
+ * Frames ReqSecStart and the FIRMWARE and NVDATA uploads exactly like
+ * send_SecureImage_i9250() does, with blocks of ctx->sec_chunk
+ */
+static int i9250_pack(fwloader_context *ctx, const char *path) {
+	static const struct {
+		enum xmm6260_image type;
+		uint32_t addr;
+	} images[] = {
+		{ FIRMWARE, FW_LOAD_ADDR, },
+		{ NVDATA, NVDATA_LOAD_ADDR, },
+	};
+	radio_fingerprint fp;
+	boot_bundle bundle;
+	unsigned i;
+	int ret;
 
-	ctx.radio_fd = open(I9250_RADIO_IMAGE, O_RDONLY);
-	if (ctx.radio_fd < 0) {
-		_e("failed to open radio firmware");
+	modemctl_fingerprint(ctx, &fp);
+	if ((ret = bundle_create(&bundle, path, "i9250", &fp, ctx->sec_chunk)) < 0) {
 		goto fail;
 	}
-	else {
-		_d("opened radio image %s, fd=%d", I9250_RADIO_IMAGE, ctx.radio_fd);
-	}
 
-	if (fstat(ctx.radio_fd, &ctx.radio_stat) < 0) {
-		_e("failed to stat radio image, error %s", strerror(errno));
+	size_t sec_len = i9250_radio_parts[SECURE_IMAGE].length;
+	if ((ret = i9250_pack_cmd(&bundle, ReqSecStart,
+		ctx->part_data[SECURE_IMAGE], sec_len,
+		modemctl_block_sum(ctx, SECURE_IMAGE, 0, sec_len), SECURE_IMAGE, 0,
+		BUNDLE_FRAME_SYNC)) < 0)
+	{
 		goto fail;
 	}
 
-	ctx.radio_data = mmap(0, RADIO_MAP_SIZE, PROT_READ, MAP_SHARED,
-		ctx.radio_fd, 0);
-	if (ctx.radio_data == MAP_FAILED) {
-		_e("failed to mmap radio image, error %s", strerror(errno));
-		goto fail;
+	for (i = 0; i < ARRAY_SIZE(images); i++) {
+		enum xmm6260_image type = images[i].type;
+		char *image = ctx->part_data[type];
+		size_t length = i9250_radio_parts[type].length;
+		uint32_t addr = images[i].addr;
+		size_t pos;
+
+		if ((ret = i9250_pack_cmd(&bundle, ReqFlashSetAddress, &addr, 4,
+			checksum_sum8(&addr, 4), type, addr, BUNDLE_FRAME_SYNC)) < 0)
+		{
+			goto fail;
+		}
+
+		for (pos = 0; pos < length; pos += ctx->sec_chunk) {
+			size_t chunk = length - pos < ctx->sec_chunk ? length - pos
+				: ctx->sec_chunk;
+			if ((ret = i9250_pack_cmd(&bundle, ReqFlashWriteBlock, image + pos,
+				chunk, modemctl_block_sum(ctx, type, pos, chunk), type,
+				addr + pos, 0)) < 0)
+			{
+				goto fail;
+			}
+		}
 	}
 
-	ctx.boot_fd = open(BOOT_DEV, O_RDWR | O_NOCTTY | O_NONBLOCK);
-	if (ctx.boot_fd < 0) {
-		_e("failed to open boot device");
+	if ((ret = bundle_finish(&bundle, path)) < 0) {
 		goto fail;
 	}
+	_i("packed %u frames, %llu bytes of 0x%x byte blocks into %s",
+		bundle.frame_count, (unsigned long long)bundle.data_size,
+		ctx->sec_chunk, path);
+
+fail:
+	bundle_close(&bundle);
+	return ret;
+}
+
+static int i9250_setup(fwloader_context *ctx) {
+	int ret;
+	const fwloader_options *opts = ctx->opts;
+	ctx->parts = i9250_radio_parts;
+	ctx->sec_wait = opts->sec_wait ? opts->sec_wait : I9250_SEC_WAIT_MODE;
+	ctx->sec_window = opts->sec_window ? opts->sec_window : 1;
+	if (ctx->sec_window > I9250_SEC_WINDOW_MAX) {
+		ctx->sec_window = I9250_SEC_WINDOW_MAX;
+	}
+
+	if ((ret = arena_init(&ctx->arena, I9250_ARENA_SIZE
+		+ modemctl_erased_table_size(i9250_radio_parts, i9250_sec_chunks,
+		ARRAY_SIZE(i9250_sec_chunks)))) < 0)
+	{
+		return ret;
+	}
+
+	//only read for the link state, without it every reset power cycles
+	const char *link_path = modemctl_path(ctx, FWLOADER_PATH_LINK, LINK_PM);
+	ctx->link_fd = open(link_path, O_RDWR);
+	if (ctx->link_fd < 0) {
+		_d("failed to open link device %s: %s", link_path, strerror(errno));
+	}
 	else {
-		_d("opened boot device %s, fd=%d", BOOT_DEV, ctx.boot_fd);
+		_d("opened link device %s, fd=%d", link_path, ctx->link_fd);
 	}
 
-	if (reboot_modem_i9250(&ctx, true) < 0) {
-		_e("failed to hard reset modem");
-		goto fail;
+	return 0;
+}
+
+/*
+ * The CP kept its power through a silent reset, only the boot mode is
+ * set up again before the reset line takes it back to the boot ROM
+ */
+static int i9250_warm_reset(fwloader_context *ctx) {
+	int ret;
+
+	if ((ret = modemctl_modem_boot_power(ctx, false)) < 0
+		|| (ret = modemctl_modem_boot_power(ctx, true)) < 0)
+	{
+		_e("failed to reset modem boot power");
+		return ret;
+	}
+
+	if ((ret = modemctl_modem_reset(ctx)) < 0) {
+		_e("failed to reset the modem");
+		return ret;
 	}
 	else {
-		_d("modem hard reset done");
+		_d("reset the modem");
 	}
 
-	/*
-	 * Now, actually load the firmware
-	 */
+	return 0;
+}
+
+static int i9250_cold_reset(fwloader_context *ctx) {
+	return reboot_modem_i9250(ctx, true);
+}
+
+static int i9250_hard_reset(fwloader_context *ctx) {
+	return modemctl_hard_reset(ctx, i9250_warm_reset, i9250_cold_reset);
+}
+
+static int i9250_atat(fwloader_context *ctx) {
+	unsigned attempt;
+	int ret;
 	int i;
-	for (i = 0; i < 2; i++) {
-		if (write(ctx.boot_fd, "ATAT", 4) != 4) {
+
+	for (attempt = 0; attempt < ARRAY_SIZE(i9250_atat_retry_ms); attempt++) {
+		if (attempt) {
+			timing_retry(&ctx->timing);
+		}
+
+		if ((ret = write_all(ctx->boot_fd, "ATAT", 4)) != 4) {
 			_e("failed to write ATAT to boot socket");
-			goto fail;
+			return ret;
 		}
 		else {
 			_d("written ATAT to boot socket, waiting for ACK");
 		}
-		
-		if (read_select(ctx.boot_fd, 100) < 0) {
-			_d("failed to select before next ACK, ignoring");
+
+		if ((ret = read_select(ctx->boot_fd,
+			i9250_atat_retry_ms[attempt])) < 0)
+		{
+			_e("failed to wait for the bootloader reply");
+			return ret;
+		}
+		if (ret > 0) {
+			break;
 		}
 	}
 
-	//FIXME: make sure it does not timeout or add the retry in the ril library
-	
-	if ((ret = read_select(ctx.boot_fd, 100)) < 0) {
-		_e("failed to wait for bootloader ready state");
-		goto fail;
-	}
-	else {
-		_d("ready for PSI upload");
+	if (attempt == ARRAY_SIZE(i9250_atat_retry_ms)) {
+		_e("bootloader did not answer %u ATATs", attempt);
+		return -ETIMEDOUT;
 	}
 
-	ret = -ETIMEDOUT;
+	//the replies usually arrive together and come out of one read
 	for (i = 0; i < I9250_BOOT_REPLY_MAX; i++) {
 		uint32_t id_buf;
-		if ((ret = receive(ctx.boot_fd, (void*)&id_buf, 4)) != 4) {
+		if ((ret = receive_exact(&ctx->boot_rx, (void*)&id_buf, 4)) != 4) {
 			_e("failed receiving bootloader reply");
-			goto fail;
+			return ret < 0 ? ret : -EIO;
 		}
 		_d("got bootloader reply %08x", id_buf);
 		if (id_buf == I9250_BOOT_LAST_MARKER) {
-			ret = 0;
-			break;
+			//the phase timing has the time, the resends count as retries
+			_d("bootloader ready after %u ATATs", attempt + 1);
+			return 0;
 		}
 	}
 
-	if (ret < 0) {
-		_e("bootloader id marker not received");
-		goto fail;
-	}
-	else {
-		_d("got bootloader id marker");
-	}
+	_e("bootloader id marker not received");
+	return -ETIMEDOUT;
+}
 
-	if ((ret = send_PSI_i9250(&ctx)) < 0) {
+static int i9250_psi(fwloader_context *ctx) {
+	int ret;
+	if ((ret = send_PSI_i9250(ctx)) < 0) {
 		_e("failed to upload PSI");
-		goto fail;
+		return ret;
 	}
 	else {
 		_d("PSI download complete");
 	}
 	
-	close(ctx.boot_fd);
-	ctx.boot_fd = open(I9250_SECOND_BOOT_DEV, O_RDWR | O_NOCTTY | O_NONBLOCK);
-	if (ctx.boot_fd < 0) {
-		_e("failed to open " I9250_SECOND_BOOT_DEV " control device");
-		goto fail;
+	close(ctx->boot_fd);
+	const char *boot1_path = modemctl_path(ctx, FWLOADER_PATH_BOOT1,
+		I9250_SECOND_BOOT_DEV);
+	ctx->boot_fd = open(boot1_path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (ctx->boot_fd < 0) {
+		_e("failed to open %s control device", boot1_path);
+		return -errno;
 	}
 	else {
-		_d("opened second boot device %s, fd=%d", I9250_SECOND_BOOT_DEV, ctx.boot_fd);
+		_d("opened second boot device %s, fd=%d", boot1_path, ctx->boot_fd);
 	}
+	rx_buffer_init(&ctx->boot_rx, ctx->boot_fd);
 
 	//RpsiCmdLoadAndExecute
-	if ((ret = write(ctx.boot_fd, I9250_PSI_CMD_EXEC, 4)) < 0) {
+	if ((ret = write_all(ctx->boot_fd, I9250_PSI_CMD_EXEC, 4)) < 0) {
 		_e("failed writing cmd_load_exe_EBL");
-		goto fail;
+		return ret;
 	}
-	if ((ret = write(ctx.boot_fd, I9250_PSI_EXEC_DATA, 8)) < 0) {
+	if ((ret = write_all(ctx->boot_fd, I9250_PSI_EXEC_DATA, 8)) < 0) {
 		_e("failed writing 8 bytes to boot1");
-		goto fail;
+		return ret;
 	}
 
-	if ((ret = expect_data(ctx.boot_fd, I9250_GENERAL_ACK, 4)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, I9250_GENERAL_ACK, 4)) < 0) {
 		_e("failed to receive cmd_load_exe_EBL ack");
-		goto fail;
+		return ret;
 	}
 
-	if ((ret = expect_data(ctx.boot_fd, I9250_PSI_READY_ACK, 4)) < 0) {
+	if ((ret = expect_sequence(&ctx->boot_rx, I9250_PSI_READY_ACK, 4)) < 0) {
 		_e("failed to receive PSI ready ack");
-		goto fail;
+		return ret;
 	}
 
-	if ((ret = send_EBL_i9250(&ctx)) < 0) {
-		_e("failed to upload EBL");
-		goto fail;
-	}
-	else {
-		_d("EBL download complete");
-	}
+	return 0;
+}
 
-	if ((ret = ack_BootInfo_i9250(&ctx)) < 0) {
-		_e("failed to receive Boot Info");
-		goto fail;
-	}
-	else {
-		_d("Boot Info ACK done");
+static const fwloader_step i9250_steps[] = {
+	{ PHASE_HARD_RESET, "hard reset", i9250_hard_reset },
+	{ PHASE_ATAT, "ATAT handshake", i9250_atat },
+	{ PHASE_PSI, "PSI upload", i9250_psi },
+	{ PHASE_EBL, "EBL upload", send_EBL_i9250 },
+	{ PHASE_BOOT_INFO, "Boot Info", ack_BootInfo_i9250 },
+	//times its own FIRMWARE/NVDATA/MPS phases
+	{ PHASE_MAX, "Secure Image", send_SecureImage_i9250, true },
+	{ PHASE_WAIT_ONLINE, "wait online", modemctl_wait_modem_online },
+};
+
+static int i9250_boot(fwloader_context *ctx) {
+	int ret = -1;
+	timing_init(&ctx->timing);
+	ctx->boot_rx.reads = 0;
+
+	//left open by the previous boot to watch the modem status
+	if (ctx->boot_fd >= 0) {
+		close(ctx->boot_fd);
 	}
 
-	if ((ret = send_SecureImage_i9250(&ctx)) < 0) {
-		_e("failed to upload Secure Image");
+	const char *boot_path = modemctl_path(ctx, FWLOADER_PATH_BOOT, BOOT_DEV);
+	ctx->boot_fd = open(boot_path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (ctx->boot_fd < 0) {
+		_e("failed to open boot device");
 		goto fail;
 	}
 	else {
-		_d("Secure Image download complete");
+		_d("opened boot device %s, fd=%d", boot_path, ctx->boot_fd);
 	}
+	rx_buffer_init(&ctx->boot_rx, ctx->boot_fd);
 
-	if ((ret = modemctl_wait_modem_online(&ctx))) {
-		_e("failed to wait for modem to become online");
+	if ((ret = modemctl_run_steps(ctx, i9250_steps,
+		ARRAY_SIZE(i9250_steps))) < 0)
+	{
 		goto fail;
 	}
 
 	_i("modem online");
-	ret = 0;
 
 fail:
-	if (ctx.radio_data != MAP_FAILED) {
-		munmap(ctx.radio_data, RADIO_MAP_SIZE);
-	}
-
-	if (ctx.radio_fd >= 0) {
-		close(ctx.radio_fd);
-	}
+	return ret;
+}
 
-	if (ctx.boot_fd >= 0) {
-		close(ctx.boot_fd);
-	}
+static const fwloader_board i9250_board = {
+	.name = "i9250",
+	.title = "I9250",
+	.radio_path = I9250_RADIO_IMAGE,
+	.chunks = i9250_sec_chunks,
+	.chunk_count = ARRAY_SIZE(i9250_sec_chunks),
+	.setup = i9250_setup,
+	.boot = i9250_boot,
+	.pack = i9250_pack,
+};
 
-	return ret;
+int boot_modem_i9250(const fwloader_options *opts) {
+	return modemctl_run(&i9250_board, opts);
 }
@@ -0,0 +1,63 @@
+/*
+ * heap_count.c: counts heap allocations while a boot runs
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "heap_count.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static bool heap_counting;
+static unsigned heap_allocs;
+
+static void heap_count_note(void) {
+	if (__atomic_load_n(&heap_counting, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void *__wrap_malloc(size_t size) {
+	heap_count_note();
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	heap_count_note();
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	heap_count_note();
+	return __real_realloc(ptr, size);
+}
+
+void heap_count_start(void) {
+	__atomic_store_n(&heap_allocs, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&heap_counting, true, __ATOMIC_RELAXED);
+}
+
+unsigned heap_count_stop(void) {
+	__atomic_store_n(&heap_counting, false, __ATOMIC_RELAXED);
+	return __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+}
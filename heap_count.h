@@ -0,0 +1,49 @@
+/*
+ * heap_count.h: counts heap allocations while a boot runs
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HEAP_COUNT_H__
+#define __HEAP_COUNT_H__
+
+#include "common.h"
+
+/*
+ * The loader is linked with --wrap for malloc(), calloc() and realloc()
+ * (see HEAP_LDFLAGS in the Makefile), so every allocation made through
+ * them, by the loader or by libc itself, can be counted. The count
+ * covers all threads and shows that a boot stays off the heap.
+ */
+
+/*
+ * @brief Starts counting heap allocations from zero
+ */
+void heap_count_start(void);
+
+/*
+ * @brief Stops counting heap allocations
+ *
+ * @return number of allocations since heap_count_start()
+ */
+unsigned heap_count_stop(void);
+
+#endif //__HEAP_COUNT_H__
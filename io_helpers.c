@@ -24,10 +24,114 @@
 
 #include "io_helpers.h"
 #include "log.h"
+#include "timing.h"
 
+#include <sys/sendfile.h>
+
+//longest silence tolerated within one transfer
 #define DEFAULT_TIMEOUT 50
 
+//the boot runs on one thread per modem, each with its own deadline
+static __thread uint64_t io_deadline_us;
+
+void io_set_deadline(uint64_t deadline_us) {
+	io_deadline_us = deadline_us;
+}
+
+uint64_t io_get_deadline(void) {
+	return io_deadline_us;
+}
+
+//counters of the boot running on this thread, NULL when not counting
+static __thread io_stats *io_stats_sink;
+
+static const char *io_op_names[] = {
+	[IO_OP_IOCTL] = "ioctl",
+	[IO_OP_SELECT] = "select",
+	[IO_OP_READ] = "read",
+	[IO_OP_WRITE] = "write",
+};
+
+void io_stats_init(io_stats *stats, const boot_timing *timing) {
+	memset(stats, 0, sizeof(*stats));
+	stats->timing = timing;
+}
+
+void io_set_stats(io_stats *stats) {
+	io_stats_sink = stats;
+}
+
+const char *io_op_name(unsigned op) {
+	if (op >= IO_OP_MAX) {
+		return NULL;
+	}
+	return io_op_names[op];
+}
+
+//start of a counted call, 0 when nothing is counted
+static uint64_t io_begin(void) {
+	return io_stats_sink ? timing_now_us() : 0;
+}
+
+/*
+ * Counts a finished call against the phase in progress. ret is what
+ * the call returned, with errno still set from it, size is how many
+ * bytes a read or write asked for.
+ */
+static void io_account(enum io_op op, uint64_t start, ssize_t ret,
+	size_t size)
+{
+	io_stats *stats = io_stats_sink;
+	int err = errno;
+
+	if (!stats) {
+		return;
+	}
+
+	unsigned phase = stats->timing->current;
+	io_counter *c = &stats->phases[phase < PHASE_MAX ? phase : PHASE_MAX][op];
+
+	c->calls++;
+	c->blocked_us += timing_now_us() - start;
+	if (ret < 0) {
+		if (op != IO_OP_SELECT && (err == EAGAIN || err == EINTR)) {
+			c->shorts++;
+		}
+		else {
+			c->errors++;
+		}
+	}
+	else if (op == IO_OP_SELECT) {
+		if (ret == 0) {
+			c->timeouts++;
+		}
+	}
+	else if (op != IO_OP_IOCTL) {
+		c->bytes += ret;
+		if ((size_t)ret < size) {
+			c->shorts++;
+		}
+	}
+
+	errno = err;
+}
+
+static int io_timeout(unsigned timeout) {
+	if (!io_deadline_us) {
+		return timeout;
+	}
+
+	uint64_t now = timing_now_us();
+	if (now >= io_deadline_us) {
+		return -ETIMEDOUT;
+	}
+
+	uint64_t left = (io_deadline_us - now + 999) / 1000;
+	return left < timeout ? (int)left : (int)timeout;
+}
+
 int c_ioctl(int fd, unsigned long code, void* data) {
+	uint64_t start = io_begin();
 	int ret;
 
 	if (!data) {
@@ -36,6 +140,7 @@ int c_ioctl(int fd, unsigned long code, void* data) {
 	else {
 		ret = ioctl(fd, code, data);
 	}
+	io_account(IO_OP_IOCTL, start, ret, 0);
 
 	if (ret < 0) {
 		_e("ioctl fd=%d code=%lx failed: %s", fd, code, strerror(errno));
@@ -48,7 +153,14 @@ int c_ioctl(int fd, unsigned long code, void* data) {
 }
 
 int read_select(int fd, unsigned timeout) {
-	int ret = 0;
+	uint64_t start = io_begin();
+	int ret = io_timeout(timeout);
+	if (ret < 0) {
+		_e("boot deadline passed waiting for fd %d", fd);
+		io_account(IO_OP_SELECT, start, 0, 0);
+		return ret;
+	}
+	timeout = ret;
 	
 	struct timeval tv = {
 		tv.tv_sec = timeout / 1000,
@@ -60,6 +172,7 @@ int read_select(int fd, unsigned timeout) {
 	FD_SET(fd, &read_set);
 
 	ret = select(fd + 1, &read_set, 0, 0, &tv);
+	io_account(IO_OP_SELECT, start, ret, 0);
 
 	if (ret < 0) {
 		_e("failed to select the fd %d ret=%d: %s", fd, ret, strerror(errno));
@@ -75,6 +188,136 @@ fail:
 	return ret;
 }
 
+int write_select(int fd, unsigned timeout) {
+	uint64_t start = io_begin();
+	int ret = io_timeout(timeout);
+	if (ret < 0) {
+		_e("boot deadline passed waiting for fd %d", fd);
+		io_account(IO_OP_SELECT, start, 0, 0);
+		return ret;
+	}
+	timeout = ret;
+	
+	struct timeval tv = {
+		tv.tv_sec = timeout / 1000,
+		tv.tv_usec = 1000 * (timeout % 1000),
+	};
+
+	fd_set write_set;
+	FD_ZERO(&write_set);
+	FD_SET(fd, &write_set);
+
+	ret = select(fd + 1, 0, &write_set, 0, &tv);
+	io_account(IO_OP_SELECT, start, ret, 0);
+
+	if (ret < 0) {
+		_e("failed to select the fd %d ret=%d: %s", fd, ret, strerror(errno));
+		goto fail;
+	}
+
+	if (ret < 1 || !FD_ISSET(fd, &write_set)) {
+		_d("fd %d not in fd set", fd);
+		goto fail;
+	}
+
+fail:
+	return ret;
+}
+
+static size_t iov_length(const struct iovec *iov, int iovcnt) {
+	size_t length = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		length += iov[i].iov_len;
+	}
+
+	return length;
+}
+
+ssize_t write_iov(int fd, struct iovec *iov, int iovcnt) {
+	ssize_t total = 0;
+
+	trace_record_iov(TRACE_TX, fd, iov, iovcnt);
+	while (iovcnt > 0) {
+		uint64_t start = io_begin();
+		ssize_t ret = writev(fd, iov, iovcnt);
+		io_account(IO_OP_WRITE, start, ret, io_stats_sink ?
+			iov_length(iov, iovcnt) : 0);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EINTR) {
+				_e("failed to write to fd %d: %s", fd, strerror(errno));
+				return -errno;
+			}
+			ret = 0;
+		}
+		total += ret;
+
+		while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + ret;
+			iov->iov_len -= ret;
+
+			if (write_select(fd, DEFAULT_TIMEOUT) < 1) {
+				_e("timed out writing to fd %d, %zd bytes written", fd, total);
+				return -ETIMEDOUT;
+			}
+		}
+	}
+
+	return total;
+}
+
+ssize_t write_all(int fd, const void *data, size_t size) {
+	struct iovec iov = {
+		.iov_base = (void*)data,
+		.iov_len = size,
+	};
+
+	return write_iov(fd, &iov, 1);
+}
+
+ssize_t send_file(int fd, int in_fd, off_t offset, size_t size) {
+	ssize_t total = 0;
+	off_t start = offset;
+
+	while ((size_t)total < size) {
+		uint64_t begin = io_begin();
+		ssize_t ret = sendfile(fd, in_fd, &offset, size - total);
+		io_account(IO_OP_WRITE, begin, ret, size - total);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EINTR) {
+				//the caller falls back to write() for these
+				if (!total && (errno == EINVAL || errno == ENOSYS)) {
+					return -errno;
+				}
+				_e("failed to sendfile to fd %d: %s", fd, strerror(errno));
+				return -errno;
+			}
+			ret = 0;
+		}
+		else if (ret == 0) {
+			_e("radio image ended after %zd bytes of %zu", total, size);
+			return -EIO;
+		}
+		total += ret;
+
+		if ((size_t)total < size && write_select(fd, DEFAULT_TIMEOUT) < 1) {
+			_e("timed out writing to fd %d, %zd bytes written", fd, total);
+			return -ETIMEDOUT;
+		}
+	}
+
+	//the payload never passes through us, only its file offset is known
+	trace(TRACE_TX, fd, start, NULL, total);
+	return total;
+}
+
 int receive(int fd, void *buf, size_t size) {
 	int ret;
 	if ((ret = read_select(fd, DEFAULT_TIMEOUT)) < 1) {
@@ -85,7 +328,13 @@ int receive(int fd, void *buf, size_t size) {
 		_d("selected %d fds for fd=%d", ret, fd);
 	}
 
-	return read(fd, buf, size);
+	uint64_t start = io_begin();
+	ret = read(fd, buf, size);
+	io_account(IO_OP_READ, start, ret, size);
+	if (ret > 0) {
+		trace(TRACE_RX, fd, 0, buf, ret);
+	}
+	return ret;
 }
 
 int expect_data(int fd, void *data, size_t size) {
@@ -102,3 +351,121 @@ int expect_data(int fd, void *data, size_t size) {
 	return ret;
 }
 
+void rx_buffer_init(rx_buffer *rx, int fd) {
+	rx->fd = fd;
+	rx->head = 0;
+	rx->tail = 0;
+}
+
+size_t rx_buffered(rx_buffer *rx) {
+	return rx->tail - rx->head;
+}
+
+//a read only counts as short when it returns less than the wanted bytes
+static int rx_fill(rx_buffer *rx, char *dst, size_t size, size_t want) {
+	int ret;
+	if ((ret = read_select(rx->fd, DEFAULT_TIMEOUT)) < 1) {
+		_e("failed to select the fd %d", rx->fd);
+		return ret < 0 ? ret : -ETIMEDOUT;
+	}
+
+	uint64_t start = io_begin();
+	ret = read(rx->fd, dst, size);
+	io_account(IO_OP_READ, start, ret, want);
+	rx->reads++;
+	if (ret > 0) {
+		trace(TRACE_RX, rx->fd, 0, dst, ret);
+	}
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return 0;
+		}
+		_e("failed to read fd %d: %s", rx->fd, strerror(errno));
+		return -errno;
+	}
+
+	if (ret == 0) {
+		_e("fd %d closed", rx->fd);
+		return -EPIPE;
+	}
+
+	return ret;
+}
+
+int receive_exact(rx_buffer *rx, void *buf, size_t size) {
+	char *dst = (char*)buf;
+	size_t done = 0;
+	int ret;
+
+	while (done < size) {
+		size_t avail = rx->tail - rx->head;
+		if (avail) {
+			size_t n = avail < size - done ? avail : size - done;
+			memcpy(dst + done, rx->data + rx->head, n);
+			rx->head += n;
+			done += n;
+			continue;
+		}
+
+		rx->head = rx->tail = 0;
+
+		//large requests skip the bounce through the buffer
+		if (size - done >= RX_BUFFER_SIZE) {
+			if ((ret = rx_fill(rx, dst + done, size - done,
+				size - done)) < 0)
+			{
+				return ret;
+			}
+			done += ret;
+			continue;
+		}
+
+		if ((ret = rx_fill(rx, rx->data, RX_BUFFER_SIZE, size - done)) < 0) {
+			return ret;
+		}
+		rx->tail = ret;
+	}
+
+	return size;
+}
+
+int expect_sequence(rx_buffer *rx, const void *data, size_t size) {
+	int ret;
+	char buf[size];
+	if ((ret = receive_exact(rx, buf, size)) != (int)size) {
+		_e("failed to receive data");
+		return ret < 0 ? ret : -1;
+	}
+	hexdump(buf, size);
+
+	if (memcmp(buf, data, size)) {
+		_e("received data does not match the expected %zu bytes", size);
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+int rx_drain(rx_buffer *rx, unsigned quiet_ms) {
+	int dropped = rx_buffered(rx);
+	int ret;
+
+	rx->head = rx->tail = 0;
+	while ((ret = read_select(rx->fd, quiet_ms)) > 0) {
+		uint64_t start = io_begin();
+		ret = read(rx->fd, rx->data, sizeof(rx->data));
+		//whatever arrives is dropped, nothing is wanted
+		io_account(IO_OP_READ, start, ret, 0);
+		if (ret <= 0) {
+			if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+			return ret < 0 ? -errno : -EPIPE;
+		}
+		rx->reads++;
+		trace(TRACE_RX, rx->fd, 0, rx->data, ret);
+		dropped += ret;
+	}
+
+	return ret < 0 ? ret : dropped;
+}
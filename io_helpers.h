@@ -23,6 +23,56 @@
 #define __IO_HELPERS_H__
 
 #include "common.h"
+#include "timing.h"
+
+#define RX_BUFFER_SIZE 4096
+
+/*
+ * Receive buffer for a file descriptor. Every read pulls in whatever
+ * the driver has available, later small requests (4 byte ACK words
+ * and the like) are then served from memory without a syscall.
+ */
+typedef struct {
+	int fd;
+	size_t head;
+	size_t tail;
+	unsigned reads;
+	char data[RX_BUFFER_SIZE];
+} rx_buffer;
+
+/*
+ * System calls counted by the helpers below, selects covering both
+ * read_select() and write_select(), writes both writev() and sendfile()
+ */
+enum io_op {
+	IO_OP_IOCTL,
+	IO_OP_SELECT,
+	IO_OP_READ,
+	IO_OP_WRITE,
+	IO_OP_MAX,
+};
+
+typedef struct {
+	unsigned calls;
+	uint64_t bytes;
+	//time spent inside the system call
+	uint64_t blocked_us;
+	//selects that ran into their timeout or the boot deadline
+	unsigned timeouts;
+	//reads and writes moving fewer bytes than the caller needed, EAGAIN
+	//included
+	unsigned shorts;
+	unsigned errors;
+} io_counter;
+
+/*
+ * Counters of one boot, split by the boot phase in progress. Calls made
+ * outside any phase are counted in the PHASE_MAX row.
+ */
+typedef struct {
+	const boot_timing *timing;
+	io_counter phases[PHASE_MAX + 1][IO_OP_MAX];
+} io_stats;
 
 /* 
  * @brief A wrapper around ioctl that prints the error to the log
@@ -35,6 +85,46 @@
  */
 int c_ioctl(int fd, unsigned long code, void* data);
 
+/* 
+ * @brief Sets the deadline every wait of the calling thread is clipped to
+ *
+ * Once it has passed, read_select() and write_select() (and with them
+ * every helper below) fail with -ETIMEDOUT instead of waiting.
+ *
+ * @param deadline_us [in] CLOCK_MONOTONIC time in microseconds, 0 for none
+ */
+void io_set_deadline(uint64_t deadline_us);
+
+/* 
+ * @brief Returns the deadline set with io_set_deadline()
+ *
+ * @return CLOCK_MONOTONIC deadline in microseconds, 0 when there is none
+ */
+uint64_t io_get_deadline(void);
+
+/* 
+ * @brief Clears the counters and binds them to the phase table of a boot
+ *
+ * @param stats [out] the counters
+ * @param timing [in] timing table whose current phase the calls count against
+ */
+void io_stats_init(io_stats *stats, const boot_timing *timing);
+
+/* 
+ * @brief Sets the counters every system call of the calling thread adds to
+ *
+ * @param stats [in] the counters, NULL to stop counting
+ */
+void io_set_stats(io_stats *stats);
+
+/* 
+ * @brief Returns the printable name of a counted system call
+ *
+ * @param op [in] enum io_op
+ * @return name or NULL for unknown ids
+ */
+const char *io_op_name(unsigned op);
+
 /* 
  * @brief Waits for fd to become available for reading
  *
@@ -45,6 +135,56 @@ int c_ioctl(int fd, unsigned long code, void* data);
  */
 int read_select(int fd, unsigned timeout);
 
+/* 
+ * @brief Waits for fd to become available for writing
+ *
+ * @param fd [in] File descriptor of the socket
+ * @param timeout [in] Timeout in milliseconds
+ * @return Negative value indicating error code
+ * @return Available socket number - 1, as select()
+ */
+int write_select(int fd, unsigned timeout);
+
+/* 
+ * @brief Writes a scatter-gather list completely
+ *
+ * Short writes and EAGAIN on non-blocking fds are handled by waiting
+ * for the fd to become writable and continuing where the kernel stopped.
+ *
+ * @param fd [in] File descriptor of the socket
+ * @param iov [in] The buffers to write, modified on partial writes
+ * @param iovcnt [in] The number of buffers
+ * @return Negative value indicating error code
+ * @return The number of bytes written
+ */
+ssize_t write_iov(int fd, struct iovec *iov, int iovcnt);
+
+/* 
+ * @brief Writes a buffer completely, see write_iov()
+ *
+ * @param fd [in] File descriptor of the socket
+ * @param data [in] The data to write
+ * @param size [in] The number of bytes to write
+ * @return Negative value indicating error code
+ * @return The number of bytes written
+ */
+ssize_t write_all(int fd, const void *data, size_t size);
+
+/* 
+ * @brief Copies a file range to the fd inside the kernel with sendfile()
+ *
+ * Handles short writes and EAGAIN like write_iov(). Fails with -EINVAL
+ * or -ENOSYS before anything was sent when the fd does not support it.
+ *
+ * @param fd [in] File descriptor of the socket
+ * @param in_fd [in] the file to read from
+ * @param offset [in] where the range starts in in_fd
+ * @param size [in] The number of bytes to send
+ * @return Negative value indicating error code
+ * @return The number of bytes written
+ */
+ssize_t send_file(int fd, int in_fd, off_t offset, size_t size);
+
 /* 
  * @brief Waits for data available and reads it to the buffer
  *
@@ -67,4 +207,56 @@ int receive(int fd, void *buf, size_t size);
  */
 int expect_data(int fd, void *data, size_t size);
 
+/* 
+ * @brief Attaches a receive buffer to a (re)opened fd, dropping its contents
+ *
+ * @param rx [out] the receive buffer
+ * @param fd [in] File descriptor of the socket
+ */
+void rx_buffer_init(rx_buffer *rx, int fd);
+
+/* 
+ * @brief Returns the number of bytes already buffered
+ *
+ * @param rx [in] the receive buffer
+ * @return number of buffered bytes
+ */
+size_t rx_buffered(rx_buffer *rx);
+
+/* 
+ * @brief Receives exactly size bytes through the receive buffer
+ *
+ * Requests larger than the buffer are read straight into buf once the
+ * buffered bytes are used up.
+ *
+ * @param rx [in] the receive buffer
+ * @param buf Buffer to hold data
+ * @param size [in] The number of bytes to read
+ * @return Negative value indicating error code
+ * @return size on success
+ */
+int receive_exact(rx_buffer *rx, void *buf, size_t size);
+
+/* 
+ * @brief Receives data through the receive buffer and compares it
+ *
+ * @param rx [in] the receive buffer
+ * @param data [in] The pattern to compare to
+ * @param size [in] The length of data to read in bytes
+ * @return -EPROTO when the received data differs from the pattern
+ * @return Negative value indicating error code
+ * @return zero when it matches
+ */
+int expect_sequence(rx_buffer *rx, const void *data, size_t size);
+
+/* 
+ * @brief Drops buffered and late data until the fd stays quiet
+ *
+ * @param rx [in] the receive buffer
+ * @param quiet_ms [in] how long nothing may arrive
+ * @return Negative value indicating error code
+ * @return number of bytes dropped
+ */
+int rx_drain(rx_buffer *rx, unsigned quiet_ms);
+
 #endif //__IO_HELPERS_H__
@@ -28,6 +28,13 @@ void hexdump(void* data, size_t size) {
 	if (size < 1) {
 		return;
 	}
+
+	if (trace_enabled) {
+		trace(TRACE_DUMP, -1, 0, data, size);
+		return;
+	}
+
+#ifdef DEBUG
 	char *_data = (char*)data;
 	char __hd_buf[DUMP_SIZE * 3 + 1];
 
@@ -40,4 +47,5 @@ void hexdump(void* data, size_t size) {
 
 	__hd_buf[sizeof(__hd_buf) - 1] = '\0';
 	_d("%s", __hd_buf);
+#endif
 }
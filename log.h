@@ -26,6 +26,7 @@
 #define __LOG_H__
 
 #include "common.h"
+#include "trace.h"
 
 #ifndef SILENT
 	#define LOG_TAG "xmm6260-sec"
@@ -34,17 +35,36 @@
 			printf("[" LOG_TAG "]: " fmt " at %s:%s:%d\n", \
 				##x, __FILE__, __func__, __LINE__); \
 		} while (0)
+	//plain report lines (tables, summaries) without the source location
+	#define _r(fmt, x...) \
+		do {\
+			printf("[" LOG_TAG "]: " fmt "\n", ##x); \
+		} while (0)
 #else
 	#define _p(fmt, x...) do {} while (0)
+	#define _r(fmt, x...) do {} while (0)
 #endif
 
 #ifdef DEBUG
-	#define _d(fmt, x...) _p("D/" fmt, ##x)
+	//with tracing on only the call site is recorded, nothing is formatted
+	#define _d(fmt, x...) \
+		do {\
+			if (trace_enabled) { \
+				trace_site(TRACE_DEBUG); \
+			} \
+			else { \
+				_p("D/" fmt, ##x); \
+			} \
+		} while (0)
 #else
 	#define _d(fmt, x...) do {} while (0)
 #endif
 
-#define _e(fmt, x...) _p("E/" fmt, ##x)
+#define _e(fmt, x...) \
+	do {\
+		trace_site(TRACE_ERROR); \
+		_p("E/" fmt, ##x); \
+	} while (0)
 #define _i(fmt, x...) _p("I/" fmt, ##x)
 
 #define DUMP_SIZE 16
@@ -0,0 +1,214 @@
+/*
+ * lz4.c: LZ4 frame compressor for modem ramdumps
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "lz4.h"
+
+#define LZ4_FRAME_MAGIC 0x184d2204
+//version 1, independent blocks, no checksums
+#define LZ4_FRAME_FLG 0x60
+//1 MiB maximum block size
+#define LZ4_FRAME_BD 0x60
+//high bit of a block size: the block is stored uncompressed
+#define LZ4_BLOCK_STORED 0x80000000u
+
+#define LZ4_MIN_MATCH 4
+//the last match has to start this far before the end of the block
+#define LZ4_MF_LIMIT 12
+//and the block always ends with this many literals
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MAX_OFFSET 65535
+//misses before the search starts skipping ahead faster
+#define LZ4_SKIP_TRIGGER 6
+
+#define XXH_PRIME32_1 2654435761u
+#define XXH_PRIME32_2 2246822519u
+#define XXH_PRIME32_3 3266489917u
+#define XXH_PRIME32_4 668265263u
+#define XXH_PRIME32_5 374761393u
+
+static uint32_t read32(const uint8_t *ptr) {
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+static void write_le32(uint8_t *ptr, uint32_t value) {
+	ptr[0] = value;
+	ptr[1] = value >> 8;
+	ptr[2] = value >> 16;
+	ptr[3] = value >> 24;
+}
+
+static uint32_t rotl32(uint32_t value, unsigned bits) {
+	return (value << bits) | (value >> (32 - bits));
+}
+
+/*
+ * xxHash32 of less than 16 bytes, all the frame header checksum needs
+ */
+static uint32_t xxh32_short(const uint8_t *data, size_t length) {
+	uint32_t hash = XXH_PRIME32_5 + length;
+
+	for (; length >= 4; data += 4, length -= 4) {
+		hash += (data[0] | (data[1] << 8) | (data[2] << 16)
+			| ((uint32_t)data[3] << 24)) * XXH_PRIME32_3;
+		hash = rotl32(hash, 17) * XXH_PRIME32_4;
+	}
+	for (; length; data++, length--) {
+		hash += *data * XXH_PRIME32_5;
+		hash = rotl32(hash, 11) * XXH_PRIME32_1;
+	}
+
+	hash ^= hash >> 15;
+	hash *= XXH_PRIME32_2;
+	hash ^= hash >> 13;
+	hash *= XXH_PRIME32_3;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static unsigned lz4_hash(uint32_t value) {
+	return (value * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t *lz4_put_length(uint8_t *op, size_t length) {
+	for (; length >= 255; length -= 255) {
+		*op++ = 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+static uint8_t *lz4_put_sequence(uint8_t *op, const uint8_t *literals,
+	size_t literal_length, size_t offset, size_t match_length)
+{
+	uint8_t *token = op++;
+	size_t match_code = match_length - LZ4_MIN_MATCH;
+
+	*token = (literal_length < 15 ? literal_length : 15) << 4;
+	if (literal_length >= 15) {
+		op = lz4_put_length(op, literal_length - 15);
+	}
+	memcpy(op, literals, literal_length);
+	op += literal_length;
+
+	//the trailing literals carry no match
+	if (!match_length) {
+		return op;
+	}
+
+	*op++ = offset;
+	*op++ = offset >> 8;
+	*token |= match_code < 15 ? match_code : 15;
+	if (match_code >= 15) {
+		op = lz4_put_length(op, match_code - 15);
+	}
+	return op;
+}
+
+/*
+ * Positions in the table are relative to the block, entries left over
+ * from an earlier block are just bad guesses and fail the compare
+ */
+static size_t lz4_compress_block(uint32_t *table, const uint8_t *src,
+	size_t size, uint8_t *dst)
+{
+	const uint8_t *ip = src, *anchor = src;
+	const uint8_t *iend = src + size;
+	const uint8_t *mflimit = iend - LZ4_MF_LIMIT;
+	const uint8_t *matchlimit = iend - LZ4_LAST_LITERALS;
+	uint8_t *op = dst;
+	unsigned misses = 0;
+
+	if (size < LZ4_MF_LIMIT + 1) {
+		return lz4_put_sequence(op, src, size, 0, 0) - dst;
+	}
+
+	while (ip < mflimit) {
+		unsigned h = lz4_hash(read32(ip));
+		const uint8_t *ref = src + table[h];
+		size_t length = LZ4_MIN_MATCH;
+
+		table[h] = ip - src;
+		if (ref >= ip || ip - ref > LZ4_MAX_OFFSET
+			|| read32(ref) != read32(ip))
+		{
+			ip += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+			continue;
+		}
+		misses = 0;
+
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+			length++;
+		}
+		while (ip + length < matchlimit && ip[length] == ref[length]) {
+			length++;
+		}
+
+		op = lz4_put_sequence(op, anchor, ip - anchor, ip - ref, length);
+		ip += length;
+		anchor = ip;
+
+		if (ip < mflimit) {
+			table[lz4_hash(read32(ip - 2))] = ip - 2 - src;
+		}
+	}
+
+	return lz4_put_sequence(op, anchor, iend - anchor, 0, 0) - dst;
+}
+
+size_t lz4_frame_header(void *dst) {
+	uint8_t *op = (uint8_t*)dst;
+
+	write_le32(op, LZ4_FRAME_MAGIC);
+	op[4] = LZ4_FRAME_FLG;
+	op[5] = LZ4_FRAME_BD;
+	op[6] = xxh32_short(op + 4, 2) >> 8;
+	return LZ4_FRAME_HEADER_SIZE;
+}
+
+size_t lz4_frame_block(uint32_t *table, const void *src, size_t size,
+	void *dst)
+{
+	uint8_t *op = (uint8_t*)dst;
+	size_t length = lz4_compress_block(table, (const uint8_t*)src, size,
+		op + 4);
+
+	if (length >= size) {
+		memcpy(op + 4, src, size);
+		write_le32(op, size | LZ4_BLOCK_STORED);
+		return 4 + size;
+	}
+
+	write_le32(op, length);
+	return 4 + length;
+}
+
+size_t lz4_frame_end(void *dst) {
+	write_le32((uint8_t*)dst, 0);
+	return LZ4_FRAME_END_SIZE;
+}
@@ -0,0 +1,76 @@
+/*
+ * lz4.h: LZ4 frame compressor for modem ramdumps
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+#include "common.h"
+
+/*
+ * A greedy single probe LZ4 block compressor writing the LZ4 frame
+ * format, so the dumps can be unpacked with the stock lz4 tool. Every
+ * frame block is compressed on its own, blocks which do not shrink are
+ * stored as they are.
+ */
+#define LZ4_HASH_BITS 16
+//matches are looked up in a table of 1 << LZ4_HASH_BITS positions
+#define LZ4_TABLE_SIZE ((1 << LZ4_HASH_BITS) * sizeof(uint32_t))
+//largest block the frame header announces
+#define LZ4_BLOCK_MAX (1 << 20)
+#define LZ4_FRAME_HEADER_SIZE 7
+#define LZ4_FRAME_END_SIZE 4
+//worst case output of lz4_frame_block() for a block of n bytes
+#define LZ4_FRAME_BLOCK_BOUND(n) (4 + (n) + (n) / 255 + 16)
+
+/*
+ * @brief Writes the frame header
+ *
+ * @param dst [out] LZ4_FRAME_HEADER_SIZE bytes
+ * @return number of bytes written
+ */
+size_t lz4_frame_header(void *dst);
+
+/*
+ * @brief Compresses one block into the frame
+ *
+ * @param table [in,out] LZ4_TABLE_SIZE bytes of match positions, zeroed
+ * before the first block and kept between blocks
+ * @param src [in] the block
+ * @param size [in] size of the block, at most LZ4_BLOCK_MAX
+ * @param dst [out] LZ4_FRAME_BLOCK_BOUND(size) bytes
+ * @return number of bytes written
+ */
+size_t lz4_frame_block(uint32_t *table, const void *src, size_t size,
+	void *dst);
+
+/*
+ * @brief Writes the end mark of the frame
+ *
+ * @param dst [out] LZ4_FRAME_END_SIZE bytes
+ * @return number of bytes written
+ */
+size_t lz4_frame_end(void *dst);
+
+#endif //__LZ4_H__
@@ -0,0 +1,446 @@
+/*
+ * manifest.c: persistent checksum cache for the radio partition
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "manifest.h"
+#include "checksum.h"
+#include "log.h"
+
+#include <limits.h>
+
+#define MANIFEST_MAGIC 0x464d4d58 //"XMMF"
+#define MANIFEST_VERSION 2
+
+//sample windows hashed per component for the fingerprint
+#define FP_EDGE_SIZE 4096
+#define FP_SAMPLE_COUNT 16
+#define FP_SAMPLE_SIZE 512
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	uint64_t sample_hash;
+	uint32_t block_size;
+	uint32_t part_count;
+	uint64_t payload_hash;
+} __attribute__((packed)) manifest_header_t;
+
+typedef struct {
+	uint32_t offset;
+	uint32_t length;
+	uint32_t block_count;
+	uint8_t crc;
+	uint8_t padding[3];
+} __attribute__((packed)) manifest_part_t;
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t length) {
+	const uint8_t *ptr = (const uint8_t*)data;
+	while (length--) {
+		hash ^= *ptr++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t hash_window(uint64_t hash, const char *data, size_t size,
+	size_t offset, size_t length)
+{
+	if (offset >= size) {
+		return hash;
+	}
+	if (length > size - offset) {
+		length = size - offset;
+	}
+	return fnv1a(hash, data + offset, length);
+}
+
+void manifest_fingerprint(char *const *data, size_t size,
+	const struct xmm6260_offset *parts, radio_fingerprint *fp)
+{
+	uint64_t hash = fnv1a(FNV_OFFSET, &size, sizeof(size));
+	unsigned i, j;
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		size_t off = parts[i].offset;
+		size_t len = parts[i].length;
+		size_t edge = len < FP_EDGE_SIZE ? len : FP_EDGE_SIZE;
+		//only the component itself is mapped, never look past its end
+		size_t avail = off >= size ? 0 : size - off < len ? size - off : len;
+
+		hash = fnv1a(hash, &off, sizeof(off));
+		hash = fnv1a(hash, &len, sizeof(len));
+		hash = hash_window(hash, data[i], avail, 0, edge);
+		hash = hash_window(hash, data[i], avail, len - edge, edge);
+
+		for (j = 1; j <= FP_SAMPLE_COUNT; j++) {
+			size_t at = (len / (FP_SAMPLE_COUNT + 1)) * j;
+			hash = hash_window(hash, data[i], avail, at, FP_SAMPLE_SIZE);
+		}
+	}
+
+	fp->size = size;
+	fp->sample_hash = hash;
+}
+
+void manifest_fingerprint_add(radio_fingerprint *fp, const void *data,
+	size_t length)
+{
+	fp->sample_hash = fnv1a(fp->sample_hash, data, length);
+}
+
+int manifest_init(image_checksums *sums, const struct xmm6260_offset *parts,
+	uint32_t block_size)
+{
+	unsigned i;
+
+	memset(sums, 0, sizeof(*sums));
+	sums->block_size = block_size;
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		part_checksums *part = sums->parts + i;
+		part->offset = parts[i].offset;
+		part->length = parts[i].length;
+
+		if (i == PSI || i == EBL) {
+			continue;
+		}
+
+		part->block_size = i == SECURE_IMAGE ? part->length : block_size;
+		part->block_count = (part->length + part->block_size - 1) /
+			part->block_size;
+		part->block_sums = calloc(part->block_count, sizeof(uint16_t));
+		part->erased = calloc(part->block_count, sizeof(uint8_t));
+		if (!part->block_sums || !part->erased) {
+			_e("failed to allocate checksum table for part %d", i);
+			manifest_free(sums);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void manifest_free(image_checksums *sums) {
+	unsigned i;
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		if (sums->parts[i].block_sums) {
+			free(sums->parts[i].block_sums);
+		}
+		free(sums->parts[i].erased);
+		sums->parts[i].block_sums = NULL;
+		sums->parts[i].erased = NULL;
+		sums->parts[i].valid = false;
+	}
+}
+
+static uint64_t payload_hash(const image_checksums *sums) {
+	uint64_t hash = FNV_OFFSET;
+	unsigned i;
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		const part_checksums *part = sums->parts + i;
+		manifest_part_t rec = {
+			.offset = part->offset,
+			.length = part->length,
+			.block_count = part->block_count,
+			.crc = part->crc,
+		};
+		hash = fnv1a(hash, &rec, sizeof(rec));
+		hash = fnv1a(hash, part->block_sums,
+			part->block_count * sizeof(uint16_t));
+		hash = fnv1a(hash, part->erased, part->block_count);
+	}
+
+	return hash;
+}
+
+int manifest_load(const char *path, image_checksums *sums) {
+	int ret = -ESTALE;
+	manifest_header_t hdr;
+	unsigned i;
+
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		_d("no manifest at %s: %s", path, strerror(errno));
+		return -ENOENT;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, file) != 1) {
+		_e("truncated manifest %s", path);
+		goto fail;
+	}
+
+	if (hdr.magic != MANIFEST_MAGIC || hdr.version != MANIFEST_VERSION
+		|| hdr.part_count != XMM6260_IMAGE_MAX)
+	{
+		_i("manifest %s has an unknown format", path);
+		goto fail;
+	}
+
+	if (hdr.size != sums->fp.size || hdr.sample_hash != sums->fp.sample_hash
+		|| hdr.block_size != sums->block_size)
+	{
+		_i("manifest %s is stale", path);
+		goto fail;
+	}
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		part_checksums *part = sums->parts + i;
+		manifest_part_t rec;
+
+		if (fread(&rec, sizeof(rec), 1, file) != 1) {
+			_e("truncated manifest %s", path);
+			goto fail;
+		}
+
+		if (rec.offset != part->offset || rec.length != part->length
+			|| rec.block_count != part->block_count)
+		{
+			_i("manifest %s does not match the radio layout", path);
+			goto fail;
+		}
+		part->crc = rec.crc;
+	}
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		part_checksums *part = sums->parts + i;
+		if (fread(part->block_sums, sizeof(uint16_t), part->block_count,
+			file) != part->block_count
+			|| fread(part->erased, 1, part->block_count, file)
+				!= part->block_count)
+		{
+			_e("truncated manifest %s", path);
+			goto fail;
+		}
+	}
+
+	if (payload_hash(sums) != hdr.payload_hash) {
+		_e("manifest %s is corrupted", path);
+		goto fail;
+	}
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		sums->parts[i].valid = true;
+		sums->parts[i].recorded = sums->parts[i].block_count;
+	}
+	sums->dirty = false;
+	ret = 0;
+
+fail:
+	fclose(file);
+	return ret;
+}
+
+int manifest_save(const char *path, const image_checksums *sums) {
+	char tmp_path[PATH_MAX];
+	unsigned i;
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		if (!sums->parts[i].valid) {
+			_d("part %d has no checksums, not saving manifest", i);
+			return -EINVAL;
+		}
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *file = fopen(tmp_path, "wb");
+	if (!file) {
+		_e("failed to create manifest %s: %s", tmp_path, strerror(errno));
+		return -errno;
+	}
+
+	manifest_header_t hdr = {
+		.magic = MANIFEST_MAGIC,
+		.version = MANIFEST_VERSION,
+		.size = sums->fp.size,
+		.sample_hash = sums->fp.sample_hash,
+		.block_size = sums->block_size,
+		.part_count = XMM6260_IMAGE_MAX,
+		.payload_hash = payload_hash(sums),
+	};
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, file) == 1;
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		const part_checksums *part = sums->parts + i;
+		manifest_part_t rec = {
+			.offset = part->offset,
+			.length = part->length,
+			.block_count = part->block_count,
+			.crc = part->crc,
+		};
+		ok = ok && fwrite(&rec, sizeof(rec), 1, file) == 1;
+	}
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		const part_checksums *part = sums->parts + i;
+		ok = ok && fwrite(part->block_sums, sizeof(uint16_t),
+			part->block_count, file) == part->block_count;
+		ok = ok && fwrite(part->erased, 1, part->block_count, file)
+			== part->block_count;
+	}
+
+	ok = (fflush(file) == 0) && ok;
+	ok = (fsync(fileno(file)) == 0) && ok;
+	fclose(file);
+
+	if (!ok || rename(tmp_path, path) < 0) {
+		_e("failed to write manifest %s: %s", path, strerror(errno));
+		unlink(tmp_path);
+		return -EIO;
+	}
+
+	_d("saved manifest %s", path);
+	return 0;
+}
+
+void manifest_build_part(image_checksums *sums, char *const *data,
+	const struct xmm6260_offset *parts, enum xmm6260_image type)
+{
+	part_checksums *part = sums->parts + type;
+	const char *start = data[type];
+	uint32_t i;
+
+	if (part->valid) {
+		return;
+	}
+
+	//raw images only carry the CRC, framed ones only the block sums
+	if (!part->block_count) {
+		part->crc = checksum_xor8(start, part->length);
+	}
+
+	for (i = 0; i < part->block_count; i++) {
+		size_t off = (size_t)i * part->block_size;
+		size_t len = part->length - off;
+		if (len > part->block_size) {
+			len = part->block_size;
+		}
+		uint32_t sum = checksum_sum8(start + off, len);
+		part->block_sums[i] = sum;
+		part->erased[i] = manifest_sum_erased(sum, len);
+	}
+
+	part->recorded = part->block_count;
+	sums->dirty = true;
+	//publish: the tables may be read by another thread once valid is set
+	__atomic_store_n(&part->valid, true, __ATOMIC_RELEASE);
+}
+
+bool manifest_part_valid(const image_checksums *sums, enum xmm6260_image type) {
+	if (!sums || type >= XMM6260_IMAGE_MAX) {
+		return false;
+	}
+
+	return __atomic_load_n(&sums->parts[type].valid, __ATOMIC_ACQUIRE);
+}
+
+void manifest_record_crc(image_checksums *sums, enum xmm6260_image type,
+	uint8_t crc)
+{
+	if (!sums || type >= XMM6260_IMAGE_MAX || sums->parts[type].valid) {
+		return;
+	}
+
+	part_checksums *part = sums->parts + type;
+	if (part->block_count) {
+		return;
+	}
+
+	part->crc = crc;
+	part->valid = true;
+	sums->dirty = true;
+}
+
+bool manifest_sum_erased(uint32_t sum, size_t length) {
+	return !sum || sum == 0xff * length;
+}
+
+void manifest_record_block(image_checksums *sums, enum xmm6260_image type,
+	size_t offset, size_t length, uint32_t sum)
+{
+	if (!sums || type >= XMM6260_IMAGE_MAX || sums->parts[type].valid) {
+		return;
+	}
+
+	part_checksums *part = sums->parts + type;
+	if (!part->block_count || offset != (size_t)part->recorded * part->block_size) {
+		return;
+	}
+
+	size_t expected = part->length - offset;
+	if (expected > part->block_size) {
+		expected = part->block_size;
+	}
+	if (length != expected) {
+		return;
+	}
+
+	part->erased[part->recorded] = manifest_sum_erased(sum, length);
+	part->block_sums[part->recorded++] = sum;
+	if (part->recorded == part->block_count) {
+		part->valid = true;
+		sums->dirty = true;
+	}
+}
+
+const uint16_t *manifest_block_sum(const image_checksums *sums,
+	enum xmm6260_image type, size_t offset, size_t length)
+{
+	if (!manifest_part_valid(sums, type)) {
+		return NULL;
+	}
+
+	const part_checksums *part = sums->parts + type;
+	if (!part->block_count || offset % part->block_size) {
+		return NULL;
+	}
+
+	uint32_t index = offset / part->block_size;
+	if (index >= part->block_count) {
+		return NULL;
+	}
+
+	size_t expected = part->length - offset;
+	if (expected > part->block_size) {
+		expected = part->block_size;
+	}
+	if (length != expected) {
+		return NULL;
+	}
+
+	return part->block_sums + index;
+}
+
+const uint8_t *manifest_erased_blocks(const image_checksums *sums,
+	enum xmm6260_image type)
+{
+	if (!manifest_part_valid(sums, type) || !sums->parts[type].block_count) {
+		return NULL;
+	}
+
+	return sums->parts[type].erased;
+}
@@ -0,0 +1,231 @@
+/*
+ * manifest.h: persistent checksum cache for the radio partition
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include "common.h"
+
+/*
+ * Components of the Samsung XMM6260 firmware
+ */
+enum xmm6260_image {
+	PSI,
+	EBL,
+	SECURE_IMAGE,
+	FIRMWARE,
+	NVDATA,
+	XMM6260_IMAGE_MAX,
+};
+
+/*
+ * Location of a firmware component in the radio partition
+ */
+struct xmm6260_offset {
+	size_t offset;
+	size_t length;
+};
+
+/*
+ * Identity of the radio partition contents: the size and a hash over
+ * a fixed set of sample windows of every firmware component
+ */
+typedef struct {
+	uint64_t size;
+	uint64_t sample_hash;
+} radio_fingerprint;
+
+typedef struct {
+	bool valid;
+	uint32_t offset;
+	uint32_t length;
+	//XOR of all bytes, as sent after the raw PSI/EBL images
+	uint8_t crc;
+	//byte sum of every bootloader block, without the length/code seed
+	uint32_t block_size;
+	uint32_t block_count;
+	uint32_t recorded;
+	uint16_t *block_sums;
+	//per block, set when it is all 0x00 or all 0xFF
+	uint8_t *erased;
+} part_checksums;
+
+/*
+ * Precomputed checksums of all firmware components
+ */
+typedef struct {
+	radio_fingerprint fp;
+	uint32_t block_size;
+	part_checksums parts[XMM6260_IMAGE_MAX];
+	//set when a part became valid after the manifest was loaded
+	bool dirty;
+} image_checksums;
+
+/*
+ * @brief Computes the fingerprint of the radio partition
+ *
+ * @param data [in] mapping of every component, by enum xmm6260_image
+ * @param size [in] the size of the radio partition
+ * @param parts [in] the board firmware component table
+ * @param fp [out] the fingerprint
+ */
+void manifest_fingerprint(char *const *data, size_t size,
+	const struct xmm6260_offset *parts, radio_fingerprint *fp);
+
+/*
+ * @brief Folds data from outside the radio partition into a fingerprint
+ *
+ * @param fp [in,out] the fingerprint
+ * @param data [in] the data, e.g. a digest of a replaced component
+ * @param length [in] length of data in bytes
+ */
+void manifest_fingerprint_add(radio_fingerprint *fp, const void *data,
+	size_t length);
+
+/*
+ * @brief Sets up empty checksum tables for the given block size
+ *
+ * SECURE_IMAGE is always a single block, FIRMWARE and NVDATA are split
+ * into blocks of block_size, PSI and EBL only carry the CRC.
+ *
+ * @param sums [out] the checksum tables
+ * @param parts [in] the board firmware component table
+ * @param block_size [in] bootloader block size for FIRMWARE/NVDATA
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int manifest_init(image_checksums *sums, const struct xmm6260_offset *parts,
+	uint32_t block_size);
+
+/*
+ * @brief Frees the checksum tables
+ *
+ * @param sums [in] the checksum tables
+ */
+void manifest_free(image_checksums *sums);
+
+/*
+ * @brief Loads the checksum tables from the manifest file
+ *
+ * The manifest is only used when its fingerprint, the component table
+ * and the block size all match what the tables were set up for.
+ *
+ * @param path [in] path of the manifest file
+ * @param sums [in,out] tables set up by manifest_init() with sums->fp set
+ * @return Negative value indicating error code (-ESTALE on mismatch)
+ * @return zero on success
+ */
+int manifest_load(const char *path, image_checksums *sums);
+
+/*
+ * @brief Atomically writes the checksum tables to the manifest file
+ *
+ * @param path [in] path of the manifest file
+ * @param sums [in] the checksum tables, all parts must be valid
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int manifest_save(const char *path, const image_checksums *sums);
+
+/*
+ * @brief Computes the checksum table of a component unless it is valid
+ *
+ * @param sums [in,out] the checksum tables
+ * @param data [in] mapping of every component, by enum xmm6260_image
+ * @param parts [in] the board firmware component table
+ * @param type [in] the component to compute
+ */
+void manifest_build_part(image_checksums *sums, char *const *data,
+	const struct xmm6260_offset *parts, enum xmm6260_image type);
+
+/*
+ * @brief Checks whether a component's checksums are available
+ *
+ * Safe to call while manifest_build_part() runs on another thread.
+ *
+ * @param sums [in] the checksum tables, may be NULL
+ * @param type [in] the firmware component
+ * @return whether the tables of the component can be used
+ */
+bool manifest_part_valid(const image_checksums *sums, enum xmm6260_image type);
+
+/*
+ * @brief Records the CRC of a raw component computed during upload
+ *
+ * @param sums [in,out] the checksum tables, may be NULL
+ * @param type [in] the firmware component
+ * @param crc [in] XOR checksum of the whole component
+ */
+void manifest_record_crc(image_checksums *sums, enum xmm6260_image type,
+	uint8_t crc);
+
+/*
+ * @brief Records the sum of a bootloader block computed during upload
+ *
+ * Blocks have to be recorded in order, the component becomes valid
+ * once its last block is recorded.
+ *
+ * @param sums [in,out] the checksum tables, may be NULL
+ * @param type [in] the firmware component
+ * @param offset [in] offset of the block inside the component
+ * @param length [in] length of the block
+ * @param sum [in] byte sum of the block, not truncated
+ */
+void manifest_record_block(image_checksums *sums, enum xmm6260_image type,
+	size_t offset, size_t length, uint32_t sum);
+
+/*
+ * @brief Tells from its byte sum whether a block is all 0x00 or all 0xFF
+ *
+ * @param sum [in] byte sum of the block, not truncated
+ * @param length [in] length of the block
+ * @return whether the block is erased
+ */
+bool manifest_sum_erased(uint32_t sum, size_t length);
+
+/*
+ * @brief Returns which blocks of a component are erased
+ *
+ * @param sums [in] the checksum tables, may be NULL
+ * @param type [in] the firmware component
+ * @return NULL unless the component is valid and split into blocks
+ * @return one flag per block of the component's block size
+ */
+const uint8_t *manifest_erased_blocks(const image_checksums *sums,
+	enum xmm6260_image type);
+
+/*
+ * @brief Returns the precomputed sum of a bootloader block
+ *
+ * @param sums [in] the checksum tables, may be NULL
+ * @param type [in] the firmware component
+ * @param offset [in] offset of the block inside the component
+ * @param length [in] length of the block
+ * @return NULL if there is no matching precomputed sum
+ * @return pointer to the block sum
+ */
+const uint16_t *manifest_block_sum(const image_checksums *sums,
+	enum xmm6260_image type, size_t offset, size_t length);
+
+#endif //__MANIFEST_H__
@@ -0,0 +1,84 @@
+/*
+ * md5.h: MD5 digest for the NVDATA sidecar files
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MD5_H__
+#define __MD5_H__
+
+#include "common.h"
+
+#define MD5_DIGEST_SIZE 16
+//lowercase hex digest as kept in the .md5 sidecar files, without the NUL
+#define MD5_HEX_SIZE (2 * MD5_DIGEST_SIZE)
+
+typedef struct {
+	uint32_t state[4];
+	uint64_t length;
+	uint8_t buffer[64];
+} md5_ctx;
+
+/*
+ * @brief Starts a new digest
+ *
+ * @param md5 [out] digest state
+ */
+void md5_init(md5_ctx *md5);
+
+/*
+ * @brief Adds data to a digest
+ *
+ * @param md5 [in,out] digest state
+ * @param data [in] the data to hash
+ * @param length [in] length of data in bytes
+ */
+void md5_update(md5_ctx *md5, const void *data, size_t length);
+
+/*
+ * @brief Completes a digest
+ *
+ * @param md5 [in] digest state, has to be initialized again for reuse
+ * @param digest [out] the MD5 digest
+ */
+void md5_final(md5_ctx *md5, uint8_t digest[MD5_DIGEST_SIZE]);
+
+/*
+ * @brief Computes the MD5 digest of a buffer
+ *
+ * @param data [in] the data to hash
+ * @param length [in] length of data in bytes
+ * @param digest [out] the MD5 digest
+ */
+void md5_digest(const void *data, size_t length,
+	uint8_t digest[MD5_DIGEST_SIZE]);
+
+/*
+ * @brief Formats a digest as lowercase hex
+ *
+ * @param digest [in] the MD5 digest
+ * @param hex [out] MD5_HEX_SIZE characters and a NUL
+ */
+void md5_hex(const uint8_t digest[MD5_DIGEST_SIZE],
+	char hex[MD5_HEX_SIZE + 1]);
+
+#endif //__MD5_H__
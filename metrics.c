@@ -0,0 +1,195 @@
+/*
+ * metrics.c: per-boot system call metrics report
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.h"
+#include "log.h"
+
+#include <stdarg.h>
+
+typedef struct {
+	char *data;
+	size_t used;
+	bool overflow;
+} metrics_line;
+
+static void metrics_printf(metrics_line *line, const char *fmt, ...) {
+	va_list ap;
+	int ret;
+
+	if (line->overflow) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	ret = vsnprintf(line->data + line->used, METRICS_LINE_MAX - line->used,
+		fmt, ap);
+	va_end(ap);
+
+	if (ret < 0 || (size_t)ret >= METRICS_LINE_MAX - line->used) {
+		line->overflow = true;
+		return;
+	}
+	line->used += ret;
+}
+
+//labels come from the device list, keep them a valid JSON string
+static void metrics_string(metrics_line *line, const char *str) {
+	metrics_printf(line, "\"");
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			metrics_printf(line, "\\%c", *str);
+		}
+		else if ((unsigned char)*str < 0x20) {
+			metrics_printf(line, "\\u%04x", (unsigned char)*str);
+		}
+		else {
+			metrics_printf(line, "%c", *str);
+		}
+	}
+	metrics_printf(line, "\"");
+}
+
+static bool metrics_any(const io_counter *ops) {
+	unsigned i;
+
+	for (i = 0; i < IO_OP_MAX; i++) {
+		if (ops[i].calls) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void metrics_ops(metrics_line *line, const io_counter *ops) {
+	bool first = true;
+	unsigned i;
+
+	metrics_printf(line, "{");
+	for (i = 0; i < IO_OP_MAX; i++) {
+		const io_counter *c = ops + i;
+		if (!c->calls) {
+			continue;
+		}
+
+		metrics_printf(line, "%s\"%s\":{\"calls\":%u,\"bytes\":%llu,"
+			"\"blocked_us\":%llu,\"timeouts\":%u,\"short\":%u,\"errors\":%u}",
+			first ? "" : ",", io_op_name(i), c->calls,
+			(unsigned long long)c->bytes,
+			(unsigned long long)c->blocked_us,
+			c->timeouts, c->shorts, c->errors);
+		first = false;
+	}
+	metrics_printf(line, "}");
+}
+
+int metrics_write(const char *path, const char *label, unsigned boot,
+	int result, const boot_timing *timing, const io_stats *stats)
+{
+	char data[METRICS_LINE_MAX];
+	metrics_line line = { .data = data, };
+	io_counter total[IO_OP_MAX];
+	uint64_t now = timing_now_us();
+	bool first = true;
+	unsigned i, j;
+	int fd = -1;
+	int ret = 0;
+
+	memset(total, 0, sizeof(total));
+
+	metrics_printf(&line, "{\"board\":");
+	metrics_string(&line, label);
+	metrics_printf(&line, ",\"boot\":%u,\"result\":%d,\"us\":%llu,\"phases\":[",
+		boot, result, (unsigned long long)(now - timing->boot_start_us));
+
+	for (i = 0; i <= PHASE_MAX; i++) {
+		const io_counter *ops = stats->phases[i];
+		const boot_phase_timing *p = i < PHASE_MAX ? timing->phases + i : NULL;
+
+		for (j = 0; j < IO_OP_MAX; j++) {
+			total[j].calls += ops[j].calls;
+			total[j].bytes += ops[j].bytes;
+			total[j].blocked_us += ops[j].blocked_us;
+			total[j].timeouts += ops[j].timeouts;
+			total[j].shorts += ops[j].shorts;
+			total[j].errors += ops[j].errors;
+		}
+
+		if (!(p && p->started) && !metrics_any(ops)) {
+			continue;
+		}
+
+		metrics_printf(&line, "%s{\"phase\":\"%s\"", first ? "" : ",",
+			p ? timing_phase_name(i) : "other");
+		if (p && p->started) {
+			uint64_t end = p->done ? p->end_us : now;
+			metrics_printf(&line, ",\"ok\":%s,\"us\":%llu,\"retries\":%u,"
+				"\"skipped\":%llu", p->done ? "true" : "false",
+				(unsigned long long)(end - p->start_us), p->retries,
+				(unsigned long long)p->skipped);
+		}
+		if (p && p->blocks.count) {
+			metrics_printf(&line, ",\"blocks\":{\"count\":%u,\"min_us\":%llu,"
+				"\"avg_us\":%llu,\"max_us\":%llu,\"jitter_us\":%llu}",
+				p->blocks.count, (unsigned long long)p->blocks.min_us,
+				(unsigned long long)(p->blocks.sum_us / p->blocks.count),
+				(unsigned long long)p->blocks.max_us,
+				(unsigned long long)timing_block_jitter(&p->blocks));
+		}
+		metrics_printf(&line, ",\"io\":");
+		metrics_ops(&line, ops);
+		metrics_printf(&line, "}");
+		first = false;
+	}
+
+	metrics_printf(&line, "],\"total\":");
+	metrics_ops(&line, total);
+	metrics_printf(&line, "}\n");
+
+	if (line.overflow) {
+		_e("metrics report of %s does not fit %u bytes", label,
+			METRICS_LINE_MAX);
+		return -ENOSPC;
+	}
+
+	//one write per report keeps the lines of concurrent boots apart
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ret = -errno;
+		_e("failed to open metrics file %s: %s", path, strerror(errno));
+		goto fail;
+	}
+
+	if (write(fd, line.data, line.used) != (ssize_t)line.used) {
+		ret = -EIO;
+		_e("failed to write metrics file %s: %s", path, strerror(errno));
+		goto fail;
+	}
+
+fail:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return ret;
+}
@@ -0,0 +1,66 @@
+/*
+ * metrics.h: per-boot system call metrics report
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "common.h"
+#include "io_helpers.h"
+#include "timing.h"
+
+/*
+ * Every boot appends one line of JSON to the metrics file, so that a
+ * daemon keeps the history of its reboots and the file can be read with
+ * any JSON Lines tool:
+ *
+ * {"board":"I9250","boot":0,"result":0,"us":43112,"phases":[
+ *   {"phase":"ATAT handshake","ok":true,"us":1210,"retries":0,
+ *    "skipped":0,"io":{"select":{"calls":2,"bytes":0,"blocked_us":1180,
+ *    "timeouts":0,"short":0,"errors":0},...}},...,
+ *   {"phase":"other","io":{...}}],"total":{...}}
+ *
+ * (shown wrapped). Only phases that were started or made a call are
+ * listed, and only the system calls that were made. Phases that upload
+ * blocks also get "blocks" with their timing_block() statistics.
+ */
+
+//one line of the report, large enough for every phase and system call
+#define METRICS_LINE_MAX (16 << 10)
+
+/*
+ * @brief Appends the report of a finished boot to the metrics file
+ *
+ * @param path [in] the metrics file, created when missing
+ * @param label [in] board (and modem) name
+ * @param boot [in] number of the boot since the loader started
+ * @param result [in] the result of the boot, zero or a negative error code
+ * @param timing [in] the phase table of the boot
+ * @param stats [in] the system call counters of the boot
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int metrics_write(const char *path, const char *label, unsigned boot,
+	int result, const boot_timing *timing, const io_stats *stats);
+
+#endif //__METRICS_H__
@@ -0,0 +1,327 @@
+/*
+ * modem-bench-micro.c: microbenchmarks for the checksum, framing and hexdump hot paths
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Times the per-byte hot paths of a boot on real-sized inputs: the PSI/EBL
+ * CRC, the additive command checksum, ReqFlashWriteBlock framing for both
+ * boards (written to /dev/null) and hexdump(). Every result is one
+ * "key=value" line on stdout, the build= key tells the DEBUG build apart.
+ *
+ * Cycles come from the perf cycle counter when the kernel allows it and
+ * from the TSC on x86 otherwise, they are reported as "-" when neither
+ * is available.
+ */
+
+#include "common.h"
+#include "log.h"
+#include "checksum.h"
+#include "modemctl_common.h"
+
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define MICRO_HAVE_TSC 1
+#endif
+
+#ifdef DEBUG
+#define MICRO_BUILD "debug"
+#else
+#define MICRO_BUILD "release"
+#endif
+
+#define MICRO_FIRMWARE_SIZE 0x9d8000
+#define MICRO_NVDATA_SIZE (2 << 20)
+#define MICRO_I9250_CHUNK 0xdfc2
+#define MICRO_I9100_CHUNK 0x4000
+//the last, short block of an image
+#define MICRO_TAIL_CHUNK 0x800
+#define MICRO_MIN_MS 200
+
+enum micro_clock {
+	MICRO_CYCLES_NONE,
+	MICRO_CYCLES_PERF,
+	MICRO_CYCLES_TSC,
+};
+
+typedef struct {
+	char *buf;
+	fwloader_context ctx;
+	fwloader_options opts;
+	enum micro_clock clock;
+	int perf_fd;
+	uint64_t min_ns;
+	FILE *out;
+	volatile uint32_t sink;
+} micro_t;
+
+typedef struct {
+	const char *name;
+	const char *input;
+	size_t size;
+	int (*op)(micro_t *m, size_t size);
+} micro_case;
+
+static int op_crc(micro_t *m, size_t size) {
+	m->sink += calculateCRC(m->buf, 0, size);
+	return 0;
+}
+
+static int op_xor8_scalar(micro_t *m, size_t size) {
+	m->sink += checksum_xor8_scalar(m->buf, size);
+	return 0;
+}
+
+static int op_sum8(micro_t *m, size_t size) {
+	m->sink += checksum_sum8(m->buf, size);
+	return 0;
+}
+
+static int op_sum8_scalar(micro_t *m, size_t size) {
+	m->sink += checksum_sum8_scalar(m->buf, size);
+	return 0;
+}
+
+static int op_frame_i9100(micro_t *m, size_t size) {
+	return i9100_write_block(&m->ctx, m->buf, size);
+}
+
+static int op_frame_i9250(micro_t *m, size_t size) {
+	return i9250_write_block(&m->ctx, m->buf, size);
+}
+
+static int op_hexdump(micro_t *m, size_t size) {
+	hexdump(m->buf, size);
+	return 0;
+}
+
+static const micro_case micro_cases[] = {
+	{ "crc", "firmware", MICRO_FIRMWARE_SIZE, op_crc },
+	{ "crc", "nvdata", MICRO_NVDATA_SIZE, op_crc },
+	{ "crc", "block", MICRO_I9250_CHUNK, op_crc },
+	{ "crc_scalar", "firmware", MICRO_FIRMWARE_SIZE, op_xor8_scalar },
+	{ "sum8", "firmware", MICRO_FIRMWARE_SIZE, op_sum8 },
+	{ "sum8", "nvdata", MICRO_NVDATA_SIZE, op_sum8 },
+	{ "sum8", "block", MICRO_I9250_CHUNK, op_sum8 },
+	{ "sum8_scalar", "firmware", MICRO_FIRMWARE_SIZE, op_sum8_scalar },
+	{ "frame_i9100", "block", MICRO_I9100_CHUNK, op_frame_i9100 },
+	{ "frame_i9100", "tail", MICRO_TAIL_CHUNK, op_frame_i9100 },
+	{ "frame_i9250", "block", MICRO_I9250_CHUNK, op_frame_i9250 },
+	{ "frame_i9250", "tail", MICRO_TAIL_CHUNK, op_frame_i9250 },
+	{ "hexdump", "block", MICRO_I9250_CHUNK, op_hexdump },
+};
+
+static uint64_t micro_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void micro_clock_init(micro_t *m) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	m->perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (m->perf_fd >= 0) {
+		m->clock = MICRO_CYCLES_PERF;
+		return;
+	}
+
+#ifdef MICRO_HAVE_TSC
+	m->clock = MICRO_CYCLES_TSC;
+#else
+	m->clock = MICRO_CYCLES_NONE;
+#endif
+}
+
+static const char *micro_clock_name(micro_t *m) {
+	switch (m->clock) {
+		case MICRO_CYCLES_PERF:
+			return "perf";
+		case MICRO_CYCLES_TSC:
+			return "tsc";
+		default:
+			return "none";
+	}
+}
+
+static uint64_t micro_cycles(micro_t *m) {
+	uint64_t count = 0;
+	switch (m->clock) {
+		case MICRO_CYCLES_PERF:
+			if (read(m->perf_fd, &count, sizeof(count)) != sizeof(count)) {
+				count = 0;
+			}
+			break;
+#ifdef MICRO_HAVE_TSC
+		case MICRO_CYCLES_TSC:
+			count = __rdtsc();
+			break;
+#endif
+		default:
+			break;
+	}
+	return count;
+}
+
+static int micro_run(micro_t *m, const micro_case *c) {
+	int ret;
+	unsigned iters = 1;
+	unsigned i;
+	uint64_t ns, cycles;
+
+	//warm the caches and the page tables once
+	if ((ret = c->op(m, c->size)) < 0) {
+		_e("%s on %s failed: %d", c->name, c->input, ret);
+		return ret;
+	}
+
+	//grow the batch until it runs long enough to be timed
+	for (;;) {
+		uint64_t start = micro_now_ns();
+		uint64_t start_cycles = micro_cycles(m);
+		for (i = 0; i < iters; i++) {
+			if ((ret = c->op(m, c->size)) < 0) {
+				_e("%s on %s failed: %d", c->name, c->input, ret);
+				return ret;
+			}
+		}
+		cycles = micro_cycles(m) - start_cycles;
+		ns = micro_now_ns() - start;
+		if (ns >= m->min_ns || iters >= (1u << 30)) {
+			break;
+		}
+		iters = ns ? iters * 2 : iters * 16;
+	}
+
+	double bytes = (double)c->size * iters;
+	fprintf(m->out, "micro build=" MICRO_BUILD " name=%s input=%s bytes=%zu "
+		"iters=%u ns_per_op=%.1f ns_per_byte=%.4f",
+		c->name, c->input, c->size, iters,
+		(double)ns / iters, ns / bytes);
+	if (m->clock != MICRO_CYCLES_NONE) {
+		fprintf(m->out, " cycles_per_byte=%.4f", cycles / bytes);
+	}
+	else {
+		fprintf(m->out, " cycles_per_byte=-");
+	}
+	fprintf(m->out, " cycles=%s kernel=%s\n",
+		micro_clock_name(m), checksum_kernel_name());
+	fflush(m->out);
+	return 0;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-t min_ms] [-f filter]\n"
+		"\t-t <ms>  minimum timed batch per case (default %d)\n"
+		"\t-f <s>   only run cases whose name starts with s\n",
+		name, MICRO_MIN_MS);
+}
+
+int main(int argc, char **argv) {
+	int ret = 0;
+	int opt;
+	unsigned i;
+	const char *filter = NULL;
+	micro_t m;
+	memset(&m, 0, sizeof(m));
+	m.min_ns = MICRO_MIN_MS * 1000000ull;
+
+	while ((opt = getopt(argc, argv, "t:f:h")) != -1) {
+		switch (opt) {
+			case 't':
+				m.min_ns = strtoull(optarg, NULL, 0) * 1000000ull;
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	//results keep the real stdout, DEBUG logging goes to /dev/null
+	int out_fd = dup(STDOUT_FILENO);
+	if (out_fd < 0 || !(m.out = fdopen(out_fd, "w"))) {
+		_e("failed to duplicate stdout: %s", strerror(errno));
+		return 1;
+	}
+	if (!freopen("/dev/null", "w", stdout)) {
+		fprintf(stderr, "failed to redirect stdout: %s\n", strerror(errno));
+		return 1;
+	}
+
+	checksum_init();
+	micro_clock_init(&m);
+
+	//one buffer large enough for the largest input, never blank
+	if (!(m.buf = malloc(MICRO_FIRMWARE_SIZE))) {
+		fprintf(stderr, "failed to allocate %d bytes\n", MICRO_FIRMWARE_SIZE);
+		ret = 1;
+		goto fail;
+	}
+	uint32_t x = 0x2545f491;
+	for (i = 0; i < MICRO_FIRMWARE_SIZE; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		m.buf[i] = x;
+	}
+
+	m.ctx.opts = &m.opts;
+	if ((m.ctx.boot_fd = open("/dev/null", O_WRONLY)) < 0) {
+		fprintf(stderr, "failed to open /dev/null: %s\n", strerror(errno));
+		ret = 1;
+		goto fail;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(micro_cases); i++) {
+		const micro_case *c = micro_cases + i;
+		if (filter && strncmp(c->name, filter, strlen(filter))) {
+			continue;
+		}
+		if (micro_run(&m, c) < 0) {
+			ret = 1;
+		}
+	}
+
+fail:
+	if (m.ctx.boot_fd > 0) {
+		close(m.ctx.boot_fd);
+	}
+	if (m.perf_fd > 0) {
+		close(m.perf_fd);
+	}
+	free(m.buf);
+	fclose(m.out);
+	return ret;
+}
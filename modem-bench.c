@@ -0,0 +1,396 @@
+/*
+ * modem-bench.c: end-to-end boot benchmark against modem-emu
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Starts modem-emu on a scratch directory, boots it a number of times
+ * with modem-ctl and reports the wall time and the throughput of every
+ * boot. One extra boot runs under ptrace to count the syscalls the
+ * loader makes, it is not part of the timing.
+ */
+
+#include "common.h"
+#include "log.h"
+#include "timing.h"
+
+#include <limits.h>
+#include <libgen.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+//large enough for the I9250 NVDATA at 0xa00000
+#define BENCH_RADIO_SIZE (12 << 20)
+#define BENCH_RUNS_MAX 64
+#define BENCH_ARGS_MAX 64
+
+typedef struct {
+	bool ok;
+	uint64_t wall_us;
+	uint64_t rx_bytes;
+} bench_run;
+
+typedef struct {
+	char dir[PATH_MAX];
+	char tools[PATH_MAX];
+	pid_t emu_pid;
+	FILE *emu_out;
+	char *argv[BENCH_ARGS_MAX];
+	char paths[6][PATH_MAX + 16];
+} bench_t;
+
+static int bench_write_file(bench_t *b, const char *name, size_t size) {
+	char path[PATH_MAX + 16];
+	uint32_t x = 0x2545f491;
+	char buf[4096];
+
+	snprintf(path, sizeof(path), "%s/%s", b->dir, name);
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		_e("failed to create %s: %s", path, strerror(errno));
+		return -errno;
+	}
+
+	//incompressible and never blank, like a real radio image
+	while (size) {
+		size_t chunk = size < sizeof(buf) ? size : sizeof(buf);
+		size_t i;
+		for (i = 0; i < chunk; i++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			buf[i] = x;
+		}
+		if (fwrite(buf, 1, chunk, file) != chunk) {
+			fclose(file);
+			return -EIO;
+		}
+		size -= chunk;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+static void bench_cleanup(bench_t *b) {
+	static const char *names[] = {
+		"radio.img", "mps", "ehci", "boot0", "boot1",
+	};
+	char path[PATH_MAX + 16];
+	unsigned i;
+
+	if (b->emu_pid > 0) {
+		kill(b->emu_pid, SIGTERM);
+		waitpid(b->emu_pid, NULL, 0);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		snprintf(path, sizeof(path), "%s/%s", b->dir, names[i]);
+		unlink(path);
+	}
+	rmdir(b->dir);
+}
+
+static int bench_start_emu(bench_t *b, const char *board,
+	const char *latency, const char *bandwidth)
+{
+	char path[PATH_MAX + 16];
+	char line[256];
+	int fds[2];
+
+	snprintf(path, sizeof(path), "%s/modem-emu", b->tools);
+	if (pipe(fds) < 0) {
+		return -errno;
+	}
+
+	b->emu_pid = fork();
+	if (b->emu_pid < 0) {
+		return -errno;
+	}
+
+	if (!b->emu_pid) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execl(path, path, "-b", board, "-d", b->dir, "-l", latency,
+			"-B", bandwidth, NULL);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	b->emu_out = fdopen(fds[0], "r");
+
+	while (fgets(line, sizeof(line), b->emu_out)) {
+		if (!strcmp(line, "ready\n")) {
+			return 0;
+		}
+	}
+
+	_e("%s did not start", path);
+	return -ENODEV;
+}
+
+/*
+ * Reads the emulator's summary of the boot that just finished
+ */
+static bool bench_emu_result(bench_t *b, bench_run *run) {
+	char line[256];
+	unsigned long long rx;
+	unsigned n;
+
+	while (fgets(line, sizeof(line), b->emu_out)) {
+		if (strncmp(line, "boot ", 5)) {
+			continue;
+		}
+		if (sscanf(line, "boot %u ok %*s rx=%llu", &n, &rx) == 2) {
+			run->rx_bytes = rx;
+			return true;
+		}
+		return false;
+	}
+
+	return false;
+}
+
+static pid_t bench_spawn(bench_t *b, bool traced) {
+	pid_t pid = fork();
+	if (pid) {
+		return pid;
+	}
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+	dup2(null_fd, STDERR_FILENO);
+
+	if (traced) {
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+	}
+
+	execv(b->argv[0], b->argv);
+	_exit(127);
+}
+
+static int bench_timed_run(bench_t *b, bench_run *run) {
+	int status;
+	uint64_t start = timing_now_us();
+
+	pid_t pid = bench_spawn(b, false);
+	if (pid < 0) {
+		return -errno;
+	}
+	waitpid(pid, &status, 0);
+	run->wall_us = timing_now_us() - start;
+
+	run->ok = bench_emu_result(b, run)
+		&& WIFEXITED(status) && !WEXITSTATUS(status);
+	return 0;
+}
+
+/*
+ * Counts the syscall stops of the loader and all of its threads,
+ * every syscall stops once on entry and once on exit
+ */
+static long bench_count_syscalls(bench_t *b) {
+	unsigned long stops = 0;
+	int status;
+
+	pid_t pid = bench_spawn(b, true);
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+		return -1;
+	}
+
+	if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void*)(long)(PTRACE_O_TRACESYSGOOD
+		| PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL)) < 0)
+	{
+		_e("ptrace is not available: %s", strerror(errno));
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+	while (1) {
+		pid_t tid = waitpid(-1, &status, __WALL);
+		if (tid < 0) {
+			break;
+		}
+
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			if (tid == pid) {
+				break;
+			}
+			continue;
+		}
+
+		int sig = 0;
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+			stops++;
+		}
+		else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) {
+			sig = WSTOPSIG(status);
+		}
+		ptrace(PTRACE_SYSCALL, tid, NULL, (void*)(long)sig);
+	}
+
+	return stops / 2;
+}
+
+static void usage(const char *name) {
+	printf("usage: %s [options] [-- modem-ctl options]\n"
+		"  -b <board>    board to boot: i9250 (default) or i9100\n"
+		"  -n <runs>     number of timed boots (default 5)\n"
+		"  -l <us>       emulated reply latency\n"
+		"  -B <bytes/s>  emulated link bandwidth\n"
+		"  -h            show this help\n", name);
+}
+
+int main(int argc, char **argv) {
+	static bench_t bench;
+	bench_t *b = &bench;
+	bench_run runs[BENCH_RUNS_MAX];
+	const char *board = "i9250";
+	const char *latency = "0";
+	const char *bandwidth = "0";
+	unsigned count = 5;
+	unsigned i, argc_ctl = 0;
+	int opt;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "b:n:l:B:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			board = optarg;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency = optarg;
+			break;
+		case 'B':
+			bandwidth = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	if (!count || count > BENCH_RUNS_MAX) {
+		_e("between 1 and %d runs are supported", BENCH_RUNS_MAX);
+		return -EINVAL;
+	}
+
+	//modem-emu and modem-ctl are expected next to the benchmark
+	char self[PATH_MAX];
+	snprintf(self, sizeof(self), "%s", argv[0]);
+	snprintf(b->tools, sizeof(b->tools), "%s", dirname(self));
+
+	snprintf(b->dir, sizeof(b->dir), "/tmp/modem-bench.XXXXXX");
+	if (!mkdtemp(b->dir)) {
+		_e("failed to create a scratch directory: %s", strerror(errno));
+		return -errno;
+	}
+
+	if ((ret = bench_write_file(b, "radio.img", BENCH_RADIO_SIZE)) < 0
+		|| (ret = bench_write_file(b, "mps", 3)) < 0
+		|| (ret = bench_write_file(b, "ehci", 0)) < 0
+		|| (ret = bench_start_emu(b, board, latency, bandwidth)) < 0)
+	{
+		goto fail;
+	}
+
+	static const char *links[] = {
+		"boot=%s/boot0", "boot1=%s/boot1", "radio=%s/radio.img",
+		"mps=%s/mps", "ehci=%s/ehci", "link=/dev/null",
+	};
+	snprintf(b->paths[0], sizeof(b->paths[0]), "%s/modem-ctl", b->tools);
+	b->argv[argc_ctl++] = b->paths[0];
+	b->argv[argc_ctl++] = "-b";
+	b->argv[argc_ctl++] = (char*)board;
+	b->argv[argc_ctl++] = "-E";
+	b->argv[argc_ctl++] = "-m";
+	b->argv[argc_ctl++] = "none";
+	for (i = 0; i < ARRAY_SIZE(links); i++) {
+		char *arg = malloc(PATH_MAX + 16);
+		snprintf(arg, PATH_MAX + 16, links[i], b->dir);
+		b->argv[argc_ctl++] = "-d";
+		b->argv[argc_ctl++] = arg;
+	}
+	//everything after -- goes to modem-ctl and wins over the above
+	for (i = optind; i < (unsigned)argc && argc_ctl < BENCH_ARGS_MAX - 1; i++) {
+		b->argv[argc_ctl++] = argv[i];
+	}
+	b->argv[argc_ctl] = NULL;
+
+	printf("boot benchmark: %s, %u runs, latency %s us, bandwidth %s\n",
+		board, count, latency, strcmp(bandwidth, "0") ? bandwidth : "unlimited");
+	printf("  %-5s %12s %10s  %s\n", "run", "wall ms", "MB/s", "status");
+
+	uint64_t total = 0, best = UINT64_MAX, worst = 0;
+	unsigned ok = 0;
+	for (i = 0; i < count; i++) {
+		bench_run *run = runs + i;
+		memset(run, 0, sizeof(*run));
+		if ((ret = bench_timed_run(b, run)) < 0) {
+			goto fail;
+		}
+
+		double mbps = run->wall_us ? run->rx_bytes / (double)run->wall_us : 0;
+		printf("  %-5u %8llu.%03llu %10.2f  %s\n", i,
+			(unsigned long long)(run->wall_us / 1000),
+			(unsigned long long)(run->wall_us % 1000), mbps,
+			run->ok ? "ok" : "FAILED");
+
+		if (run->ok) {
+			ok++;
+			total += run->wall_us;
+			best = run->wall_us < best ? run->wall_us : best;
+			worst = run->wall_us > worst ? run->wall_us : worst;
+		}
+	}
+
+	if (ok) {
+		printf("  wall ms min/avg/max: %.3f/%.3f/%.3f\n", best / 1000.0,
+			total / 1000.0 / ok, worst / 1000.0);
+	}
+
+	long syscalls = bench_count_syscalls(b);
+	bench_run traced;
+	if (syscalls >= 0 && bench_emu_result(b, &traced)) {
+		printf("  loader syscalls per boot: %ld\n", syscalls);
+	}
+	else {
+		printf("  loader syscalls per boot: unavailable\n");
+	}
+
+	ret = ok == count ? 0 : -EIO;
+
+fail:
+	bench_cleanup(b);
+	return ret;
+}
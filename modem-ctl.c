@@ -20,25 +20,379 @@
  */
 
 #include "modemctl_common.h"
+#include "trace.h"
 
-#if 0
-TODO:
-nvdata checking/regeneration
-ramdump
-#endif
+static void usage(const char *name) {
+	printf("usage: %s [options] [i9100]\n"
+		"       %s [options] pack <bundle>\n"
+		"       %s [options] dump <file>\n"
+		"  -b <board>    board to boot: i9250 (default) or i9100\n"
+		"  -w <mode>     secure image completion wait: delay (default), ack\n"
+		"                or select\n"
+		"  -m <path>     checksum manifest path, '" MANIFEST_DISABLED "' to disable\n"
+		"  -W            compute checksums on a worker thread during reset\n"
+		"  -c <mode>     secure image block size: fixed, tuned or calibrate\n"
+		"  -p <count>    ReqFlashWriteBlock commands in flight (I9250)\n"
+		"  -d <name>=<path> override a device or file path, name is one of\n"
+		"                boot, boot1, link, radio, mps, ehci, nvdata\n"
+		"                (NVDATA is sent from the radio partition unless\n"
+		"                nvdata=<path> is given, e.g. /efs/nv_data.bin)\n"
+		"  -E            emulate the modem_if ioctls (bootloader emulator)\n"
+		"  -S            send PSI and EBL with write() instead of sendfile()\n"
+		"  -t <ms>       deadline of the whole boot sequence\n"
+		"  -D            stay resident and reboot the modem after a crash\n"
+		"  -T <path>     keep a binary trace, dumped to path on failure or\n"
+		"                SIGUSR1, decode it with modem-trace\n"
+		"  -L <file>     boot several modems at once, one per line as\n"
+		"                '<name> <name>=<path> ...' with -d style overrides\n"
+		"  -P <bundle>   send the secure image from a bundle made with pack\n"
+		"  -s            sparse upload: leave out FIRMWARE and NVDATA blocks\n"
+		"                that are all 0x00 or all 0xFF (experimental)\n"
+		"  -R <dir>      with -D, dump the modem RAM into dir after a CP crash\n"
+		"  -Z            LZ4 compress ramdumps\n"
+		"  -M <path>     append a JSON line of per-phase system call\n"
+		"                counters to path after every boot\n"
+		"  -r <prio>     send the secure image as SCHED_FIFO at prio, with\n"
+		"                the radio components and buffers locked in memory\n"
+		"  -a <cpu>      pin the secure image upload to cpu, locking as -r\n"
+		"  -H            restart the modem warm after a silent reset with\n"
+		"                the link up, instead of a power cycle (untested\n"
+		"                on hardware)\n"
+		"  -N            let NVDATA repairs rewrite the nvdata file, they\n"
+		"                only go into a copy sent to the modem otherwise\n"
+		"  -h            show this help\n"
+		"pack frames the secure image upload of the board into a bundle\n"
+		"dump captures the RAM of a crashed modem from the boot device\n",
+		name, name, name);
+}
+
+static int parse_sec_wait(const char *arg, enum sec_wait_mode *mode) {
+	if (!strcmp(arg, "delay")) {
+		*mode = SEC_WAIT_DELAY;
+	}
+	else if (!strcmp(arg, "ack")) {
+		*mode = SEC_WAIT_ACK;
+	}
+	else if (!strcmp(arg, "select")) {
+		*mode = SEC_WAIT_SELECT;
+	}
+	else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static const char *path_names[FWLOADER_PATH_COUNT] = {
+	[FWLOADER_PATH_BOOT] = "boot",
+	[FWLOADER_PATH_BOOT1] = "boot1",
+	[FWLOADER_PATH_LINK] = "link",
+	[FWLOADER_PATH_RADIO] = "radio",
+	[FWLOADER_PATH_MPS] = "mps",
+	[FWLOADER_PATH_EHCI] = "ehci",
+	[FWLOADER_PATH_NVDATA] = "nvdata",
+};
+
+static int parse_path(const char *arg, const char **paths) {
+	const char *value = strchr(arg, '=');
+	unsigned i;
+
+	if (!value) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < FWLOADER_PATH_COUNT; i++) {
+		if (strlen(path_names[i]) == (size_t)(value - arg)
+			&& !strncmp(arg, path_names[i], value - arg))
+		{
+			paths[i] = value + 1;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+#define MAX_DEVICES 64
+
+static fwloader_device devices[MAX_DEVICES];
+
+/*
+ * Reads the modem list of a multi-modem boot. The strings point into
+ * the file contents, which are kept until exit.
+ */
+static int parse_device_list(const char *path, fwloader_options *opts) {
+	static char buf[16 << 10];
+	char *line, *next, *save;
+	unsigned count = 0, lineno = 0;
+	ssize_t size;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		_e("failed to open device list %s: %s", path, strerror(errno));
+		return -errno;
+	}
+	size = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (size < 0) {
+		_e("failed to read device list %s: %s", path, strerror(errno));
+		return -EIO;
+	}
+	buf[size] = '\0';
+
+	for (line = buf; line; line = next) {
+		fwloader_device *device = devices + count;
+		char *token, *comment;
+
+		lineno++;
+		if ((next = strchr(line, '\n'))) {
+			*next++ = '\0';
+		}
+		if ((comment = strchr(line, '#'))) {
+			*comment = '\0';
+		}
+
+		token = strtok_r(line, " \t\r", &save);
+		if (!token) {
+			continue;
+		}
+
+		if (count == MAX_DEVICES) {
+			_e("%s: more than %u modems", path, MAX_DEVICES);
+			return -E2BIG;
+		}
+
+		memset(device, 0, sizeof(*device));
+		device->name = token;
+		while ((token = strtok_r(NULL, " \t\r", &save))) {
+			if (parse_path(token, device->paths) < 0) {
+				_e("%s:%u: invalid path override %s", path, lineno, token);
+				return -EINVAL;
+			}
+		}
+
+		//all modems share one radio mapping and NVDATA
+		if (device->paths[FWLOADER_PATH_RADIO]
+			|| device->paths[FWLOADER_PATH_NVDATA])
+		{
+			_e("%s:%u: the radio image and NVDATA can only be set with -d",
+				path, lineno);
+			return -EINVAL;
+		}
+		count++;
+	}
+
+	if (!count) {
+		_e("%s: no modems listed", path);
+		return -EINVAL;
+	}
+
+	opts->devices = devices;
+	opts->device_count = count;
+	return 0;
+}
+
+static int parse_chunk_mode(const char *arg, enum chunk_mode *mode) {
+	if (!strcmp(arg, "fixed")) {
+		*mode = CHUNK_MODE_FIXED;
+	}
+	else if (!strcmp(arg, "tuned")) {
+		*mode = CHUNK_MODE_TUNED;
+	}
+	else if (!strcmp(arg, "calibrate")) {
+		*mode = CHUNK_MODE_CALIBRATE;
+	}
+	else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
 
 int main(int argc, char** argv) {
 	int ret;
+	int opt;
+	bool i9100 = false;
+	fwloader_options opts;
+	memset(&opts, 0, sizeof(opts));
+
+	while ((opt = getopt(argc, argv, "b:w:m:Wc:p:d:ESDT:t:L:P:R:ZM:r:a:HNsh")) != -1) {
+		switch (opt) {
+		case 'b':
+			if (!strcmp(optarg, "i9100")) {
+				i9100 = true;
+			}
+			else if (!strcmp(optarg, "i9250")) {
+				i9100 = false;
+			}
+			else {
+				_e("unknown board %s", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'w':
+			if (parse_sec_wait(optarg, &opts.sec_wait) < 0) {
+				_e("unknown wait mode %s", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'm':
+			opts.manifest_path = optarg;
+			break;
+		case 'W':
+			opts.checksum_worker = true;
+			break;
+		case 'c':
+			if (parse_chunk_mode(optarg, &opts.chunk_mode) < 0) {
+				_e("unknown chunk mode %s", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'p':
+			if (atoi(optarg) < 1) {
+				_e("invalid window %s", optarg);
+				return -EINVAL;
+			}
+			opts.sec_window = atoi(optarg);
+			break;
+		case 'd':
+			if (parse_path(optarg, opts.paths) < 0) {
+				_e("invalid path override %s", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'E':
+			opts.emulate_ioctls = true;
+			break;
+		case 'S':
+			opts.no_sendfile = true;
+			break;
+		case 't':
+			if (atoi(optarg) < 1) {
+				_e("invalid boot deadline %s", optarg);
+				return -EINVAL;
+			}
+			opts.boot_timeout_ms = atoi(optarg);
+			break;
+		case 'D':
+			opts.daemon = true;
+			break;
+		case 'T':
+			if ((ret = trace_init(optarg)) < 0) {
+				_e("failed to set up tracing to %s: %s", optarg, strerror(-ret));
+				return ret;
+			}
+			break;
+		case 'P':
+			opts.bundle_path = optarg;
+			break;
+		case 'R':
+			opts.dump_dir = optarg;
+			break;
+		case 'Z':
+			opts.dump_compress = true;
+			break;
+		case 'M':
+			opts.metrics_path = optarg;
+			break;
+		case 'r':
+			if (atoi(optarg) < sched_get_priority_min(SCHED_FIFO)
+				|| atoi(optarg) > sched_get_priority_max(SCHED_FIFO))
+			{
+				_e("invalid SCHED_FIFO priority %s", optarg);
+				return -EINVAL;
+			}
+			opts.rt_priority = atoi(optarg);
+			break;
+		case 'a':
+			if (atoi(optarg) < 0 || atoi(optarg) >= CPU_SETSIZE) {
+				_e("invalid CPU %s", optarg);
+				return -EINVAL;
+			}
+			opts.rt_pin = true;
+			opts.rt_cpu = atoi(optarg);
+			break;
+		case 'H':
+			opts.warm_reset = true;
+			break;
+		case 'N':
+			opts.nvdata_writeback = true;
+			break;
+		case 's':
+			opts.sparse = true;
+			break;
+		case 'L':
+			if ((ret = parse_device_list(optarg, &opts)) < 0) {
+				return ret;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	if (opts.device_count && opts.daemon) {
+		_e("-D boots a single modem, it cannot be combined with -L");
+		return -EINVAL;
+	}
+
+	//the calibration file is per board, not per modem
+	if (opts.device_count && opts.chunk_mode == CHUNK_MODE_CALIBRATE) {
+		_e("calibrate one modem at a time, not with -L");
+		return -EINVAL;
+	}
+
+	if (opts.dump_dir && !opts.daemon) {
+		_e("-R dumps the crashes the daemon sees, it needs -D");
+		return -EINVAL;
+	}
+
+	//pick the checksum kernels before any boot phase is timed
+	checksum_init();
+
+	if (optind < argc && !strcmp(argv[optind], "pack")) {
+		if (optind + 2 != argc) {
+			usage(argv[0]);
+			return -EINVAL;
+		}
+		opts.pack_path = argv[optind + 1];
+	}
+	else if (optind < argc && !strcmp(argv[optind], "dump")) {
+		if (optind + 2 != argc || opts.daemon || opts.device_count) {
+			usage(argv[0]);
+			return -EINVAL;
+		}
+		opts.dump_path = argv[optind + 1];
+	}
+	//any other extra argument selects I9100, as it always did
+	else if (optind < argc) {
+		i9100 = true;
+	}
 
-	if (argc > 1) {
-		ret = boot_modem_i9100();
+	if (i9100) {
+		ret = boot_modem_i9100(&opts);
 	}
 	else {
-		ret = boot_modem_i9250();
+		ret = boot_modem_i9250(&opts);
 	}
 
 	if (ret < 0) {
-		_e("failed to boot modem");
+		if (opts.pack_path) {
+			_e("failed to pack the bundle");
+		}
+		else if (opts.dump_path) {
+			_e("failed to dump the modem RAM");
+		}
+		else {
+			_e("failed to boot modem");
+		}
+		if (trace_enabled && trace_dump() < 0) {
+			_e("failed to dump the trace");
+		}
 		goto fail;
 	}
 	else {
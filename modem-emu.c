@@ -0,0 +1,848 @@
+/*
+ * modem-emu.c: userspace XMM6260 bootloader emulator
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Emulates the XMM6260 boot ROM, PSI and EBL the way fwloader_i9100.c
+ * and fwloader_i9250.c talk to them. Every boot device is a pty whose
+ * slave is symlinked into the directory given with -d, modem-ctl is
+ * then pointed at the links with -d boot=<dir>/boot0 ... -E.
+ *
+ * Replies are queued and delivered after the configured latency while
+ * the emulator keeps reading, and reads are paced to the configured
+ * link bandwidth. Only the framing and the checksums are checked, the
+ * payload itself is dropped.
+ */
+
+#include "common.h"
+#include "log.h"
+#include "checksum.h"
+#include "timing.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <termios.h>
+
+#define EMU_BOOT_DEVS 2
+
+//the I9250 PSI upload does not carry its length
+#define EMU_I9250_PSI_LENGTH 0xf000
+
+#define EMU_I9250_BOOT_LAST_MARKER 0x0030ffff
+#define EMU_I9250_GENERAL_ACK "\x02\x00\x00\x00"
+#define EMU_I9250_PSI_START_MAGIC "\xff\xf0\x00\x30"
+#define EMU_I9250_PSI_CMD_EXEC "\x08\x00\x00\x00"
+#define EMU_I9250_PSI_EXEC_DATA "\x00\x00\x00\x00\x02\x00\x02\x00"
+#define EMU_I9250_PSI_READY_ACK "\x00\xaa\x00\x00"
+#define EMU_I9250_EBL_HDR_ACK_MAGIC "\xcc\xcc\x00\x00"
+#define EMU_I9250_EBL_IMG_ACK_MAGIC "\x51\xa5\x00\x00"
+
+#define EMU_I9100_PSI_MAGIC 0x30
+#define EMU_I9100_BOOT_INFO_SIZE 76
+#define EMU_I9100_PSI_ACK_MAGIC "\x00\xaa"
+#define EMU_I9100_EBL_HDR_ACK_MAGIC "\xcc\xcc"
+#define EMU_I9100_EBL_IMG_ACK_MAGIC "\x51\xa5"
+
+#define EMU_CMD_SET_PORT_CONF 0x86
+#define EMU_CMD_SEC_START 0x204
+#define EMU_CMD_SEC_END 0x205
+#define EMU_CMD_FORCE_HW_RESET 0x208
+#define EMU_CMD_FLASH_SET_ADDRESS 0x802
+#define EMU_CMD_FLASH_WRITE_BLOCK 0x804
+
+//largest command payload and largest queued reply (I9100 ACK + reply)
+#define EMU_FRAME_MAX 0x10000
+#define EMU_MSG_MAX (0x4000 + 8)
+#define EMU_QUEUE_SIZE 64
+
+//bandwidth is accounted in reads of at most this size
+#define EMU_READ_MAX 4096
+#define EMU_RX_CREDIT_US 200
+//a boot that stalls this long is abandoned, the next ATAT restarts it
+#define EMU_IDLE_TIMEOUT_US (1000 * 1000)
+
+typedef struct {
+	uint64_t due_us;
+	int dev;
+	size_t length;
+	char data[EMU_MSG_MAX];
+} emu_msg;
+
+typedef struct {
+	bool i9250;
+	int master[EMU_BOOT_DEVS];
+	int slave[EMU_BOOT_DEVS];
+
+	unsigned latency_us;
+	uint64_t bandwidth;
+	//earliest time of the next read, idle time is not banked
+	uint64_t rx_next_us;
+	bool in_boot;
+	//hang up the ptys after every boot, like a crashing modem
+	bool crash;
+	//I9250: lose the ACK of every n-th ReqFlashWriteBlock, like a flaky link
+	unsigned drop_every;
+	//I9250: break the checksum of every n-th ReqFlashWriteBlock ACK
+	unsigned bad_sum_every;
+	unsigned blocks;
+	//ignore the first ATATs of every boot, like a boot ROM still starting
+	unsigned atat_ignore;
+
+	//statistics of the current boot
+	uint64_t start_us;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t image_bytes;
+	unsigned frames;
+	unsigned dropped;
+
+	emu_msg queue[EMU_QUEUE_SIZE];
+	unsigned queue_head;
+	unsigned queue_count;
+
+	char frame[EMU_FRAME_MAX];
+} emu_t;
+
+static emu_t emu;
+
+static int emu_write_all(int fd, const char *data, size_t length) {
+	while (length) {
+		ssize_t ret = write(fd, data, length);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			_e("failed to write reply: %s", strerror(errno));
+			return -errno;
+		}
+		data += ret;
+		length -= ret;
+	}
+
+	return 0;
+}
+
+static int emu_flush(emu_t *e, bool all) {
+	int ret;
+	uint64_t now = timing_now_us();
+
+	while (e->queue_count) {
+		emu_msg *msg = e->queue + e->queue_head;
+		if (!all && msg->due_us > now) {
+			break;
+		}
+
+		if ((ret = emu_write_all(e->master[msg->dev], msg->data,
+			msg->length)) < 0)
+		{
+			return ret;
+		}
+
+		e->tx_bytes += msg->length;
+		e->queue_head = (e->queue_head + 1) % EMU_QUEUE_SIZE;
+		e->queue_count--;
+	}
+
+	return 0;
+}
+
+/*
+ * Queues a reply for delivery after the link latency
+ */
+static int emu_send(emu_t *e, int dev, const void *data, size_t length) {
+	int ret;
+
+	if (length > EMU_MSG_MAX) {
+		_e("reply of %zu bytes is too large", length);
+		return -EINVAL;
+	}
+
+	if (e->queue_count == EMU_QUEUE_SIZE && (ret = emu_flush(e, true)) < 0) {
+		return ret;
+	}
+
+	emu_msg *msg = e->queue +
+		(e->queue_head + e->queue_count) % EMU_QUEUE_SIZE;
+	msg->due_us = timing_now_us() + e->latency_us;
+	msg->dev = dev;
+	msg->length = length;
+	memcpy(msg->data, data, length);
+	e->queue_count++;
+
+	return e->latency_us ? 0 : emu_flush(e, false);
+}
+
+/*
+ * Reads exactly length bytes from a boot device, delivering due
+ * replies in the meantime and pacing the reads to the bandwidth
+ */
+static int emu_read(emu_t *e, int dev, void *buf, size_t length) {
+	char *dst = buf;
+	uint64_t idle_since = timing_now_us();
+	int ret;
+
+	while (length) {
+		if ((ret = emu_flush(e, false)) < 0) {
+			return ret;
+		}
+
+		uint64_t now = timing_now_us();
+		uint64_t wake = UINT64_MAX;
+		uint64_t allowed = e->bandwidth ? e->rx_next_us : now;
+
+		if (e->queue_count) {
+			wake = e->queue[e->queue_head].due_us;
+		}
+		if (allowed > now && allowed < wake) {
+			wake = allowed;
+		}
+		if (e->in_boot && idle_since + EMU_IDLE_TIMEOUT_US < wake) {
+			wake = idle_since + EMU_IDLE_TIMEOUT_US;
+		}
+
+		struct pollfd pfd = {
+			.fd = allowed <= now ? e->master[dev] : -1,
+			.events = POLLIN,
+		};
+		struct timespec ts, *timeout = NULL;
+		if (wake != UINT64_MAX) {
+			uint64_t wait = wake > now ? wake - now : 0;
+			ts.tv_sec = wait / 1000000;
+			ts.tv_nsec = (wait % 1000000) * 1000;
+			timeout = &ts;
+		}
+
+		ret = ppoll(&pfd, 1, timeout, NULL);
+		if (ret < 0 && errno != EINTR) {
+			_e("failed to poll boot device %d: %s", dev, strerror(errno));
+			return -errno;
+		}
+
+		if (ret <= 0 || !(pfd.revents & POLLIN)) {
+			if (e->in_boot && timing_now_us() >= idle_since + EMU_IDLE_TIMEOUT_US) {
+				_e("boot stalled waiting for %zu bytes on boot%d", length, dev);
+				return -ETIMEDOUT;
+			}
+			continue;
+		}
+
+		size_t chunk = length < EMU_READ_MAX ? length : EMU_READ_MAX;
+		ssize_t got = read(e->master[dev], dst, chunk);
+		if (got < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			_e("failed to read boot device %d: %s", dev, strerror(errno));
+			return -errno;
+		}
+
+		dst += got;
+		length -= got;
+		e->rx_bytes += got;
+		idle_since = timing_now_us();
+		if (e->bandwidth) {
+			//a little credit absorbs the wakeup latency of ppoll
+			uint64_t from = now - EMU_RX_CREDIT_US;
+			if (e->rx_next_us > from) {
+				from = e->rx_next_us;
+			}
+			e->rx_next_us = from + got * 1000000 / e->bandwidth;
+		}
+	}
+
+	return 0;
+}
+
+static int emu_expect(emu_t *e, int dev, const void *data, size_t length,
+	const char *what)
+{
+	char buf[16];
+	int ret;
+
+	if ((ret = emu_read(e, dev, buf, length)) < 0) {
+		return ret;
+	}
+
+	if (memcmp(buf, data, length)) {
+		_e("unexpected %s", what);
+		hexdump(buf, length);
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads a raw image followed by its one byte XOR CRC
+ */
+static int emu_read_image(emu_t *e, int dev, size_t length,
+	unsigned char *crc)
+{
+	unsigned char sum = 0;
+	int ret;
+
+	while (length) {
+		size_t chunk = length < EMU_FRAME_MAX ? length : EMU_FRAME_MAX;
+		if ((ret = emu_read(e, dev, e->frame, chunk)) < 0) {
+			return ret;
+		}
+		sum ^= checksum_xor8(e->frame, chunk);
+		length -= chunk;
+	}
+
+	*crc = sum;
+	return 0;
+}
+
+/*
+ * The boot ROM ignores everything until it sees ATAT
+ */
+static int emu_wait_atat(emu_t *e) {
+	char window[4] = {};
+	unsigned seen = 0;
+	int ret;
+
+	e->in_boot = false;
+	while (seen <= e->atat_ignore) {
+		memmove(window, window + 1, 3);
+		if ((ret = emu_read(e, 0, window + 3, 1)) < 0) {
+			return ret;
+		}
+		if (!memcmp(window, "ATAT", 4)) {
+			memset(window, 0, sizeof(window));
+			seen++;
+		}
+	}
+
+	e->in_boot = true;
+	e->start_us = timing_now_us();
+	e->rx_bytes = 4;
+	e->tx_bytes = 0;
+	e->image_bytes = 0;
+	e->frames = 0;
+	e->dropped = 0;
+
+	return 0;
+}
+
+static int emu_check_crc(unsigned char got, unsigned char expected,
+	const char *what)
+{
+	if (got != expected) {
+		_e("%s CRC %02x, computed %02x", what, got, expected);
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+/*
+ * I9250: the commands with a long tail carry two extra bytes after
+ * the tail magic, ReqForceHwReset is the only one without an ACK
+ */
+static const struct {
+	unsigned code;
+	bool long_tail;
+	bool ack;
+} emu_i9250_cmds[] = {
+	{ EMU_CMD_SET_PORT_CONF, true, true, },
+	{ EMU_CMD_SEC_START, true, true, },
+	{ EMU_CMD_SEC_END, false, true, },
+	{ EMU_CMD_FORCE_HW_RESET, true, false, },
+	{ EMU_CMD_FLASH_SET_ADDRESS, true, true, },
+	{ EMU_CMD_FLASH_WRITE_BLOCK, false, true, },
+};
+
+static int emu_ack_i9250(emu_t *e, unsigned code, bool long_tail,
+	bool bad_sum)
+{
+	//length, magic, code, payload size, status, checksum, tail magic, tail
+	uint16_t status = 0;
+	uint16_t checksum = sizeof(status) + code
+		+ checksum_sum8(&status, sizeof(status)) + bad_sum;
+	uint16_t words[] = {
+		0, 0, 2, code, sizeof(status), status, checksum, 3, 0xeaea, 0,
+	};
+	uint32_t length = 14 + (long_tail ? 2 : 0);
+
+	memcpy(words, &length, 4);
+	return emu_send(e, 1, words, 4 + ((length + 3) & ~3));
+}
+
+static int emu_frames_i9250(emu_t *e, const char *boot_info, size_t info_size) {
+	int ret;
+
+	while (1) {
+		bool bad_sum = false;
+		struct {
+			uint32_t total_size;
+			uint16_t hdr_magic;
+			uint16_t cmd;
+			uint16_t data_size;
+		} __attribute__((packed)) hdr;
+
+		if ((ret = emu_read(e, 1, &hdr, sizeof(hdr))) < 0) {
+			return ret;
+		}
+
+		unsigned i;
+		for (i = 0; i < ARRAY_SIZE(emu_i9250_cmds); i++) {
+			if (emu_i9250_cmds[i].code == hdr.cmd) {
+				break;
+			}
+		}
+
+		if (i == ARRAY_SIZE(emu_i9250_cmds) || hdr.hdr_magic != 2
+			|| hdr.total_size != hdr.data_size + 10u)
+		{
+			_e("bad command header");
+			hexdump(&hdr, sizeof(hdr));
+			return -EPROTO;
+		}
+
+		if ((ret = emu_read(e, 1, e->frame, hdr.data_size)) < 0) {
+			return ret;
+		}
+
+		uint16_t tail[3];
+		size_t tail_size = emu_i9250_cmds[i].long_tail ? 6 : 4;
+		if ((ret = emu_read(e, 1, tail, tail_size)) < 0) {
+			return ret;
+		}
+
+		uint16_t checksum = hdr.data_size + hdr.cmd
+			+ checksum_sum8(e->frame, hdr.data_size);
+		if (tail[0] != checksum || tail[1] != 3
+			|| (tail_size == 6 && tail[2] != 0xeaea))
+		{
+			_e("command %x: checksum %x, computed %x, tail %x",
+				hdr.cmd, tail[0], checksum, tail[1]);
+			return -EBADMSG;
+		}
+		e->frames++;
+
+		switch (hdr.cmd) {
+		case EMU_CMD_SET_PORT_CONF:
+			if (hdr.data_size != info_size
+				|| memcmp(e->frame, boot_info, info_size))
+			{
+				_e("SetPortConf does not echo the Boot Info");
+				return -EPROTO;
+			}
+			break;
+		case EMU_CMD_FLASH_WRITE_BLOCK:
+			e->image_bytes += hdr.data_size;
+			e->blocks++;
+			if (e->drop_every && e->blocks % e->drop_every == 0) {
+				e->dropped++;
+				continue;
+			}
+			bad_sum = e->bad_sum_every && e->blocks % e->bad_sum_every == 0;
+			break;
+		case EMU_CMD_FORCE_HW_RESET:
+			return 0;
+		}
+
+		if ((ret = emu_ack_i9250(e, hdr.cmd, emu_i9250_cmds[i].long_tail,
+			bad_sum)) < 0)
+		{
+			return ret;
+		}
+	}
+}
+
+static int emu_boot_i9250(emu_t *e) {
+	unsigned char crc;
+	uint32_t length;
+	int ret;
+
+	if ((ret = emu_wait_atat(e)) < 0) {
+		return ret;
+	}
+
+	uint32_t id[] = { 0x00000001, EMU_I9250_BOOT_LAST_MARKER, };
+	if ((ret = emu_send(e, 0, id, sizeof(id))) < 0) {
+		return ret;
+	}
+
+	//ATATs resent while the reply was on its way are dropped
+	char magic[4];
+	do {
+		if ((ret = emu_read(e, 0, magic, 4)) < 0) {
+			return ret;
+		}
+	} while (!memcmp(magic, "ATAT", 4));
+	if (memcmp(magic, EMU_I9250_PSI_START_MAGIC, 4)) {
+		_e("unexpected PSI start magic");
+		return -EPROTO;
+	}
+
+	uint32_t psi_crc;
+	if ((ret = emu_read_image(e, 0, EMU_I9250_PSI_LENGTH, &crc)) < 0
+		|| (ret = emu_read(e, 0, &psi_crc, 4)) < 0)
+	{
+		return ret;
+	}
+	if (psi_crc != (((uint32_t)crc << 24) | 0xffffff)) {
+		_e("PSI CRC %08x, computed %02x", psi_crc, crc);
+		return -EBADMSG;
+	}
+
+	static const char psi_acks[] = "\xff\xff\xff\x01" "\xff\xff\xff\x01"
+		EMU_I9250_GENERAL_ACK "\x01\xdd\x00\x00";
+	if ((ret = emu_send(e, 0, psi_acks, 16)) < 0) {
+		return ret;
+	}
+
+	//the PSI runs, the rest of the boot goes over the second device
+	if ((ret = emu_expect(e, 1, EMU_I9250_PSI_CMD_EXEC, 4, "PSI exec")) < 0
+		|| (ret = emu_expect(e, 1, EMU_I9250_PSI_EXEC_DATA, 8, "PSI exec data")) < 0
+		|| (ret = emu_send(e, 1, EMU_I9250_GENERAL_ACK
+			EMU_I9250_PSI_READY_ACK, 8)) < 0)
+	{
+		return ret;
+	}
+
+	if ((ret = emu_expect(e, 1, "\x04\x00\x00\x00", 4, "EBL length size")) < 0
+		|| (ret = emu_read(e, 1, &length, 4)) < 0
+		|| (ret = emu_send(e, 1, EMU_I9250_GENERAL_ACK
+			EMU_I9250_EBL_HDR_ACK_MAGIC, 8)) < 0)
+	{
+		return ret;
+	}
+
+	uint32_t image_length;
+	if ((ret = emu_read(e, 1, &image_length, 4)) < 0) {
+		return ret;
+	}
+	if (image_length != length + 1) {
+		_e("EBL length %x, then %x", length, image_length);
+		return -EPROTO;
+	}
+
+	unsigned char ebl_crc;
+	if ((ret = emu_read_image(e, 1, length, &crc)) < 0
+		|| (ret = emu_read(e, 1, &ebl_crc, 1)) < 0
+		|| (ret = emu_check_crc(ebl_crc, crc, "EBL")) < 0
+		|| (ret = emu_send(e, 1, EMU_I9250_GENERAL_ACK
+			EMU_I9250_EBL_IMG_ACK_MAGIC, 8)) < 0)
+	{
+		return ret;
+	}
+
+	//length, then the Boot Info padded to words
+	static const char boot_info[] = "\x0c\x00\x00\x00"
+		"\x01\x00\x02\x00\x00\x00\x00\x00\xff\xff\xff\xff";
+	if ((ret = emu_send(e, 1, boot_info, 16)) < 0) {
+		return ret;
+	}
+
+	return emu_frames_i9250(e, boot_info + 4, 12);
+}
+
+/*
+ * I9100: every command is padded to a fixed size, the ACK echoes the
+ * header followed by a reply of the same fixed size
+ */
+static size_t emu_i9100_cmd_size(unsigned code) {
+	return code == EMU_CMD_SET_PORT_CONF ? 0x800 : 0x4000;
+}
+
+static bool emu_i9100_cmd_ack(unsigned code) {
+	return code != EMU_CMD_FLASH_WRITE_BLOCK && code != EMU_CMD_FORCE_HW_RESET;
+}
+
+static int emu_boot_i9100(emu_t *e) {
+	unsigned char crc, image_crc;
+	int ret;
+
+	if ((ret = emu_wait_atat(e)) < 0
+		|| (ret = emu_send(e, 0, "\x01\x06", 2)) < 0)
+	{
+		return ret;
+	}
+
+	struct {
+		uint8_t magic;
+		uint16_t length;
+		uint8_t padding;
+	} __attribute__((packed)) psi_hdr;
+	if ((ret = emu_read(e, 0, &psi_hdr, sizeof(psi_hdr))) < 0) {
+		return ret;
+	}
+	if (psi_hdr.magic != EMU_I9100_PSI_MAGIC) {
+		_e("bad PSI header magic %x", psi_hdr.magic);
+		return -EPROTO;
+	}
+
+	if ((ret = emu_read_image(e, 0, psi_hdr.length, &crc)) < 0
+		|| (ret = emu_read(e, 0, &image_crc, 1)) < 0
+		|| (ret = emu_check_crc(image_crc, crc, "PSI")) < 0)
+	{
+		return ret;
+	}
+
+	//22 opaque bytes, two single byte ACKs, then the PSI ACK magic
+	char psi_acks[26] = {};
+	memcpy(psi_acks + 22, "\x01\x01" EMU_I9100_PSI_ACK_MAGIC, 4);
+	if ((ret = emu_send(e, 0, psi_acks, sizeof(psi_acks))) < 0) {
+		return ret;
+	}
+
+	uint32_t length;
+	if ((ret = emu_read(e, 0, &length, 4)) < 0
+		|| (ret = emu_send(e, 0, EMU_I9100_EBL_HDR_ACK_MAGIC, 2)) < 0
+		|| (ret = emu_read_image(e, 0, length, &crc)) < 0
+		|| (ret = emu_read(e, 0, &image_crc, 1)) < 0
+		|| (ret = emu_check_crc(image_crc, crc, "EBL")) < 0
+		|| (ret = emu_send(e, 0, EMU_I9100_EBL_IMG_ACK_MAGIC, 2)) < 0)
+	{
+		return ret;
+	}
+
+	char boot_info[EMU_I9100_BOOT_INFO_SIZE];
+	memset(boot_info, 0xff, sizeof(boot_info));
+	memcpy(boot_info, "\x02\x00\x4c\x00", 4);
+	if ((ret = emu_send(e, 0, boot_info, sizeof(boot_info))) < 0) {
+		return ret;
+	}
+
+	while (1) {
+		struct {
+			uint16_t check;
+			uint16_t cmd;
+			uint32_t data_size;
+		} __attribute__((packed)) hdr;
+
+		if ((ret = emu_read(e, 0, &hdr, sizeof(hdr))) < 0) {
+			return ret;
+		}
+
+		size_t cmd_size = emu_i9100_cmd_size(hdr.cmd);
+		if (hdr.data_size > cmd_size) {
+			_e("command %x data size %x exceeds %zx", hdr.cmd,
+				hdr.data_size, cmd_size);
+			return -EPROTO;
+		}
+
+		if ((ret = emu_read(e, 0, e->frame, cmd_size)) < 0) {
+			return ret;
+		}
+
+		uint16_t check = hdr.data_size + hdr.cmd
+			+ checksum_sum8(e->frame, hdr.data_size);
+		if (check != hdr.check) {
+			_e("command %x: checksum %x, computed %x", hdr.cmd,
+				hdr.check, check);
+			return -EBADMSG;
+		}
+		e->frames++;
+
+		switch (hdr.cmd) {
+		case EMU_CMD_SET_PORT_CONF:
+			if (hdr.data_size != sizeof(boot_info)
+				|| memcmp(e->frame, boot_info, sizeof(boot_info)))
+			{
+				_e("SetPortConf does not echo the Boot Info");
+				return -EPROTO;
+			}
+			break;
+		case EMU_CMD_FLASH_WRITE_BLOCK:
+			e->image_bytes += hdr.data_size;
+			break;
+		case EMU_CMD_FORCE_HW_RESET:
+			return 0;
+		}
+
+		if (emu_i9100_cmd_ack(hdr.cmd)) {
+			static char ack[EMU_MSG_MAX];
+			memset(ack, 0, 8 + cmd_size);
+			memcpy(ack, &hdr, 8);
+			if ((ret = emu_send(e, 0, ack, 8 + cmd_size)) < 0) {
+				return ret;
+			}
+		}
+	}
+}
+
+static int emu_open_pty(emu_t *e, int dev, const char *dir) {
+	char link[PATH_MAX];
+	struct termios tio;
+
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+		_e("failed to allocate a pty: %s", strerror(errno));
+		return -errno;
+	}
+
+	//the loader does not touch termios, so the pty has to be raw already
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(fd, TCSANOW, &tio);
+
+	const char *pts = ptsname(fd);
+	//an open slave keeps the master usable while the loader reopens it
+	e->slave[dev] = open(pts, O_RDWR | O_NOCTTY);
+	if (e->slave[dev] < 0) {
+		_e("failed to open %s: %s", pts, strerror(errno));
+		return -errno;
+	}
+	tcgetattr(e->slave[dev], &tio);
+	cfmakeraw(&tio);
+	tcsetattr(e->slave[dev], TCSANOW, &tio);
+
+	snprintf(link, sizeof(link), "%s/boot%d", dir, dev);
+	unlink(link);
+	if (symlink(pts, link) < 0) {
+		_e("failed to link %s to %s: %s", link, pts, strerror(errno));
+		return -errno;
+	}
+
+	e->master[dev] = fd;
+	_i("boot%d is %s", dev, pts);
+
+	return 0;
+}
+
+static void usage(const char *name) {
+	printf("usage: %s [options]\n"
+		"  -b <board>    protocol to emulate: i9250 (default) or i9100\n"
+		"  -d <dir>      where to create the boot device links (default .)\n"
+		"  -l <us>       latency of every reply\n"
+		"  -B <bytes/s>  link bandwidth, unlimited by default\n"
+		"  -n <count>    exit after this many boots\n"
+		"  -C            crash after every boot by hanging up the ptys\n"
+		"  -F <count>    drop the ACK of every count-th ReqFlashWriteBlock (I9250)\n"
+		"  -K <count>    break the checksum of every count-th\n"
+		"                ReqFlashWriteBlock ACK (I9250)\n"
+		"  -A <count>    ignore the first count ATATs of every boot\n"
+		"  -h            show this help\n", name);
+}
+
+int main(int argc, char **argv) {
+	emu_t *e = &emu;
+	const char *dir = ".";
+	unsigned max_boots = 0;
+	unsigned boots;
+	int opt;
+	int ret;
+
+	e->i9250 = true;
+	while ((opt = getopt(argc, argv, "b:d:l:B:n:CF:K:A:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			if (!strcmp(optarg, "i9100")) {
+				e->i9250 = false;
+			}
+			else if (!strcmp(optarg, "i9250")) {
+				e->i9250 = true;
+			}
+			else {
+				_e("unknown board %s", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'l':
+			e->latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			e->bandwidth = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			max_boots = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			e->crash = true;
+			break;
+		case 'F':
+			e->drop_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'K':
+			e->bad_sum_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			e->atat_ignore = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	checksum_init();
+
+	unsigned devs = e->i9250 ? 2 : 1;
+	unsigned i;
+	for (i = 0; i < devs; i++) {
+		if ((ret = emu_open_pty(e, i, dir)) < 0) {
+			return ret;
+		}
+	}
+
+	printf("ready\n");
+	fflush(stdout);
+
+	for (boots = 0; !max_boots || boots < max_boots; boots++) {
+		ret = e->i9250 ? emu_boot_i9250(e) : emu_boot_i9100(e);
+		if (ret == 0) {
+			ret = emu_flush(e, true);
+		}
+
+		uint64_t took = timing_now_us() - e->start_us;
+		if (ret < 0) {
+			printf("boot %u failed %d\n", boots, ret);
+			e->queue_count = 0;
+			for (i = 0; i < devs; i++) {
+				tcflush(e->master[i], TCIFLUSH);
+			}
+		}
+		else {
+			printf("boot %u ok us=%llu rx=%llu tx=%llu frames=%u image=%llu"
+				" dropped=%u\n",
+				boots, (unsigned long long)took,
+				(unsigned long long)e->rx_bytes,
+				(unsigned long long)e->tx_bytes, e->frames,
+				(unsigned long long)e->image_bytes, e->dropped);
+		}
+		fflush(stdout);
+
+		//the loader sees a hangup on its boot fd and boots again
+		if (e->crash && ret == 0) {
+			for (i = 0; i < devs; i++) {
+				close(e->master[i]);
+				close(e->slave[i]);
+				if ((ret = emu_open_pty(e, i, dir)) < 0) {
+					return ret;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
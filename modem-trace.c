@@ -0,0 +1,124 @@
+/*
+ * modem-trace.c: decoder for the modem-ctl binary trace
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Prints a trace dumped by "modem-ctl -T", one record per line:
+ *
+ *   <ms since the first record> <seq> <event> fd=<fd> len=<len> <detail>
+ *
+ * tx/rx/dump records show the first bytes in hex, error/debug records
+ * the function and line, begin/end records the boot phase.
+ */
+
+#include "common.h"
+#include "timing.h"
+#include "trace.h"
+
+static void trace_print(const trace_record *rec, uint64_t base_ns) {
+	const char *name = trace_event_name(rec->event);
+	uint64_t at = rec->time_ns - base_ns;
+	size_t n = rec->len < TRACE_DATA_SIZE ? rec->len : TRACE_DATA_SIZE;
+	size_t i;
+
+	printf("%6llu.%06llu %8u %-6s", (unsigned long long)(at / 1000000),
+		(unsigned long long)(at % 1000000), rec->seq, name ? name : "?");
+
+	switch (rec->event) {
+		case TRACE_TX:
+		case TRACE_RX:
+		case TRACE_DUMP:
+			printf(" fd=%d len=%u ", rec->fd, rec->len);
+			for (i = 0; i < n; i++) {
+				printf(" %02x", rec->data[i]);
+			}
+			if (n < rec->len) {
+				printf(" ...");
+			}
+			break;
+		case TRACE_ERROR:
+		case TRACE_DEBUG:
+			printf(" %.*s:%u", (int)n, (const char*)rec->data, rec->arg);
+			break;
+		case TRACE_PHASE_BEGIN:
+		case TRACE_PHASE_END:
+			name = timing_phase_name(rec->arg);
+			printf(" %s", name ? name : "?");
+			break;
+		default:
+			printf(" event=%u", rec->event);
+			break;
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	int ret = 1;
+	trace_file_header header;
+	trace_record rec;
+	uint64_t base_ns = 0;
+	uint32_t i;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+		return 1;
+	}
+
+	FILE *file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "failed to open %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1
+		|| memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)))
+	{
+		fprintf(stderr, "%s is not a modem-ctl trace\n", argv[1]);
+		goto fail;
+	}
+
+	if (header.version != TRACE_VERSION || header.record_size != sizeof(rec)) {
+		fprintf(stderr, "unsupported trace version %u record size %u\n",
+			header.version, header.record_size);
+		goto fail;
+	}
+
+	printf("%u records, %u older records dropped\n",
+		header.count, header.dropped);
+
+	for (i = 0; i < header.count; i++) {
+		if (fread(&rec, sizeof(rec), 1, file) != 1) {
+			fprintf(stderr, "trace truncated after %u records\n", i);
+			goto fail;
+		}
+		if (!i) {
+			base_ns = rec.time_ns;
+		}
+		trace_print(&rec, base_ns);
+	}
+	ret = 0;
+
+fail:
+	fclose(file);
+	return ret;
+}
@@ -22,16 +22,69 @@
 //modemctl shared code
 #include "modemctl_common.h"
 
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/fs.h>
+
 /*
  * modemctl generic functions
  */
+const char *modemctl_path(fwloader_context *ctx, enum fwloader_path path,
+	const char *fallback)
+{
+	if (path < FWLOADER_PATH_COUNT && ctx->opts->paths[path]) {
+		return ctx->opts->paths[path];
+	}
+
+	return fallback;
+}
+
+/*
+ * Without the modem_if driver (bootloader emulator on a pty) the link
+ * reports connected, the modem reports online and everything else
+ * succeeds. A crash played by the emulator is reported until the modem
+ * is reset, like the driver does across a reopen of the boot device.
+ */
+static int modemctl_ioctl(fwloader_context *ctx, int fd, unsigned long code,
+	void *data)
+{
+	if (!ctx->opts->emulate_ioctls) {
+		return c_ioctl(fd, code, data);
+	}
+
+	_d("emulated ioctl fd=%d code=%lx", fd, code);
+	switch (code) {
+	case IOCTL_LINK_CONNECTED:
+		return 1;
+	case IOCTL_MODEM_STATUS:
+		//the emulator hangs up its ptys to play a modem crash
+		{
+			struct pollfd pfd = { .fd = fd, .events = 0, };
+			if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLHUP)) {
+				ctx->emu_crashed = true;
+			}
+		}
+		return ctx->emu_crashed ? STATE_CRASH_RESET : STATE_ONLINE;
+	case IOCTL_MODEM_RESET:
+	case IOCTL_MODEM_ON:
+	case IOCTL_MODEM_OFF:
+		ctx->emu_crashed = false;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
 int modemctl_link_set_active(fwloader_context *ctx, bool enabled) {
 	unsigned status = enabled;
 	int ret;
 	unsigned long ioctl_code;
 
 	ioctl_code = IOCTL_LINK_CONTROL_ACTIVE;
-	ret = c_ioctl(ctx->link_fd, ioctl_code, &status);
+	ret = modemctl_ioctl(ctx, ctx->link_fd, ioctl_code, &status);
 
 	if (ret < 0) {
 		_d("failed to set link active to %d", enabled);
@@ -49,7 +102,7 @@ int modemctl_link_set_enabled(fwloader_context *ctx, bool enabled) {
 	unsigned long ioctl_code;
 
 	ioctl_code = IOCTL_LINK_CONTROL_ENABLE;
-	ret = c_ioctl(ctx->link_fd, ioctl_code, &status);
+	ret = modemctl_ioctl(ctx, ctx->link_fd, ioctl_code, &status);
 
 	if (ret < 0) {
 		_d("failed to set link state to %d", enabled);
@@ -61,103 +114,1552 @@ fail:
 	return ret;
 }
 
-int modemctl_wait_link_ready(fwloader_context *ctx) {
+/*
+ * Wait engine: re-checks a condition whenever the kernel tells us
+ * something changed (POLLHUP/POLLERR on the watched fd, a uevent
+ * from the modem_if driver) and otherwise polls it with a short
+ * exponential backoff, all against a CLOCK_MONOTONIC deadline.
+ */
+typedef int (*modemctl_wait_check)(fwloader_context *ctx);
+
+static int uevent_open(void) {
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_pid = 0,
+		.nl_groups = 1,
+	};
+
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		_d("uevent socket unavailable: %s", strerror(errno));
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		_d("failed to bind uevent socket: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Reads all pending uevents. A uevent is NUL separated "key=value"
+ * fields after "action@devpath", so they are joined for the log.
+ */
+static void uevent_drain(int fd) {
+	char buf[1024];
+	ssize_t i, ret;
+
+	while ((ret = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+		for (i = 0; i < ret; i++) {
+			if (!buf[i]) {
+				buf[i] = ' ';
+			}
+		}
+		buf[ret] = '\0';
+		_d("uevent: %s", buf);
+	}
+}
+
+static int modemctl_wait_event(fwloader_context *ctx, int fd,
+	modemctl_wait_check check, unsigned timeout_ms)
+{
 	int ret;
+	uint64_t deadline = timing_now_us() + (uint64_t)timeout_ms * 1000;
+	unsigned backoff = WAIT_BACKOFF_MIN_US;
 
-	struct timeval tv_start = {};
-	struct timeval tv_end = {};
+	if (io_get_deadline() && io_get_deadline() < deadline) {
+		deadline = io_get_deadline();
+	}
 
-	gettimeofday(&tv_start, 0);;
+	struct pollfd fds[2] = {
+		//no events requested: only POLLHUP/POLLERR wake us up
+		{ .fd = fd, .events = 0, },
+		{ .fd = uevent_open(), .events = POLLIN, },
+	};
 
-	//link wakeup timeout in milliseconds
-	long diff = 0;
+	while (1) {
+		if ((ret = check(ctx)) < 0) {
+			goto fail;
+		}
 
-	do {
-		ret = c_ioctl(ctx->link_fd, IOCTL_LINK_CONNECTED, 0);
-		if (ret < 0) {
+		if (ret > 0) {
+			ret = 0;
 			goto fail;
 		}
 
-		if (ret == 1) {
-			return 0;
+		uint64_t now = timing_now_us();
+		if (now >= deadline) {
+			ret = -ETIMEDOUT;
+			goto fail;
+		}
+
+		uint64_t wait = deadline - now;
+		if (wait > backoff) {
+			wait = backoff;
+		}
+
+		struct timespec ts = {
+			.tv_sec = wait / 1000000,
+			.tv_nsec = (wait % 1000000) * 1000,
+		};
+
+		ret = ppoll(fds, ARRAY_SIZE(fds), &ts, 0);
+		if (ret < 0 && errno != EINTR) {
+			_e("failed to poll for modem events: %s", strerror(errno));
+			ret = -errno;
+			goto fail;
+		}
+
+		if (ret <= 0) {
+			backoff *= 2;
+			if (backoff > LINK_POLL_DELAY_US) {
+				backoff = LINK_POLL_DELAY_US;
+			}
+			continue;
 		}
 
-		usleep(LINK_POLL_DELAY_US);
-		gettimeofday(&tv_end, 0);;
+		if (fds[0].revents) {
+			//hangup is level triggered, only use it as a single wakeup
+			_d("fd %d signalled %x", fd, fds[0].revents);
+			fds[0].fd = -1;
+		}
 
-		diff = (tv_end.tv_sec - tv_start.tv_sec) * 1000;
-		diff += (tv_end.tv_usec - tv_start.tv_usec) / 1000;
-	} while (diff < LINK_TIMEOUT_MS);
+		if (fds[1].revents & POLLIN) {
+			uevent_drain(fds[1].fd);
+		}
+	}
 
-	ret = -ETIMEDOUT;
-	
 fail:
+	if (fds[1].fd >= 0) {
+		close(fds[1].fd);
+	}
+
 	return ret;
 }
 
+static int check_link_ready(fwloader_context *ctx) {
+	int ret = modemctl_ioctl(ctx, ctx->link_fd, IOCTL_LINK_CONNECTED, 0);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return ret == 1;
+}
+
+static int check_modem_online(fwloader_context *ctx) {
+	int ret = modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_STATUS, 0);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return ret == STATE_ONLINE;
+}
+
+int modemctl_link_connected(fwloader_context *ctx) {
+	//the I9250 link_pm device is optional
+	if (ctx->link_fd < 0) {
+		return -ENODEV;
+	}
+
+	return check_link_ready(ctx);
+}
+
+int modemctl_wait_link_ready(fwloader_context *ctx) {
+	return modemctl_wait_event(ctx, ctx->link_fd, check_link_ready,
+		LINK_TIMEOUT_MS);
+}
+
 int modemctl_wait_modem_online(fwloader_context *ctx) {
-	int ret;
+	return modemctl_wait_event(ctx, ctx->boot_fd, check_modem_online,
+		LINK_TIMEOUT_MS);
+}
 
-	struct timeval tv_start = {};
-	struct timeval tv_end = {};
+static volatile sig_atomic_t modemctl_stopping;
 
-	gettimeofday(&tv_start, 0);;
+static void modemctl_stop(int sig) {
+	modemctl_stopping = 1;
+}
 
-	//link wakeup timeout in milliseconds
-	long diff = 0;
+static int check_modem_crashed(fwloader_context *ctx) {
+	if (modemctl_stopping) {
+		return 1;
+	}
 
-	do {
-		ret = c_ioctl(ctx->boot_fd, IOCTL_MODEM_STATUS, 0);
-		if (ret < 0) {
-			goto fail;
-		}
+	int ret = modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_STATUS, 0);
+	if (ret < 0) {
+		return ret;
+	}
 
-		if (ret == STATE_ONLINE) {
-			return 0;
-		}
+	return ret != STATE_ONLINE && ret != STATE_BOOTING
+		&& ret != STATE_LOADER_DONE;
+}
+
+/*
+ * Waits until the modem leaves the online state, returns the new state,
+ * zero when the daemon is being stopped or a negative error code
+ */
+static int modemctl_wait_modem_crash(fwloader_context *ctx) {
+	int ret;
 
-		usleep(LINK_POLL_DELAY_US);
-		gettimeofday(&tv_end, 0);;
+	do {
+		ret = modemctl_wait_event(ctx, ctx->boot_fd, check_modem_crashed,
+			DAEMON_WATCH_TIMEOUT_MS);
+	} while (ret == -ETIMEDOUT && !modemctl_stopping);
 
-		diff = (tv_end.tv_sec - tv_start.tv_sec) * 1000;
-		diff += (tv_end.tv_usec - tv_start.tv_usec) / 1000;
-	} while (diff < LINK_TIMEOUT_MS);
+	if (ret < 0 || modemctl_stopping) {
+		return modemctl_stopping ? 0 : ret;
+	}
 
-	ret = -ETIMEDOUT;
-	
-fail:
-	return ret;
+	return modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_STATUS, 0);
 }
 
 int modemctl_modem_power(fwloader_context *ctx, bool enabled) {
 	if (enabled) {
-		return c_ioctl(ctx->boot_fd, IOCTL_MODEM_ON, 0);
+		return modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_ON, 0);
 	}
 	else {
-		return c_ioctl(ctx->boot_fd, IOCTL_MODEM_OFF, 0);
+		return modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_OFF, 0);
 	}
 	return -1;
 }
 
 int modemctl_modem_boot_power(fwloader_context *ctx, bool enabled) {
 	if (enabled) {
-		return c_ioctl(ctx->boot_fd, IOCTL_MODEM_BOOT_ON, 0);
+		return modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_BOOT_ON, 0);
 	}
 	else {
-		return c_ioctl(ctx->boot_fd, IOCTL_MODEM_BOOT_OFF, 0);
+		return modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_BOOT_OFF, 0);
 	}
 	return -1;
 }
 
-unsigned char calculateCRC(void* data, size_t offset, size_t length)
+int modemctl_modem_reset(fwloader_context *ctx) {
+	return modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_RESET, 0);
+}
+
+/*
+ * A CP that reset itself silently is still powered and its boot ROM
+ * can take it from the reset line, as long as the link to it is still
+ * up. The driver keeps that state across runs, so this holds for a
+ * one-shot boot as much as for the daemon. Anything else, a ramdump in
+ * progress or a modem that went off, needs the power cycle. Not yet
+ * tried on hardware, so only with opts->warm_reset.
+ */
+static bool modemctl_warm_reset_possible(fwloader_context *ctx) {
+	int state, link;
+
+	if (!ctx->opts->warm_reset) {
+		return false;
+	}
+
+	state = modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_STATUS, 0);
+	if (state != STATE_CRASH_RESET) {
+		_d("modem state %d, power cycling it", state);
+		return false;
+	}
+
+	if ((link = modemctl_link_connected(ctx)) <= 0) {
+		_i("link is %s after the silent reset, power cycling the modem",
+			link < 0 ? "unknown" : "down");
+		return false;
+	}
+
+	return true;
+}
+
+int modemctl_hard_reset(fwloader_context *ctx, reset_fn warm, reset_fn cold) {
+	uint64_t start = timing_now_us();
+	int ret;
+
+	if (modemctl_warm_reset_possible(ctx)) {
+		if ((ret = warm(ctx)) == 0) {
+			uint64_t took = timing_now_us() - start;
+			if (ctx->cold_reset_us > took) {
+				_r("warm restart in %llu us, %llu us less than a power cycle",
+					(unsigned long long)took,
+					(unsigned long long)(ctx->cold_reset_us - took));
+			}
+			else {
+				_r("warm restart in %llu us", (unsigned long long)took);
+			}
+			return 0;
+		}
+		_i("warm restart failed: %s, power cycling the modem", strerror(-ret));
+		start = timing_now_us();
+	}
+
+	if ((ret = cold(ctx)) < 0) {
+		return ret;
+	}
+
+	ctx->cold_reset_us = timing_now_us() - start;
+	_r("power cycle in %llu us", (unsigned long long)ctx->cold_reset_us);
+
+	return 0;
+}
+
+/*
+ * Polls the output queue of the boot fd until it is empty. Returns 1
+ * once drained, 0 at the deadline and a negative error code when the
+ * driver cannot report its queue.
+ */
+static int modemctl_wait_drained(int fd, uint64_t deadline_us) {
+	int queued;
+
+	for (;;) {
+		if (ioctl(fd, TIOCOUTQ, &queued) < 0) {
+			return -errno;
+		}
+		if (!queued) {
+			return 1;
+		}
+		if (timing_now_us() >= deadline_us) {
+			return 0;
+		}
+		usleep(SEC_DRAIN_POLL_US);
+	}
+}
+
+int modemctl_wait_sec_download(fwloader_context *ctx, unsigned delay_us) {
+	int ret = 0;
+	uint64_t start = timing_now_us();
+	uint64_t spent;
+
+	switch (ctx->sec_wait) {
+	case SEC_WAIT_ACK:
+		_d("last block ACK received, not waiting");
+		return 0;
+	case SEC_WAIT_SELECT:
+		ret = modemctl_wait_drained(ctx->boot_fd, start + delay_us);
+		if (ret < 0) {
+			_d("boot fd queue unknown, falling back to fixed delay");
+			break;
+		}
+		if (ret == 0) {
+			_d("boot fd not drained, deadline reached");
+			return 0;
+		}
+
+		//an empty queue only means the modem has the data, its reply is
+		//the earliest sign that it is done with it
+		spent = timing_now_us() - start;
+		if (spent < delay_us
+			&& read_select(ctx->boot_fd, (delay_us - spent) / 1000) > 0)
+		{
+			_d("modem replied %llu us after the last block",
+				(unsigned long long)(timing_now_us() - start));
+			return 0;
+		}
+		break;
+	default:
+		break;
+	}
+
+	spent = timing_now_us() - start;
+	if (spent < delay_us) {
+		usleep(delay_us - spent);
+	}
+
+	return 0;
+}
+
+int modemctl_stream_image(fwloader_context *ctx, char *data, size_t length,
+	size_t chunk_size, unsigned char *crc)
+{
+	unsigned char image_crc = 0;
+	size_t pos = 0;
+
+	while (pos < length) {
+		size_t remaining = length - pos;
+		size_t chunk = chunk_size < remaining ? chunk_size : remaining;
+
+		if (crc) {
+			image_crc ^= checksum_xor8(data + pos, chunk);
+		}
+
+		struct iovec iov = {
+			.iov_base = data + pos,
+			.iov_len = chunk,
+		};
+		ssize_t ret = write_iov(ctx->boot_fd, &iov, 1);
+		if (ret < 0) {
+			_e("failed to write image chunk at 0x%zx", pos);
+			return ret;
+		}
+
+		pos += chunk;
+	}
+
+	if (crc) {
+		*crc = image_crc;
+	}
+
+	return 0;
+}
+
+/*
+ * Sends a radio partition range in chunk_size pieces like
+ * modemctl_stream_image(), returns -EOPNOTSUPP before anything was sent
+ * when boot_fd cannot do sendfile()
+ */
+static int modemctl_sendfile_image(fwloader_context *ctx, size_t offset,
+	size_t length, size_t chunk_size)
 {
-	unsigned char crc = 0;
-	unsigned char *ptr = (unsigned char*)(data + offset);
-	
-	while (length--) {
-		crc ^= *ptr++;
+	size_t pos = 0;
+
+	if (ctx->no_sendfile || ctx->opts->no_sendfile || ctx->radio_fd < 0) {
+		return -EOPNOTSUPP;
+	}
+
+	while (pos < length) {
+		size_t remaining = length - pos;
+		size_t chunk = chunk_size < remaining ? chunk_size : remaining;
+
+		ssize_t ret = send_file(ctx->boot_fd, ctx->radio_fd, offset + pos,
+			chunk);
+		if (!pos && (ret == -EINVAL || ret == -ENOSYS)) {
+			_i("boot fd does not support sendfile, using write");
+			ctx->no_sendfile = true;
+			return -EOPNOTSUPP;
+		}
+		if (ret < 0) {
+			_e("failed to send image chunk at 0x%zx", pos);
+			return ret;
+		}
+
+		pos += chunk;
+	}
+
+	return 0;
+}
+
+int modemctl_send_raw_image(fwloader_context *ctx, enum xmm6260_image type,
+	size_t chunk_size, unsigned char *crc)
+{
+	int ret;
+	char *data = ctx->part_data[type];
+	size_t length = ctx->parts[type].length;
+
+	if (manifest_part_valid(ctx->sums, type)) {
+		*crc = ctx->sums->parts[type].crc;
+		ret = modemctl_sendfile_image(ctx, ctx->parts[type].offset, length,
+			chunk_size);
+		if (ret != -EOPNOTSUPP) {
+			return ret;
+		}
+		return modemctl_stream_image(ctx, data, length, chunk_size, NULL);
+	}
+
+	if ((ret = modemctl_stream_image(ctx, data, length, chunk_size, crc)) < 0) {
+		return ret;
+	}
+
+	//while the worker runs it owns the tables
+	if (!ctx->csum_worker.running) {
+		manifest_record_crc(ctx->sums, type, *crc);
+	}
+
+	return 0;
+}
+
+uint16_t modemctl_block_sum(fwloader_context *ctx, enum xmm6260_image type,
+	size_t offset, size_t length)
+{
+	const uint16_t *cached = manifest_block_sum(ctx->sums, type, offset, length);
+	if (cached) {
+		return *cached;
+	}
+
+	uint32_t sum = checksum_sum8(ctx->part_data[type] + offset, length);
+	if (!ctx->csum_worker.running) {
+		manifest_record_block(ctx->sums, type, offset, length, sum);
+	}
+
+	return sum;
+}
+
+int modemctl_radio_size(fwloader_context *ctx) {
+	uint64_t size = 0;
+
+	if (S_ISBLK(ctx->radio_stat.st_mode)) {
+		if (ioctl(ctx->radio_fd, BLKGETSIZE64, &size) < 0) {
+			_e("failed to get radio partition size: %s", strerror(errno));
+			return -errno;
+		}
+	}
+	else {
+		size = ctx->radio_stat.st_size;
+	}
+
+	ctx->radio_size = size;
+	_d("radio partition size 0x%llx", (unsigned long long)size);
+
+	return 0;
+}
+
+int modemctl_radio_open(fwloader_context *ctx, const char *path) {
+	ctx->radio_fd = open(path, O_RDONLY);
+	if (ctx->radio_fd < 0) {
+		_e("failed to open radio firmware");
+		return -errno;
+	}
+	else {
+		_d("opened radio image %s, fd=%d", path, ctx->radio_fd);
+	}
+
+	if (fstat(ctx->radio_fd, &ctx->radio_stat) < 0) {
+		_e("failed to stat radio image, error %s", strerror(errno));
+		return -errno;
+	}
+
+	if (modemctl_radio_size(ctx) < 0) {
+		return -EIO;
+	}
+
+	int ret;
+	if ((ret = modemctl_radio_map(ctx)) < 0) {
+		return ret;
+	}
+
+	modemctl_prefetch_parts(ctx);
+	return 0;
+}
+
+int modemctl_radio_map(fwloader_context *ctx) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	unsigned i;
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		size_t offset = ctx->parts[i].offset;
+		size_t length = ctx->parts[i].length;
+		radio_window *map = ctx->radio_maps + i;
+
+		if (offset > ctx->radio_size || length > ctx->radio_size - offset) {
+			_e("radio part %u at 0x%zx+0x%zx is past the end of the "
+				"0x%zx byte partition", i, offset, length, ctx->radio_size);
+			return -EINVAL;
+		}
+
+		map->offset = offset & ~(page - 1);
+		map->size = offset + length - map->offset;
+		map->base = mmap(0, map->size, PROT_READ, MAP_SHARED, ctx->radio_fd,
+			map->offset);
+		if (map->base == MAP_FAILED) {
+			_e("failed to mmap radio part %u, error %s", i, strerror(errno));
+			map->base = NULL;
+			return -errno;
+		}
+
+		ctx->part_data[i] = map->base + (offset - map->offset);
+		_d("radio part %u mapped at 0x%llx+0x%zx", i,
+			(unsigned long long)map->offset, map->size);
+	}
+
+	return 0;
+}
+
+/*
+ * Pins the firmware components so a crash recovery never waits for the
+ * eMMC, failing that (RLIMIT_MEMLOCK) only costs speed
+ */
+static void modemctl_lock_parts(fwloader_context *ctx) {
+	unsigned i;
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		radio_window *map = ctx->radio_maps + i;
+
+		if (map->base && mlock(map->base, map->size) < 0) {
+			_i("failed to lock radio part %u: %s", i, strerror(errno));
+		}
+	}
+
+	if (ctx->nvdata.map && mlock(ctx->nvdata.map, ctx->nvdata.size) < 0) {
+		_i("failed to lock NVDATA: %s", strerror(errno));
+	}
+}
+
+void modemctl_prefetch_parts(fwloader_context *ctx) {
+	//in the order the bootloader asks for them
+	static const enum xmm6260_image order[] = {
+		PSI, EBL, SECURE_IMAGE, FIRMWARE, NVDATA,
+	};
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(order); i++) {
+		enum xmm6260_image type = order[i];
+		radio_window *map = ctx->radio_maps + type;
+		if (!map->base) {
+			continue;
+		}
+
+		if (readahead(ctx->radio_fd, map->offset, map->size) < 0) {
+			_d("readahead of part %d failed: %s", type, strerror(errno));
+		}
+
+		if (madvise(map->base, map->size, MADV_WILLNEED) < 0) {
+			_d("MADV_WILLNEED on part %d failed: %s", type, strerror(errno));
+		}
+
+		if (type == FIRMWARE || type == NVDATA) {
+			madvise(map->base, map->size, MADV_SEQUENTIAL);
+		}
+	}
+}
+
+void modemctl_fingerprint(fwloader_context *ctx, radio_fingerprint *fp) {
+	manifest_fingerprint(ctx->part_data, ctx->radio_size, ctx->parts, fp);
+
+	if (ctx->nvdata.map) {
+		manifest_fingerprint_add(fp, ctx->nvdata.digest,
+			sizeof(ctx->nvdata.digest));
 	}
+}
+
+void modemctl_checksums_load(fwloader_context *ctx, const char *board,
+	uint32_t block_size)
+{
+	const char *path = ctx->opts->manifest_path;
+	bool persist = !path || strcmp(path, MANIFEST_DISABLED);
+
+	if (ctx->sums) {
+		radio_fingerprint fp;
+		modemctl_fingerprint(ctx, &fp);
+		if (!memcmp(&fp, &ctx->sums->fp, sizeof(fp))) {
+			_d("reusing the checksums of the previous boot");
+			return;
+		}
 
-	return crc;
+		_i("radio partition changed, rebuilding checksums");
+		ctx->sums_cached = false;
+		manifest_free(ctx->sums);
+		free(ctx->sums);
+		ctx->sums = NULL;
+	}
+
+	//the worker and multi-modem boots need the tables without a file
+	if (!persist && !ctx->opts->checksum_worker && !ctx->opts->device_count) {
+		_d("checksum manifest disabled");
+		return;
+	}
+
+	if (!persist) {
+		ctx->manifest_path[0] = '\0';
+	}
+	else if (path) {
+		snprintf(ctx->manifest_path, sizeof(ctx->manifest_path), "%s", path);
+	}
+	else {
+		snprintf(ctx->manifest_path, sizeof(ctx->manifest_path),
+			MANIFEST_DIR "/xmm6260_%s.manifest", board);
+	}
+
+	ctx->sums = calloc(1, sizeof(*ctx->sums));
+	if (!ctx->sums) {
+		_e("failed to allocate checksum tables");
+		return;
+	}
+
+	if (manifest_init(ctx->sums, ctx->parts, block_size) < 0) {
+		free(ctx->sums);
+		ctx->sums = NULL;
+		return;
+	}
+
+	modemctl_fingerprint(ctx, &ctx->sums->fp);
+
+	if (persist && manifest_load(ctx->manifest_path, ctx->sums) == 0) {
+		_i("using cached checksums from %s", ctx->manifest_path);
+		ctx->sums_cached = true;
+	}
+	else {
+		if (persist) {
+			_i("checksum manifest %s will be rebuilt", ctx->manifest_path);
+		}
+
+		if (ctx->opts->checksum_worker) {
+			checksum_worker_start(&ctx->csum_worker, ctx->sums,
+				ctx->part_data, ctx->parts);
+		}
+	}
+}
+
+void modemctl_checksums_commit(fwloader_context *ctx, bool success) {
+	if (!ctx->sums) {
+		return;
+	}
+
+	checksum_worker_join(&ctx->csum_worker, !success);
+
+	//without a manifest path the tables were only there for the worker
+	if (success) {
+		if (ctx->manifest_path[0] && ctx->sums->dirty
+			&& manifest_save(ctx->manifest_path, ctx->sums) == 0)
+		{
+			_i("saved checksum manifest %s", ctx->manifest_path);
+			ctx->sums->dirty = false;
+		}
+		//a completed boot vouches for whatever is in the tables now
+		ctx->sums_cached = true;
+		return;
+	}
+
+	if (ctx->sums_cached && ctx->manifest_path[0]) {
+		_i("boot failed with cached checksums, dropping %s",
+			ctx->manifest_path);
+		unlink(ctx->manifest_path);
+	}
+
+	manifest_free(ctx->sums);
+	free(ctx->sums);
+	ctx->sums = NULL;
+	ctx->sums_cached = false;
+}
+
+void modemctl_checksums_free(fwloader_context *ctx) {
+	checksum_worker_join(&ctx->csum_worker, true);
+
+	if (ctx->sums) {
+		manifest_free(ctx->sums);
+		free(ctx->sums);
+		ctx->sums = NULL;
+		ctx->sums_cached = false;
+	}
+}
+
+void modemctl_chunk_setup(fwloader_context *ctx, const char *board,
+	const uint32_t *sizes, unsigned count)
+{
+	char path[PATH_MAX];
+
+	ctx->sec_chunk = sizes[0];
+
+	snprintf(path, sizeof(path), MANIFEST_DIR "/xmm6260_%s.chunk", board);
+	if (chunk_tune_init(&ctx->chunk_tune, path, sizes, count) < 0) {
+		return;
+	}
+
+	if (ctx->opts->chunk_mode != CHUNK_MODE_FIXED) {
+		ctx->sec_chunk = chunk_tune_load(&ctx->chunk_tune);
+	}
+
+	if (ctx->opts->chunk_mode == CHUNK_MODE_CALIBRATE && count < 2) {
+		_i("%s takes a single block size, nothing to calibrate", board);
+	}
+
+	_d("secure image chunk size 0x%x", ctx->sec_chunk);
+}
+
+int modemctl_block_retry(fwloader_context *ctx, enum xmm6260_image type,
+	size_t offset, unsigned *retries, int error)
+{
+	int ret;
+
+	//a closed fd or an expired boot deadline will not get any better
+	if (error == -EPIPE || error == -ENOMEM || *retries >= SEC_BLOCK_RETRY_MAX
+		|| (io_get_deadline() && timing_now_us() >= io_get_deadline()))
+	{
+		_e("giving up on block 0x%zx after %u retries", offset, *retries);
+		return error;
+	}
+
+	if ((ret = rx_drain(&ctx->boot_rx, SEC_RETRY_QUIET_MS)) < 0) {
+		_e("failed to drain the boot fd");
+		return ret;
+	}
+
+	(*retries)++;
+	timing_retry(&ctx->timing);
+	_i("resending image %d from block 0x%zx (retry %u/%u, %d stale bytes)",
+		type, offset, *retries, SEC_BLOCK_RETRY_MAX, ret);
+	return 0;
+}
+
+void modemctl_window_disable(fwloader_context *ctx) {
+	_i("ACK checksum mismatch with %u blocks in flight: the windowed ACK "
+		"checksum is only verified against modem-emu, sending one block "
+		"at a time until modem-ctl exits", ctx->sec_window);
+	ctx->sec_window = 1;
+}
+
+/*
+ * Sends the frames [first, last] of the bundle, like
+ * modemctl_sendfile_image() with the mapping as the fallback
+ */
+static int modemctl_bundle_send(fwloader_context *ctx, unsigned first,
+	unsigned last)
+{
+	boot_bundle *bundle = ctx->bundle;
+	off_t offset = BUNDLE_DATA_OFFSET + bundle->frames[first].offset;
+	size_t length = BUNDLE_DATA_OFFSET + bundle->frames[last].offset
+		+ bundle->frames[last].length - offset;
+	ssize_t ret;
+
+	if (!ctx->no_sendfile && !ctx->opts->no_sendfile) {
+		ret = send_file(ctx->boot_fd, bundle->fd, offset, length);
+		if (ret != -EINVAL && ret != -ENOSYS) {
+			return ret < 0 ? ret : 0;
+		}
+		_i("boot fd does not support sendfile, using write");
+		ctx->no_sendfile = true;
+	}
+
+	ret = write_all(ctx->boot_fd, bundle->map + offset, length);
+	return ret < 0 ? ret : 0;
+}
+
+int modemctl_play_bundle(fwloader_context *ctx, enum xmm6260_image type,
+	bundle_ack_fn ack, set_address_fn rewind)
+{
+	const bundle_frame *frames;
+	unsigned first, count, end, next, acked, retries = 0;
+	unsigned window = ctx->sec_window ? ctx->sec_window : 1;
+	int ret = 0;
+
+	if (!ctx->bundle || !(count = bundle_find(ctx->bundle, type, &first))) {
+		return -ENOENT;
+	}
+	frames = ctx->bundle->frames;
+	end = first + count;
+	next = acked = first;
+
+	_d("playing %u bundle frames of image %d", count, type);
+	while (acked < end) {
+		//a sync frame goes out alone, once everything before it is ACKed
+		unsigned last = next;
+		while (last < end && last - acked < window) {
+			if (frames[last].flags & BUNDLE_FRAME_SYNC) {
+				last += last == acked;
+				break;
+			}
+			last++;
+		}
+
+		if (last > next) {
+			if ((ret = modemctl_bundle_send(ctx, next, last - 1)) < 0) {
+				_e("failed to send bundle frames %u-%u", next, last - 1);
+				goto retry;
+			}
+			next = last;
+		}
+
+		ret = ack(ctx, frames[acked].ack_code);
+		if (ret == -EBADMSG && window > 1) {
+			_e("bad ACK for bundle frame %u, falling back to stop-and-wait",
+				acked);
+			modemctl_window_disable(ctx);
+			window = 1;
+			goto retry;
+		}
+		if (ret < 0 && ret != -EBADMSG) {
+			_e("failed to receive ACK of bundle frame %u", acked);
+			goto retry;
+		}
+		if (!(frames[acked].flags & BUNDLE_FRAME_SYNC)) {
+			timing_block(&ctx->timing);
+		}
+		acked++;
+		continue;
+
+retry:
+		//only the failed frame and those after it go again: a block gets a
+		//ReqFlashSetAddress of its own address first, a sync frame (the
+		//ReqFlashSetAddress of the image or ReqSecStart) that failed
+		//itself is simply sent again, the ACKed frames before it never are
+		do {
+			if ((ret = modemctl_block_retry(ctx, type,
+				frames[acked].addr - frames[first].addr, &retries, ret)) < 0)
+			{
+				return ret;
+			}
+
+			ret = frames[acked].flags & BUNDLE_FRAME_SYNC ? 0
+				: rewind(ctx, frames[acked].addr);
+		} while (ret < 0);
+		next = acked;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns which ctx->sec_chunk blocks of a part are erased. The table
+ * comes from the manifest when it has the part, otherwise every block
+ * is summed once and the sums are recorded for the upload to use.
+ */
+static const uint8_t *modemctl_erased_blocks(fwloader_context *ctx,
+	enum xmm6260_image type)
+{
+	const uint8_t *cached = manifest_erased_blocks(ctx->sums, type);
+	size_t length = ctx->parts[type].length;
+	unsigned i, count = (length + ctx->sec_chunk - 1) / ctx->sec_chunk;
+	uint8_t *scanned;
+
+	if (cached && ctx->sums->parts[type].block_size == ctx->sec_chunk) {
+		return cached;
+	}
+
+	//sized into the arena by modemctl_erased_table_size()
+	if (!(scanned = arena_claim(&ctx->arena, count))) {
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		size_t offset = (size_t)i * ctx->sec_chunk;
+		size_t size = length - offset < ctx->sec_chunk ? length - offset
+			: ctx->sec_chunk;
+		uint32_t sum = checksum_sum8(ctx->part_data[type] + offset, size);
+
+		scanned[i] = manifest_sum_erased(sum, size);
+		if (!ctx->csum_worker.running) {
+			manifest_record_block(ctx->sums, type, offset, size, sum);
+		}
+	}
+
+	return scanned;
+}
+
+size_t modemctl_erased_table_size(const struct xmm6260_offset *parts,
+	const uint32_t *chunks, unsigned count)
+{
+	uint32_t chunk = chunks[0];
+	size_t length = 0;
+	unsigned i;
+
+	for (i = 1; i < count; i++) {
+		chunk = chunks[i] < chunk ? chunks[i] : chunk;
+	}
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		length = parts[i].length > length ? parts[i].length : length;
+	}
+
+	//arena_claim() rounds every claim up to 8 bytes
+	return (length + chunk - 1) / chunk + 7;
+}
+
+static int modemctl_send_sparse(fwloader_context *ctx,
+	enum xmm6260_image type, send_blocks_fn send, set_address_fn set_address)
+{
+	size_t length = ctx->parts[type].length;
+	size_t chunk = ctx->sec_chunk;
+	unsigned i, j, count = (length + chunk - 1) / chunk;
+	size_t arena_pos = arena_mark(&ctx->arena);
+	const uint8_t *erased = modemctl_erased_blocks(ctx, type);
+	//the caller has already set the address of the first block
+	size_t next = 0;
+	int ret = 0;
+
+	if (!erased) {
+		_e("no room for the erased block table");
+		return send(ctx, type, 0, length, chunk);
+	}
+
+	for (i = 0; i < count; i = j) {
+		size_t from = i * chunk;
+
+		if (erased[i]) {
+			size_t skip = length - from < chunk ? length - from : chunk;
+			timing_skip(&ctx->timing, skip);
+			j = i + 1;
+			continue;
+		}
+
+		for (j = i; j < count && !erased[j]; j++) {
+		}
+		size_t to = (size_t)j * chunk < length ? (size_t)j * chunk : length;
+
+		if (from != next && (ret = set_address(ctx, ctx->sec_load_addr
+			+ from)) < 0)
+		{
+			_e("failed to set the address of block 0x%zx", from);
+			break;
+		}
+		if ((ret = send(ctx, type, from, to, chunk)) < 0) {
+			break;
+		}
+		next = to;
+	}
+
+	arena_release(&ctx->arena, arena_pos);
+	return ret;
+}
+
+int modemctl_send_secure_blocks(fwloader_context *ctx,
+	enum xmm6260_image type, send_blocks_fn send, set_address_fn set_address)
+{
+	chunk_tune *tune = &ctx->chunk_tune;
+	size_t length = ctx->parts[type].length;
+	unsigned i;
+	int ret;
+
+	if (type != FIRMWARE || ctx->opts->chunk_mode != CHUNK_MODE_CALIBRATE
+		|| tune->count < 2)
+	{
+		if (ctx->opts->sparse && (type == FIRMWARE || type == NVDATA)) {
+			return modemctl_send_sparse(ctx, type, send, set_address);
+		}
+		return send(ctx, type, 0, length, ctx->sec_chunk);
+	}
+
+	for (i = 0; i < tune->count; i++) {
+		size_t from = length * i / tune->count;
+		size_t to = length * (i + 1) / tune->count;
+		uint64_t start = timing_now_us();
+
+		if ((ret = send(ctx, type, from, to, tune->samples[i].size)) < 0) {
+			return ret;
+		}
+
+		chunk_tune_record(tune, i, to - from, timing_now_us() - start);
+	}
+
+	chunk_tune_save(tune);
+	return 0;
+}
+
+/*
+ * Sets up the real-time window of a step. The radio components are
+ * left alone in daemon mode, modemctl_lock_parts() keeps them locked
+ * for good and unlocking them afterwards would undo that.
+ */
+static void modemctl_realtime_enter(fwloader_context *ctx,
+	realtime_window *rt)
+{
+	const fwloader_options *opts = ctx->opts;
+	unsigned i;
+
+	if (!opts->rt_priority && !opts->rt_pin) {
+		memset(rt, 0, sizeof(*rt));
+		return;
+	}
+
+	realtime_enter(rt, opts->rt_priority, opts->rt_pin, opts->rt_cpu);
+
+	if (!opts->daemon) {
+		for (i = SECURE_IMAGE; i < XMM6260_IMAGE_MAX; i++) {
+			realtime_lock(rt, ctx->part_data[i], ctx->parts[i].length);
+		}
+	}
+	if (ctx->bundle) {
+		realtime_lock(rt, ctx->bundle->map, ctx->bundle->map_size);
+	}
+	realtime_lock(rt, ctx->arena.base, ctx->arena.size);
+	//the receive buffer and the window state
+	realtime_lock(rt, ctx, sizeof(*ctx));
+}
+
+int modemctl_run_steps(fwloader_context *ctx, const fwloader_step *steps,
+	unsigned count)
+{
+	int ret = 0;
+	unsigned i;
+	unsigned timeout_ms = ctx->opts->boot_timeout_ms ?
+		ctx->opts->boot_timeout_ms : BOOT_TIMEOUT_MS;
+	uint64_t deadline = timing_now_us() + (uint64_t)timeout_ms * 1000;
+	realtime_window rt;
+
+	io_set_deadline(deadline);
+	for (i = 0; i < count; i++) {
+		const fwloader_step *step = steps + i;
+
+		if (timing_now_us() >= deadline) {
+			_e("boot deadline of %u ms passed before %s", timeout_ms,
+				step->name);
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		timing_begin(&ctx->timing, step->phase);
+		if (step->realtime) {
+			modemctl_realtime_enter(ctx, &rt);
+		}
+		ret = step->run(ctx);
+		if (step->realtime) {
+			realtime_leave(&rt);
+		}
+		if (ret < 0) {
+			_e("%s failed: %s", step->name, strerror(-ret));
+			break;
+		}
+		timing_end(&ctx->timing, step->phase);
+		_d("%s done", step->name);
+	}
+	io_set_deadline(0);
+
+	return ret < 0 ? ret : 0;
+}
+
+static void modemctl_context_init(fwloader_context *ctx,
+	const fwloader_options *opts)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	//the fail path must not close what was never opened
+	ctx->radio_fd = -1;
+	ctx->boot_fd = -1;
+	ctx->link_fd = -1;
+	ctx->nvdata.fd = -1;
+	ctx->opts = opts;
+}
+
+static void modemctl_bundle_free(fwloader_context *ctx) {
+	if (ctx->bundle) {
+		bundle_close(ctx->bundle);
+		free(ctx->bundle);
+		ctx->bundle = NULL;
+	}
+}
+
+/*
+ * Sends the NVDATA file given with -d nvdata=<path> instead of the radio
+ * partition copy. The file is opened again before every later boot, as
+ * the modem keeps updating it while it runs. Whatever goes wrong, the
+ * boot falls back to the radio partition copy.
+ */
+static void modemctl_nvdata_load(fwloader_context *ctx) {
+	const char *path = modemctl_path(ctx, FWLOADER_PATH_NVDATA, NULL);
+	radio_window *map = ctx->radio_maps + NVDATA;
+	char *defaults = map->base + (ctx->parts[NVDATA].offset - map->offset);
+	uint8_t digest[MD5_DIGEST_SIZE];
+	bool reload = ctx->nvdata.map != NULL;
+
+	if (!path || !strcmp(path, NVDATA_DISABLED)) {
+		return;
+	}
+
+	//a private mapping does not follow the file, so map it afresh
+	if (reload) {
+		memcpy(digest, ctx->nvdata.digest, sizeof(digest));
+		nvdata_close(&ctx->nvdata);
+	}
+
+	nvdata_open(&ctx->nvdata, path, defaults, ctx->parts[NVDATA].length,
+		ctx->opts->nvdata_writeback);
+
+	if (reload && ctx->nvdata.map && ctx->opts->daemon) {
+		mlock(ctx->nvdata.map, ctx->nvdata.size);
+	}
+
+	if (reload && ctx->bundle
+		&& (!ctx->nvdata.map
+		|| memcmp(digest, ctx->nvdata.digest, sizeof(digest))))
+	{
+		_i("NVDATA changed, not using the bundle any more");
+		modemctl_bundle_free(ctx);
+	}
+
+	if (ctx->nvdata.map) {
+		ctx->part_data[NVDATA] = ctx->nvdata.map;
+		_d("sending NVDATA from %s", path);
+	}
+	else {
+		_i("sending the NVDATA of the radio partition");
+		ctx->part_data[NVDATA] = defaults;
+	}
+}
+
+/*
+ * Opens the bundle for the boot, a bundle built for another board or
+ * radio partition is ignored and the commands are framed as usual
+ */
+static void modemctl_bundle_load(fwloader_context *ctx,
+	const fwloader_board *board, const char *path)
+{
+	radio_fingerprint fp;
+	boot_bundle *bundle = calloc(1, sizeof(*bundle));
+
+	if (!bundle) {
+		_e("failed to allocate the bundle");
+		return;
+	}
+
+	if (bundle_open(bundle, path) < 0) {
+		free(bundle);
+		return;
+	}
+
+	modemctl_fingerprint(ctx, &fp);
+	if (strcmp(bundle->board, board->name) || memcmp(&fp, &bundle->fp,
+		sizeof(fp)))
+	{
+		_i("bundle %s does not match this %s radio partition, not using it",
+			path, board->title);
+		bundle_close(bundle);
+		free(bundle);
+		return;
+	}
+
+	_i("using bundle %s, %u frames of 0x%x byte blocks", path,
+		bundle->frame_count, bundle->block_size);
+	ctx->bundle = bundle;
+}
+
+static void modemctl_context_free(fwloader_context *ctx) {
+	unsigned i;
+
+	arena_free(&ctx->arena);
+
+	modemctl_bundle_free(ctx);
+	//the last boot already committed the tables
+	modemctl_checksums_free(ctx);
+	nvdata_close(&ctx->nvdata);
+
+	for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+		if (ctx->radio_maps[i].base) {
+			munmap(ctx->radio_maps[i].base, ctx->radio_maps[i].size);
+		}
+	}
+
+	if (ctx->link_fd >= 0) {
+		close(ctx->link_fd);
+	}
+
+	if (ctx->radio_fd >= 0) {
+		close(ctx->radio_fd);
+	}
+
+	if (ctx->boot_fd >= 0) {
+		close(ctx->boot_fd);
+	}
+}
+
+/*
+ * Runs one boot of the board, counting its heap allocations and, when
+ * a metrics report was asked for, its system calls
+ */
+static int modemctl_boot(const fwloader_board *board, fwloader_context *ctx) {
+	int ret;
+
+	heap_count_start();
+	if (!ctx->opts->metrics_path) {
+		ret = board->boot(ctx);
+	}
+	else {
+		io_stats_init(&ctx->io_stats, &ctx->timing);
+		io_set_stats(&ctx->io_stats);
+		ret = board->boot(ctx);
+		io_set_stats(NULL);
+	}
+	ctx->arena.heap_allocs = heap_count_stop();
+
+	return ret;
+}
+
+static void modemctl_report(fwloader_context *ctx, const char *label,
+	unsigned boot, int result)
+{
+	_d("boot fd: %u reads", ctx->boot_rx.reads);
+	timing_report(&ctx->timing, label);
+	arena_report(&ctx->arena);
+
+	if (ctx->opts->metrics_path) {
+		metrics_write(ctx->opts->metrics_path, label, boot, result,
+			&ctx->timing, &ctx->io_stats);
+	}
+}
+
+typedef struct {
+	const fwloader_board *board;
+	const fwloader_device *device;
+	fwloader_options opts;
+	fwloader_context ctx;
+	pthread_t thread;
+	bool started;
+	int ret;
+} modemctl_unit;
+
+static void *modemctl_unit_main(void *arg) {
+	modemctl_unit *unit = (modemctl_unit*)arg;
+
+	unit->ret = modemctl_boot(unit->board, &unit->ctx);
+	return NULL;
+}
+
+/*
+ * Boots every listed modem on its own thread. The shared context owns
+ * the radio mapping and the checksum tables, which are complete before
+ * the first thread starts so the boots only ever read them.
+ */
+static int modemctl_run_many(const fwloader_board *board,
+	fwloader_context *shared)
+{
+	const fwloader_options *opts = shared->opts;
+	modemctl_unit *units;
+	char label[64];
+	unsigned i, j, online = 0;
+	uint64_t start;
+	int ret = 0;
+
+	modemctl_checksums_load(shared, board->name, shared->sec_chunk);
+	if (shared->sums) {
+		checksum_worker_join(&shared->csum_worker, false);
+		for (i = 0; i < XMM6260_IMAGE_MAX; i++) {
+			if (!manifest_part_valid(shared->sums, i)) {
+				manifest_build_part(shared->sums, shared->part_data,
+					shared->parts, i);
+			}
+		}
+	}
+
+	units = calloc(opts->device_count, sizeof(*units));
+	if (!units) {
+		_e("failed to allocate %u modems", opts->device_count);
+		return -ENOMEM;
+	}
+
+	start = timing_now_us();
+	for (i = 0; i < opts->device_count; i++) {
+		modemctl_unit *unit = units + i;
+
+		unit->board = board;
+		unit->device = opts->devices + i;
+		unit->opts = *opts;
+		unit->opts.devices = NULL;
+		unit->opts.device_count = 0;
+		for (j = 0; j < FWLOADER_PATH_COUNT; j++) {
+			if (unit->device->paths[j]) {
+				unit->opts.paths[j] = unit->device->paths[j];
+			}
+		}
+
+		modemctl_context_init(&unit->ctx, &unit->opts);
+		if ((unit->ret = board->setup(&unit->ctx)) < 0) {
+			_e("%s: setup failed", unit->device->name);
+			continue;
+		}
+
+		unit->ctx.radio_fd = shared->radio_fd;
+		memcpy(unit->ctx.part_data, shared->part_data,
+			sizeof(unit->ctx.part_data));
+		unit->ctx.radio_size = shared->radio_size;
+		unit->ctx.radio_stat = shared->radio_stat;
+		unit->ctx.sums = shared->sums;
+		unit->ctx.sums_cached = shared->sums_cached;
+		unit->ctx.sec_chunk = shared->sec_chunk;
+		unit->ctx.bundle = shared->bundle;
+
+		if ((errno = pthread_create(&unit->thread, NULL,
+			modemctl_unit_main, unit)))
+		{
+			_e("%s: failed to start boot thread: %s", unit->device->name,
+				strerror(errno));
+			unit->ret = -errno;
+			continue;
+		}
+		unit->started = true;
+	}
+
+	for (i = 0; i < opts->device_count; i++) {
+		modemctl_unit *unit = units + i;
+
+		if (unit->started) {
+			pthread_join(unit->thread, NULL);
+		}
+
+		snprintf(label, sizeof(label), "%s %s", board->title,
+			unit->device->name);
+		modemctl_report(&unit->ctx, label, 0, unit->ret);
+
+		if (unit->ret < 0) {
+			_r("%s: failed: %s", unit->device->name, strerror(-unit->ret));
+			if (!ret) {
+				ret = unit->ret;
+			}
+		}
+		else {
+			_r("%s: online", unit->device->name);
+			online++;
+		}
+
+		//the radio mapping and the tables belong to the shared context
+		unit->ctx.radio_fd = -1;
+		unit->ctx.sums = NULL;
+		unit->ctx.bundle = NULL;
+		modemctl_context_free(&unit->ctx);
+	}
+
+	_r("%u of %u modems online in %llu ms", online, opts->device_count,
+		(unsigned long long)(timing_now_us() - start) / 1000);
+
+	free(units);
+	modemctl_checksums_commit(shared, online > 0);
+	return ret;
+}
+
+static int modemctl_dump_update(void *arg) {
+	fwloader_context *ctx = (fwloader_context*)arg;
+	return modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_DUMP_UPDATE, 0);
+}
+
+/*
+ * Has the driver start a CP ramdump on ctx->boot_fd and streams it to path
+ */
+static int modemctl_ramdump(fwloader_context *ctx, const char *path) {
+	ramdump_stats stats;
+	uint64_t busy_us;
+	int ret;
+
+	if ((ret = modemctl_ioctl(ctx, ctx->boot_fd, IOCTL_MODEM_DUMP_START,
+		0)) < 0)
+	{
+		_e("failed to start the ramdump");
+		return ret;
+	}
+
+	_i("dumping modem RAM to %s", path);
+	ret = ramdump_capture(ctx->boot_fd, path, ctx->opts->dump_compress,
+		modemctl_dump_update, ctx, &stats);
+	busy_us = stats.elapsed_us - stats.idle_us;
+
+	_r("ramdump: %llu bytes in %llu ms, %.1f MiB/s, %llu bytes written%s",
+		(unsigned long long)stats.bytes_read,
+		(unsigned long long)busy_us / 1000,
+		busy_us ? stats.bytes_read / (busy_us / 1e6) / (1 << 20) : 0.0,
+		(unsigned long long)stats.bytes_written,
+		stats.direct ? " with O_DIRECT" : "");
+	_r("ramdump: %u buffers, reader waited %llu ms for storage, "
+		"writer waited %llu ms for the link", stats.buffers,
+		(unsigned long long)stats.reader_wait_us / 1000,
+		(unsigned long long)stats.writer_wait_us / 1000);
+
+	if (ret < 0) {
+		_e("ramdump %s is incomplete", path);
+	}
+	return ret;
+}
+
+/*
+ * Captures a ramdump of a modem that is already waiting in upload mode
+ */
+static int modemctl_ramdump_device(fwloader_context *ctx, const char *path) {
+	const char *boot_path = modemctl_path(ctx, FWLOADER_PATH_BOOT, BOOT_DEV);
+
+	ctx->boot_fd = open(boot_path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (ctx->boot_fd < 0) {
+		_e("failed to open boot device %s: %s", boot_path, strerror(errno));
+		return -errno;
+	}
+
+	return modemctl_ramdump(ctx, path);
+}
+
+/*
+ * Dumps a modem that crashed into STATE_CRASH_EXIT in daemon mode, the
+ * dump is named after the board and the time of the crash
+ */
+static void modemctl_crash_dump(fwloader_context *ctx,
+	const fwloader_board *board)
+{
+	char path[PATH_MAX], stamp[32];
+	time_t now = time(NULL);
+
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+	snprintf(path, sizeof(path), "%s/xmm6260_%s_%s.dump%s",
+		ctx->opts->dump_dir, board->name, stamp,
+		ctx->opts->dump_compress ? ".lz4" : "");
+
+	modemctl_ramdump(ctx, path);
+}
+
+int modemctl_run(const fwloader_board *board, const fwloader_options *opts) {
+	unsigned boots;
+	int ret;
+	fwloader_context ctx;
+	modemctl_context_init(&ctx, opts);
+
+	if ((ret = board->setup(&ctx)) < 0) {
+		goto fail;
+	}
+
+	if (opts->dump_path) {
+		ret = modemctl_ramdump_device(&ctx, opts->dump_path);
+		goto fail;
+	}
+
+	if ((ret = modemctl_radio_open(&ctx, modemctl_path(&ctx,
+		FWLOADER_PATH_RADIO, board->radio_path))) < 0)
+	{
+		goto fail;
+	}
+
+	modemctl_chunk_setup(&ctx, board->name, board->chunks, board->chunk_count);
+	modemctl_nvdata_load(&ctx);
+
+	if (opts->pack_path) {
+		if (!board->pack) {
+			_e("%s does not support bundles", board->title);
+			ret = -EOPNOTSUPP;
+			goto fail;
+		}
+		ret = board->pack(&ctx, opts->pack_path);
+		goto fail;
+	}
+
+	if (opts->bundle_path) {
+		modemctl_bundle_load(&ctx, board, opts->bundle_path);
+	}
+
+	if (opts->device_count) {
+		ret = modemctl_run_many(board, &ctx);
+		goto fail;
+	}
+
+	if (opts->daemon) {
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = modemctl_stop;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+
+		modemctl_lock_parts(&ctx);
+	}
+
+	for (boots = 0; ; boots++) {
+		if (boots) {
+			modemctl_nvdata_load(&ctx);
+		}
+		modemctl_checksums_load(&ctx, board->name, ctx.sec_chunk);
+		ret = modemctl_boot(board, &ctx);
+		modemctl_checksums_commit(&ctx, ret == 0);
+		modemctl_report(&ctx, board->title, boots, ret);
+
+		if (!opts->daemon || modemctl_stopping) {
+			break;
+		}
+
+		if (ret < 0) {
+			_i("boot failed, retrying in %u ms", DAEMON_RETRY_DELAY_US / 1000);
+			usleep(DAEMON_RETRY_DELAY_US);
+			continue;
+		}
+
+		int state = modemctl_wait_modem_crash(&ctx);
+		if (modemctl_stopping) {
+			break;
+		}
+		_i("modem left the online state (%d), rebooting", state);
+
+		if (state == STATE_CRASH_EXIT && opts->dump_dir) {
+			modemctl_crash_dump(&ctx, board);
+		}
+	}
+
+	if (modemctl_stopping) {
+		_i("daemon stopped");
+		ret = 0;
+	}
+
+fail:
+	modemctl_context_free(&ctx);
+	return ret;
+}
+
+unsigned char calculateCRC(void* data, size_t offset, size_t length)
+{
+	return checksum_xor8((char*)data + offset, length);
 }
 
@@ -24,7 +24,21 @@
 
 #include "common.h"
 #include "log.h"
+
+#include <limits.h>
 #include "io_helpers.h" 
+#include "timing.h"
+#include "arena.h"
+#include "checksum.h"
+#include "manifest.h"
+#include "checksum_worker.h"
+#include "chunk_tune.h"
+#include "bundle.h"
+#include "nvdata.h"
+#include "ramdump.h"
+#include "metrics.h"
+#include "heap_count.h"
+#include "realtime.h"
 
 //Samsung IOCTLs
 #include "modem_prj.h"
@@ -36,30 +50,206 @@
 #define IPC_DEV MODEM_DEVICE(umts_ipc0)
 #define RFS_DEV MODEM_DEVICE(umts_rfs0)
 
+//upper bound of the polling backoff when no event wakes us up
 #define LINK_POLL_DELAY_US (50 * 1000)
+#define WAIT_BACKOFF_MIN_US 1000
 #define LINK_TIMEOUT_MS 2000
+//one deadline for the whole boot sequence, see modemctl_run_steps()
+#define BOOT_TIMEOUT_MS (20 * 1000)
+//daemon mode: status re-check period and delay before retrying a failed boot
+#define DAEMON_WATCH_TIMEOUT_MS (60 * 1000)
+#define DAEMON_RETRY_DELAY_US (1000 * 1000)
+
+//secure image blocks resent per image before the boot is given up, and
+//how long the link has to stay quiet before a resent block goes out
+#define SEC_BLOCK_RETRY_MAX 8
+#define SEC_RETRY_QUIET_MS 10
+
+//where the checksum manifest lives unless overridden with -m
+#define MANIFEST_DIR "/data/radio"
+#define MANIFEST_DISABLED "none"
+//NVDATA is only sent from a file given with -d nvdata=<path>, "none"
+//is the same as leaving it out
+#define NVDATA_DISABLED "none"
+
+/*
+ * How to wait for the modem to finish processing a secure image
+ * after the last ReqFlashWriteBlock has been sent
+ */
+enum sec_wait_mode {
+	SEC_WAIT_DEFAULT, //use the board default
+	SEC_WAIT_DELAY, //fixed SEC_DOWNLOAD_DELAY_US sleep
+	SEC_WAIT_ACK, //the ACK of the last block is the completion signal
+	SEC_WAIT_SELECT, //boot_fd drained, then the modem reply or the delay
+};
+
+//output queue polling period of SEC_WAIT_SELECT
+#define SEC_DRAIN_POLL_US 1000
+
+/*
+ * Device and file paths that can be overridden from the command line,
+ * e.g. to boot against the bootloader emulator
+ */
+enum fwloader_path {
+	FWLOADER_PATH_BOOT, //first boot device, ATAT and PSI
+	FWLOADER_PATH_BOOT1, //second boot device, I9250 only
+	FWLOADER_PATH_LINK, //link_pm control device
+	FWLOADER_PATH_RADIO, //radio partition
+	FWLOADER_PATH_MPS, //MPS data, I9250 only
+	FWLOADER_PATH_EHCI, //EHCI power control, I9100 only
+	FWLOADER_PATH_NVDATA, //NVDATA file on the EFS partition
+	FWLOADER_PATH_COUNT,
+};
+
+/*
+ * One modem of a multi-modem boot: its name in the reports and the
+ * paths which differ from the shared options
+ */
+typedef struct {
+	const char *name;
+	const char *paths[FWLOADER_PATH_COUNT];
+} fwloader_device;
 
-#define RADIO_MAP_SIZE (16 << 20)
+/*
+ * Runtime options passed from the command line
+ */
+typedef struct {
+	enum sec_wait_mode sec_wait;
+	const char *manifest_path;
+	bool checksum_worker;
+	enum chunk_mode chunk_mode;
+	unsigned sec_window;
+	const char *paths[FWLOADER_PATH_COUNT];
+	//answer the modem_if ioctls locally instead of calling the driver
+	bool emulate_ioctls;
+	//stay resident and reboot the modem whenever it crashes
+	bool daemon;
+	//send PSI and EBL with write() even where sendfile() works
+	bool no_sendfile;
+	//deadline of one boot sequence, BOOT_TIMEOUT_MS when zero
+	unsigned boot_timeout_ms;
+	//boot these modems concurrently instead of the one given by paths
+	const fwloader_device *devices;
+	unsigned device_count;
+	//send the secure image from this bundle, see modemctl_play_bundle()
+	const char *bundle_path;
+	//write a bundle to this path instead of booting
+	const char *pack_path;
+	//capture a ramdump to this path instead of booting
+	const char *dump_path;
+	//daemon mode: capture a ramdump into this directory after a CP crash
+	const char *dump_dir;
+	//LZ4 compress ramdumps
+	bool dump_compress;
+	//leave out erased FIRMWARE/NVDATA blocks, see modemctl_send_secure_blocks()
+	bool sparse;
+	//append a report of the system calls of every boot to this file
+	const char *metrics_path;
+	//SCHED_FIFO priority of the secure image upload, 0 to keep the policy
+	unsigned rt_priority;
+	//pin the secure image upload to rt_cpu
+	bool rt_pin;
+	unsigned rt_cpu;
+	//try a warm restart after a silent reset instead of a power cycle
+	bool warm_reset;
+	//let NVDATA repairs rewrite the file and its sidecars
+	bool nvdata_writeback;
+} fwloader_options;
+
+/*
+ * Page aligned mapping of one firmware component of the radio partition
+ */
+typedef struct {
+	char *base;
+	size_t size;
+	off_t offset;
+} radio_window;
 
 typedef struct {
+	const fwloader_options *opts;
+
 	int link_fd;
 	int boot_fd;
+	//buffered reader over boot_fd, reset whenever boot_fd is reopened
+	rx_buffer boot_rx;
 
 	int radio_fd;
-	char *radio_data;
+	//start of every component, inside radio_maps or borrowed from
+	//another context, NULL until the radio partition is mapped
+	char *part_data[XMM6260_IMAGE_MAX];
+	radio_window radio_maps[XMM6260_IMAGE_MAX];
 	struct stat radio_stat;
+	size_t radio_size;
+	const struct xmm6260_offset *parts;
+	//NVDATA file sent instead of the radio partition copy when mapped
+	nvdata_image nvdata;
+
+	//precomputed checksums, NULL when the manifest is disabled
+	image_checksums *sums;
+	char manifest_path[PATH_MAX];
+	bool sums_cached;
+	checksum_worker csum_worker;
+	//boot_fd turned out not to support sendfile()
+	bool no_sendfile;
+	//pre-framed secure image commands, NULL without a usable bundle
+	boot_bundle *bundle;
+
+	enum sec_wait_mode sec_wait;
+
+	//ReqFlashWriteBlock payload size and its calibration state
+	uint32_t sec_chunk;
+	chunk_tune chunk_tune;
+	//ReqFlashWriteBlock commands in flight and where the image goes
+	unsigned sec_window;
+	uint32_t sec_load_addr;
+
+	fwloader_arena arena;
+
+	//crash played by the bootloader emulator, see modemctl_ioctl()
+	bool emu_crashed;
+	//how long the last power cycle took, to report what warm restarts save
+	uint64_t cold_reset_us;
+
+	boot_timing timing;
+	//system calls of the last boot, counted with metrics_path set
+	io_stats io_stats;
 } fwloader_context;
 
 /*
- * Components of the Samsung XMM6260 firmware
- */
-enum xmm6260_image {
-	PSI,
-	EBL,
-	SECURE_IMAGE,
-	FIRMWARE,
-	NVDATA,
-};
+ * One state of the boot sequence. The states run in table order, each
+ * one timed as its boot phase and all of them against one deadline.
+ */
+typedef struct {
+	//PHASE_MAX for steps that time their own sub-phases
+	enum boot_phase phase;
+	const char *name;
+	int (*run)(fwloader_context *ctx);
+	//run with the rt_priority/rt_pin settings and the upload data locked
+	bool realtime;
+} fwloader_step;
+
+/*
+ * A board is booted in two steps so that the daemon can keep the context
+ * resident: setup() prepares the per-modem state which stays around
+ * across modem restarts, boot() runs one complete boot sequence and may
+ * be called again on the same context after the modem crashed. The
+ * radio mapping is set up by modemctl_run(), several modems can share it.
+ */
+typedef struct {
+	//used in the manifest and tuning file names
+	const char *name;
+	//used in the reports
+	const char *title;
+	//radio partition unless overridden with FWLOADER_PATH_RADIO
+	const char *radio_path;
+	//ReqFlashWriteBlock payload sizes, the first one is the default
+	const uint32_t *chunks;
+	unsigned chunk_count;
+	int (*setup)(fwloader_context *ctx);
+	int (*boot)(fwloader_context *ctx);
+	//writes the bundle played by modemctl_play_bundle(), may be NULL
+	int (*pack)(fwloader_context *ctx, const char *path);
+} fwloader_board;
 
 /*
  * Bootloader control interface definitions
@@ -101,7 +291,7 @@ int modemctl_link_set_active(fwloader_context *ctx, bool enabled);
 int modemctl_link_set_enabled(fwloader_context *ctx, bool enabled);
 
 /* 
- * @brief Poll the link until it gets ready or times out
+ * @brief Wait for the link to get ready or time out
  *
  * @param ctx [in] firmware loader context
  * @return Negative value indicating error code
@@ -110,7 +300,17 @@ int modemctl_link_set_enabled(fwloader_context *ctx, bool enabled);
 int modemctl_wait_link_ready(fwloader_context *ctx);
 
 /* 
- * @brief Poll the modem until it gets online or times out
+ * @brief Checks whether the modem is connected to the link
+ *
+ * @param ctx [in] firmware loader context
+ * @return -ENODEV without a link device, no ioctl is made then
+ * @return Negative value indicating error code
+ * @return 1 when connected, zero otherwise
+ */
+int modemctl_link_connected(fwloader_context *ctx);
+
+/* 
+ * @brief Wait for the modem to get online or time out
  *
  * @param ctx [in] firmware loader context
  * @return Negative value indicating error code
@@ -138,21 +338,352 @@ int modemctl_modem_power(fwloader_context *ctx, bool enabled);
  */
 int modemctl_modem_boot_power(fwloader_context *ctx, bool enabled);
 
+/* 
+ * @brief Pulses the modem reset line, the power stays on
+ *
+ * @param ctx [in] firmware loader context
+ * @return Negative value indicating error code
+ * @return ioctl call result
+ */
+int modemctl_modem_reset(fwloader_context *ctx);
+
+typedef int (*reset_fn)(fwloader_context *ctx);
+
+/* 
+ * @brief Resets the modem for a boot, without a power cycle if possible
+ *
+ * warm() is only tried with opts->warm_reset set, while the driver
+ * reports a silent reset (STATE_CRASH_RESET) with the link still
+ * connected. When warm() fails or is not possible, cold() power cycles
+ * the modem. Either path is reported, a warm restart with the time it
+ * saved over the last power cycle.
+ *
+ * @param ctx [in] firmware loader context
+ * @param warm [in] board restart that keeps the modem powered
+ * @param cold [in] board power cycle
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int modemctl_hard_reset(fwloader_context *ctx, reset_fn warm, reset_fn cold);
+
+/* 
+ * @brief Waits for the modem to complete a secure image download
+ *
+ * @param ctx [in] firmware loader context
+ * @param delay_us [in] fixed delay, also the deadline for SEC_WAIT_SELECT
+ * which only ends early when the modem replies after the output queue
+ * has drained
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int modemctl_wait_sec_download(fwloader_context *ctx, unsigned delay_us);
+
+/* 
+ * @brief Sets up a context for a board, boots it and, in daemon mode,
+ * keeps rebooting it whenever the modem crashes
+ *
+ * In daemon mode the radio parts are locked in memory and the checksum
+ * tables are kept between boots, only SIGINT/SIGTERM make it return.
+ * With opts->dump_dir a modem that crashed into STATE_CRASH_EXIT has
+ * its RAM dumped before it is rebooted, one that reset silently is
+ * restarted warm where possible, see modemctl_hard_reset(). With
+ * opts->dump_path only a
+ * ramdump is captured and the modem is not booted.
+ * With opts->devices every listed modem is booted on its own thread and
+ * context, all of them sharing one radio mapping and checksum tables.
+ *
+ * @param board [in] board to boot
+ * @param opts [in] runtime options
+ * @return Negative value indicating error code
+ * @return zero on success, with opts->devices only if all modems booted
+ */
+int modemctl_run(const fwloader_board *board, const fwloader_options *opts);
+
+/* 
+ * @brief Runs a boot sequence against one global deadline
+ *
+ * Every wait in the io helpers and the wait engine is clipped to the
+ * deadline, so a stuck boot fails after opts->boot_timeout_ms no matter
+ * in which step and which wait it is stuck.
+ *
+ * @param ctx [in] firmware loader context, boot_fd open
+ * @param steps [in] the boot states in order
+ * @param count [in] number of states
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int modemctl_run_steps(fwloader_context *ctx, const fwloader_step *steps,
+	unsigned count);
+
+/* 
+ * @brief Opens and maps the radio partition and starts its readahead
+ *
+ * @param ctx [in] firmware loader context, parts set
+ * @param path [in] radio partition or image path
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int modemctl_radio_open(fwloader_context *ctx, const char *path);
+
 /* 
  * @brief Boots the modem on the I9100 (Galaxy S2) board
  *
+ * @param opts [in] runtime options
  * @return Negative value indicating error code
  * @return zero on success
  */
-int boot_modem_i9100(void);
+int boot_modem_i9100(const fwloader_options *opts);
 
 /* 
  * @brief Boots the modem on the I9250 (Galaxy Nexus) board
  *
+ * @param opts [in] runtime options
  * @return Negative value indicating error code
  * @return zero on success
  */
-int boot_modem_i9250(void);
+int boot_modem_i9250(const fwloader_options *opts);
+
+/* 
+ * @brief Frames one ReqFlashWriteBlock and writes it to ctx->boot_fd
+ * without waiting for an ACK, the unit timed by modem-bench-micro
+ *
+ * @param ctx [in] context, only boot_fd and the arena are used
+ * @param data [in] block payload
+ * @param size [in] payload size, at most one SEC_DOWNLOAD_CHUNK
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int i9100_write_block(fwloader_context *ctx, void *data, size_t size);
+int i9250_write_block(fwloader_context *ctx, void *data, size_t size);
+
+/* 
+ * @brief Determines the size of the opened radio partition
+ *
+ * @param ctx [in] firmware loader context, radio_fd and radio_stat set
+ * @return Negative value indicating error code
+ * @return zero on success, ctx->radio_size is set
+ */
+int modemctl_radio_size(fwloader_context *ctx);
+
+/* 
+ * @brief Starts asynchronous readahead of all firmware components
+ *
+ * Issued right after the radio partition is mapped so eMMC reads
+ * overlap with the modem power cycle. PSI and EBL are queued first as
+ * they are needed first; FIRMWARE and NVDATA are additionally marked
+ * for sequential access.
+ *
+ * @param ctx [in] firmware loader context, radio mapping and parts set
+ */
+void modemctl_prefetch_parts(fwloader_context *ctx);
+
+/* 
+ * @brief Maps every firmware component on its own
+ *
+ * Only the page aligned windows of the components in ctx->parts are
+ * mapped, each of them has to lie within the radio partition.
+ *
+ * @param ctx [in] firmware loader context, radio_fd, radio_size and parts set
+ * @return Negative value indicating error code
+ * @return zero on success, ctx->part_data is set
+ */
+int modemctl_radio_map(fwloader_context *ctx);
+
+/* 
+ * @brief Computes the fingerprint of what the boot sends
+ *
+ * The radio partition fingerprint, with the digest of the NVDATA file
+ * folded in when that replaces the radio partition copy.
+ *
+ * @param ctx [in] firmware loader context, radio mapping and parts set
+ * @param fp [out] the fingerprint
+ */
+void modemctl_fingerprint(fwloader_context *ctx, radio_fingerprint *fp);
+
+/* 
+ * @brief Sets up the checksum tables and loads them from the manifest
+ *
+ * When the manifest is missing or stale the tables start out empty and
+ * get filled in by the upload, see modemctl_checksums_commit(), or by
+ * the background checksum worker if it is enabled. Tables kept from an
+ * earlier boot are reused as long as the radio fingerprint still matches.
+ *
+ * @param ctx [in] firmware loader context, radio mapping and parts set
+ * @param board [in] board name, part of the default manifest file name
+ * @param block_size [in] bootloader block size for FIRMWARE/NVDATA
+ */
+void modemctl_checksums_load(fwloader_context *ctx, const char *board,
+	uint32_t block_size);
+
+/* 
+ * @brief Frees the checksum tables, the last boot must be committed
+ *
+ * @param ctx [in] firmware loader context
+ */
+void modemctl_checksums_free(fwloader_context *ctx);
+
+/* 
+ * @brief Saves rebuilt checksums after a boot and keeps the tables
+ *
+ * After a failed boot the tables are dropped and the next boot rebuilds
+ * them. A manifest that was used for the failed boot is removed, so a
+ * stale entry cannot break the next boot as well.
+ *
+ * @param ctx [in] firmware loader context
+ * @param success [in] whether the boot succeeded
+ */
+void modemctl_checksums_commit(fwloader_context *ctx, bool success);
+
+/* 
+ * @brief Sends a raw (PSI/EBL) image with its CRC from the checksum cache
+ *
+ * With the CRC cached the image never has to be touched, it is then
+ * copied from radio_fd with sendfile() unless boot_fd does not support
+ * that. Otherwise it is written from the mapping while the CRC is
+ * computed.
+ *
+ * @param ctx [in] firmware loader context
+ * @param type [in] the image to send
+ * @param chunk_size [in] largest write to issue
+ * @param crc [out] XOR checksum of the image
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int modemctl_send_raw_image(fwloader_context *ctx, enum xmm6260_image type,
+	size_t chunk_size, unsigned char *crc);
+
+/* 
+ * @brief Returns the byte sum of a bootloader block
+ *
+ * Uses the checksum cache when it has the block and records the
+ * computed value otherwise.
+ *
+ * @param ctx [in] firmware loader context
+ * @param type [in] the image the block belongs to
+ * @param offset [in] offset of the block inside the image
+ * @param length [in] length of the block
+ * @return the byte sum of the block
+ */
+uint16_t modemctl_block_sum(fwloader_context *ctx, enum xmm6260_image type,
+	size_t offset, size_t length);
+
+/*
+ * Sends the [from, to) range of a secure image as ReqFlashWriteBlock
+ * commands of at most chunk bytes
+ */
+typedef int (*send_blocks_fn)(fwloader_context *ctx, enum xmm6260_image type,
+	size_t from, size_t to, uint32_t chunk);
+
+/*
+ * Sends ReqFlashSetAddress for addr and waits for its ACK
+ */
+typedef int (*set_address_fn)(fwloader_context *ctx, uint32_t addr);
+
+/* 
+ * @brief Returns the path of a device or file
+ *
+ * @param ctx [in] firmware loader context
+ * @param path [in] which path to look up
+ * @param fallback [in] the board default
+ * @return the command line override or fallback
+ */
+const char *modemctl_path(fwloader_context *ctx, enum fwloader_path path,
+	const char *fallback);
+
+/* 
+ * @brief Picks the ReqFlashWriteBlock size for this boot
+ *
+ * Sets ctx->sec_chunk from the tuned value in MANIFEST_DIR unless the
+ * fixed mode is selected or the tuning was done on another kernel.
+ *
+ * @param ctx [in] firmware loader context
+ * @param board [in] board name used for the tuning file
+ * @param sizes [in] block sizes the bootloader accepts, default first
+ * @param count [in] number of entries in sizes
+ */
+void modemctl_chunk_setup(fwloader_context *ctx, const char *board,
+	const uint32_t *sizes, unsigned count);
+
+/* 
+ * @brief Prepares resending a secure image block after a failure
+ *
+ * Drops whatever replies are still on their way so the next ACK belongs
+ * to the resent block and counts the retry in the boot timing. The
+ * caller then issues ReqFlashSetAddress for the block and carries on
+ * from there.
+ *
+ * @param ctx [in] firmware loader context
+ * @param type [in] the image being sent
+ * @param offset [in] offset of the block to resend inside the image
+ * @param retries [in,out] retries of this image so far
+ * @param error [in] the error that failed the block
+ * @return error when the block must not be retried
+ * @return zero when it may be resent
+ */
+int modemctl_block_retry(fwloader_context *ctx, enum xmm6260_image type,
+	size_t offset, unsigned *retries, int error);
+
+/* 
+ * @brief Goes back to one ReqFlashWriteBlock in flight after an ACK
+ * of a windowed block failed its checksum
+ *
+ * The ACK checksum of windowed blocks has only been checked against
+ * modem-emu, so a mismatch keeps windowing off for every later boot
+ * of this context as well.
+ *
+ * @param ctx [in] firmware loader context
+ */
+void modemctl_window_disable(fwloader_context *ctx);
+
+/* 
+ * @brief Returns the arena space the sparse upload needs for its
+ * erased block table, for the largest part and the smallest block size
+ *
+ * @param parts [in] the radio components of the board
+ * @param chunks [in] the ReqFlashWriteBlock payload sizes of the board
+ * @param count [in] number of entries in chunks
+ * @return size in bytes
+ */
+size_t modemctl_erased_table_size(const struct xmm6260_offset *parts,
+	const uint32_t *chunks, unsigned count);
+
+/* 
+ * @brief Sends the blocks of a secure image
+ *
+ * In calibration mode the FIRMWARE image is split into one segment
+ * per accepted block size, each segment is timed and the fastest size
+ * is stored for later boots. Otherwise the whole image is sent with
+ * ctx->sec_chunk. In sparse mode FIRMWARE and NVDATA blocks that are
+ * all 0x00 or all 0xFF are left out, every run of the other blocks
+ * starts with its own ReqFlashSetAddress.
+ *
+ * @param ctx [in] firmware loader context, sec_load_addr set
+ * @param type [in] the image to send
+ * @param send [in] board specific block sender
+ * @param set_address [in] board specific ReqFlashSetAddress
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int modemctl_send_secure_blocks(fwloader_context *ctx,
+	enum xmm6260_image type, send_blocks_fn send, set_address_fn set_address);
+
+/* 
+ * @brief Streams a raw image to the boot fd and computes its CRC on the way
+ *
+ * Each chunk is XORed into the CRC right before it is written, so the
+ * image is pulled from the radio partition once and the write copies
+ * it out of the cache.
+ *
+ * @param ctx [in] firmware loader context
+ * @param data [in] the image data
+ * @param length [in] length of the image in bytes
+ * @param chunk_size [in] largest write to issue
+ * @param crc [out] XOR checksum of the image, not computed if NULL
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int modemctl_stream_image(fwloader_context *ctx, char *data, size_t length,
+	size_t chunk_size, unsigned char *crc);
 
 /* 
  * @brief Calculate the checksum for the XMM6260 bootloader protocol
@@ -164,4 +695,28 @@ int boot_modem_i9250(void);
  */
 unsigned char calculateCRC(void* data, size_t offset, size_t length);
 
+/*
+ * Receives the ACK of a bundle frame, cmd_code is the command it has
+ * to carry. Returns -EBADMSG for an ACK that fails its checksum.
+ */
+typedef int (*bundle_ack_fn)(fwloader_context *ctx, unsigned cmd_code);
+
+/* 
+ * @brief Sends the pre-framed commands of an image from ctx->bundle
+ *
+ * Up to ctx->sec_window frames are in flight and go out with a single
+ * write; frames marked BUNDLE_FRAME_SYNC are sent on their own. A frame
+ * that fails or is not ACKed is resent like in modemctl_block_retry().
+ *
+ * @param ctx [in] firmware loader context
+ * @param type [in] the image to send
+ * @param ack [in] board specific ACK receiver
+ * @param rewind [in] board specific ReqFlashSetAddress
+ * @return Negative value indicating error code
+ * @return -ENOENT when there is no bundle or it does not carry the image
+ * @return zero on success
+ */
+int modemctl_play_bundle(fwloader_context *ctx, enum xmm6260_image type,
+	bundle_ack_fn ack, set_address_fn rewind);
+
 #endif //__MODEMCTL_COMMON_H__
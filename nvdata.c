@@ -0,0 +1,464 @@
+/*
+ * nvdata.c: NVDATA from the EFS partition, verified and repaired per block
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "nvdata.h"
+#include "log.h"
+
+#define NVDATA_BLOCKS_MAGIC 0x4b42564e //"NVBK"
+#define NVDATA_BLOCKS_VERSION 2
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t block_count;
+	uint64_t size;
+	//digests of the whole file the table was written for
+	uint8_t digest[MD5_DIGEST_SIZE];
+	uint8_t salted[MD5_DIGEST_SIZE];
+} __attribute__((packed)) nvdata_blocks_header_t;
+
+typedef uint8_t block_digest[MD5_DIGEST_SIZE];
+
+static unsigned nvdata_block_count(size_t size) {
+	return (size + NVDATA_BLOCK_SIZE - 1) / NVDATA_BLOCK_SIZE;
+}
+
+static size_t nvdata_block_length(size_t size, unsigned block) {
+	size_t offset = (size_t)block * NVDATA_BLOCK_SIZE;
+	return size - offset < NVDATA_BLOCK_SIZE ? size - offset : NVDATA_BLOCK_SIZE;
+}
+
+/*
+ * Hashes the data once for both the plain and the RIL style salted digest
+ */
+static void nvdata_digest(const char *data, size_t size,
+	uint8_t digest[MD5_DIGEST_SIZE], uint8_t salted[MD5_DIGEST_SIZE])
+{
+	md5_ctx md5, salt;
+
+	md5_init(&md5);
+	md5_update(&md5, data, size);
+	salt = md5;
+	md5_update(&salt, NVDATA_MD5_SECRET, strlen(NVDATA_MD5_SECRET));
+	md5_final(&md5, digest);
+	md5_final(&salt, salted);
+}
+
+/*
+ * Atomically replaces a sidecar file with the concatenation of two buffers
+ */
+static int nvdata_write_file(const char *path, const void *head,
+	size_t head_size, const void *body, size_t body_size)
+{
+	char tmp_path[PATH_MAX];
+	FILE *file;
+	bool ok;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if (!(file = fopen(tmp_path, "wb"))) {
+		_e("failed to create %s: %s", tmp_path, strerror(errno));
+		return -errno;
+	}
+
+	ok = fwrite(head, 1, head_size, file) == head_size;
+	ok = ok && (!body_size || fwrite(body, 1, body_size, file) == body_size);
+	ok = (fflush(file) == 0) && ok;
+	ok = (fsync(fileno(file)) == 0) && ok;
+	fclose(file);
+
+	if (!ok || rename(tmp_path, path) < 0) {
+		_e("failed to write %s: %s", path, strerror(errno));
+		unlink(tmp_path);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads the hex digest of a .md5 sidecar, anything after it is ignored
+ */
+static int nvdata_read_md5(const char *path, char hex[MD5_HEX_SIZE + 1]) {
+	ssize_t size;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return -errno;
+	}
+	size = read(fd, hex, MD5_HEX_SIZE);
+	close(fd);
+
+	if (size != MD5_HEX_SIZE) {
+		return -EINVAL;
+	}
+	hex[MD5_HEX_SIZE] = '\0';
+
+	return 0;
+}
+
+/*
+ * Loads the block table, *blocks is only allocated when asked for
+ */
+static int nvdata_read_blocks(nvdata_image *nv, nvdata_blocks_header_t *hdr,
+	block_digest **blocks)
+{
+	char path[PATH_MAX];
+	unsigned count = nvdata_block_count(nv->size);
+	size_t size = count * sizeof(block_digest);
+	int fd, ret = -EINVAL;
+
+	snprintf(path, sizeof(path), "%s" NVDATA_BLOCKS_SUFFIX, nv->path);
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return -errno;
+	}
+
+	if (read(fd, hdr, sizeof(*hdr)) != sizeof(*hdr)
+		|| hdr->magic != NVDATA_BLOCKS_MAGIC
+		|| hdr->version != NVDATA_BLOCKS_VERSION
+		|| hdr->block_size != NVDATA_BLOCK_SIZE
+		|| hdr->block_count != count || hdr->size != nv->size)
+	{
+		_d("ignoring block table %s", path);
+		goto fail;
+	}
+
+	if (blocks) {
+		if (!(*blocks = malloc(size))) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		if (read(fd, *blocks, size) != (ssize_t)size) {
+			_d("block table %s is truncated", path);
+			free(*blocks);
+			*blocks = NULL;
+			goto fail;
+		}
+	}
+	ret = 0;
+
+fail:
+	close(fd);
+	return ret;
+}
+
+/*
+ * Writes the block table and the .md5 sidecar for the current contents,
+ * the digests have to be up to date. Does nothing without writeback.
+ */
+static int nvdata_write_sidecars(nvdata_image *nv, bool md5_only) {
+	char path[PATH_MAX], hex[MD5_HEX_SIZE + 1];
+	unsigned i, count = nvdata_block_count(nv->size);
+	block_digest *blocks;
+	int ret;
+
+	if (!nv->writeback) {
+		return 0;
+	}
+
+	if (!md5_only) {
+		nvdata_blocks_header_t hdr = {
+			.magic = NVDATA_BLOCKS_MAGIC,
+			.version = NVDATA_BLOCKS_VERSION,
+			.block_size = NVDATA_BLOCK_SIZE,
+			.block_count = count,
+			.size = nv->size,
+		};
+		memcpy(hdr.digest, nv->digest, sizeof(hdr.digest));
+		memcpy(hdr.salted, nv->salted, sizeof(hdr.salted));
+
+		if (!(blocks = malloc(count * sizeof(*blocks)))) {
+			return -ENOMEM;
+		}
+		for (i = 0; i < count; i++) {
+			md5_digest(nv->map + (size_t)i * NVDATA_BLOCK_SIZE,
+				nvdata_block_length(nv->size, i), blocks[i]);
+		}
+
+		snprintf(path, sizeof(path), "%s" NVDATA_BLOCKS_SUFFIX, nv->path);
+		ret = nvdata_write_file(path, &hdr, sizeof(hdr), blocks,
+			count * sizeof(*blocks));
+		free(blocks);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	md5_hex(nv->salted, hex);
+	snprintf(path, sizeof(path), "%s" NVDATA_MD5_SUFFIX, nv->path);
+	return nvdata_write_file(path, hex, MD5_HEX_SIZE, NULL, 0);
+}
+
+/*
+ * Maps the backup next to the NVDATA file if it matches its own .md5
+ */
+static char *nvdata_map_backup(nvdata_image *nv) {
+	char path[PATH_MAX], want[MD5_HEX_SIZE + 1], have[MD5_HEX_SIZE + 1];
+	uint8_t digest[MD5_DIGEST_SIZE], salted[MD5_DIGEST_SIZE];
+	const char *slash = strrchr(nv->path, '/');
+	struct stat st;
+	char *map;
+	int fd;
+
+	snprintf(path, sizeof(path), "%.*s" NVDATA_BACKUP_NAME,
+		slash ? (int)(slash - nv->path + 1) : 0, nv->path);
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		_d("no NVDATA backup %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size != nv->size) {
+		_i("NVDATA backup %s has the wrong size, not using it", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(0, nv->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		_e("failed to mmap NVDATA backup %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	nvdata_digest(map, nv->size, digest, salted);
+	md5_hex(salted, have);
+	strncat(path, NVDATA_MD5_SUFFIX, sizeof(path) - strlen(path) - 1);
+	if (nvdata_read_md5(path, want) < 0 || strcasecmp(want, have)) {
+		_i("NVDATA backup does not match %s, not using it", path);
+		munmap(map, nv->size);
+		return NULL;
+	}
+
+	return map;
+}
+
+/*
+ * Takes the repaired contents: with writeback they go to the file and
+ * the sidecars, otherwise they only live in the private copy
+ */
+static int nvdata_commit(nvdata_image *nv) {
+	nvdata_digest(nv->map, nv->size, nv->digest, nv->salted);
+
+	if (!nv->writeback) {
+		_i("NVDATA %s repaired for this boot only, the file is unchanged",
+			nv->path);
+		return 0;
+	}
+
+	if (msync(nv->map, nv->size, MS_SYNC) < 0) {
+		_e("failed to write back NVDATA %s: %s", nv->path, strerror(errno));
+		return -errno;
+	}
+
+	return nvdata_write_sidecars(nv, false);
+}
+
+/*
+ * Restores the blocks which do not match the block table from the
+ * backup or else from the defaults
+ */
+static int nvdata_restore(nvdata_image *nv, const block_digest *blocks) {
+	unsigned i, count = nvdata_block_count(nv->size);
+	char *backup = nvdata_map_backup(nv);
+
+	for (i = 0; i < count; i++) {
+		size_t offset = (size_t)i * NVDATA_BLOCK_SIZE;
+		size_t length = nvdata_block_length(nv->size, i);
+		uint8_t digest[MD5_DIGEST_SIZE];
+
+		md5_digest(nv->map + offset, length, digest);
+		if (!memcmp(digest, blocks[i], sizeof(digest))) {
+			continue;
+		}
+
+		//only a backup block the table vouches for is any good
+		if (backup) {
+			md5_digest(backup + offset, length, digest);
+		}
+		if (backup && !memcmp(digest, blocks[i], sizeof(digest))) {
+			memcpy(nv->map + offset, backup + offset, length);
+			nv->restored++;
+		}
+		else {
+			memcpy(nv->map + offset, nv->defaults + offset, length);
+			nv->regenerated++;
+		}
+	}
+
+	if (backup) {
+		munmap(backup, nv->size);
+	}
+
+	_i("repaired NVDATA %s: %u blocks from the backup, %u from the defaults",
+		nv->path, nv->restored, nv->regenerated);
+
+	return nvdata_commit(nv);
+}
+
+/*
+ * Replaces the whole file with the backup, as the RIL does when the
+ * .md5 does not match. Without a good backup the file is left alone.
+ */
+static int nvdata_restore_backup(nvdata_image *nv) {
+	char *backup = nvdata_map_backup(nv);
+
+	if (!backup) {
+		_i("NVDATA %s does not match its .md5 and there is no good backup, "
+			"sending it as it is", nv->path);
+		return 0;
+	}
+
+	memcpy(nv->map, backup, nv->size);
+	munmap(backup, nv->size);
+	nv->restored = nvdata_block_count(nv->size);
+	_i("NVDATA %s does not match its .md5, restored it from the backup",
+		nv->path);
+
+	return nvdata_commit(nv);
+}
+
+int nvdata_check(nvdata_image *nv) {
+	char path[PATH_MAX], want[MD5_HEX_SIZE + 1], have[MD5_HEX_SIZE + 1];
+	char table[MD5_HEX_SIZE + 1];
+	nvdata_blocks_header_t hdr;
+	block_digest *blocks = NULL;
+	bool have_md5, have_blocks;
+	int ret;
+
+	nv->restored = nv->regenerated = 0;
+	nvdata_digest(nv->map, nv->size, nv->digest, nv->salted);
+	md5_hex(nv->salted, have);
+
+	snprintf(path, sizeof(path), "%s" NVDATA_MD5_SUFFIX, nv->path);
+	have_md5 = nvdata_read_md5(path, want) == 0;
+
+	if (have_md5 && !strcasecmp(want, have)) {
+		//keep the table in step with updates that only rewrote the .md5
+		if (nv->writeback && (nvdata_read_blocks(nv, &hdr, NULL) < 0
+			|| memcmp(hdr.digest, nv->digest, sizeof(hdr.digest))))
+		{
+			_d("updating the block table of %s", nv->path);
+			nvdata_write_sidecars(nv, false);
+		}
+		_d("NVDATA %s verified", nv->path);
+		return 0;
+	}
+
+	have_blocks = nvdata_read_blocks(nv, &hdr, &blocks) == 0;
+	if (have_blocks) {
+		md5_hex(hdr.salted, table);
+	}
+
+	if (have_blocks && !memcmp(hdr.digest, nv->digest, sizeof(hdr.digest))) {
+		_i("NVDATA %s matches its block table but not its .md5", nv->path);
+		ret = nvdata_write_sidecars(nv, true);
+	}
+	else if (!have_md5 && !have_blocks) {
+		//nothing to check against, take the file as it is like the RIL does
+		_i("NVDATA %s has no checksum, sending it as it is", nv->path);
+		ret = nvdata_write_sidecars(nv, false);
+	}
+	else if (have_blocks && (!have_md5 || !strcasecmp(want, table))) {
+		_i("NVDATA %s is damaged, repairing it", nv->path);
+		ret = nvdata_restore(nv, blocks);
+	}
+	else {
+		ret = nvdata_restore_backup(nv);
+	}
+
+	free(blocks);
+	return ret;
+}
+
+int nvdata_open(nvdata_image *nv, const char *path, const char *defaults,
+	size_t size, bool writeback)
+{
+	struct stat st;
+	int ret;
+
+	memset(nv, 0, sizeof(*nv));
+	nv->fd = -1;
+	if (strlen(path) >= sizeof(nv->path)) {
+		_e("NVDATA path %s is too long", path);
+		return -ENAMETOOLONG;
+	}
+	strcpy(nv->path, path);
+	nv->defaults = defaults;
+	nv->size = size;
+	nv->writeback = writeback;
+
+	//never created: a missing file is for the RIL to set up
+	if ((nv->fd = open(path, writeback ? O_RDWR : O_RDONLY)) < 0) {
+		ret = -errno;
+		_i("failed to open NVDATA %s: %s", path, strerror(errno));
+		return ret;
+	}
+
+	if (fstat(nv->fd, &st) < 0) {
+		ret = -errno;
+		_e("failed to stat NVDATA %s: %s", path, strerror(errno));
+		goto fail;
+	}
+
+	if ((size_t)st.st_size != size) {
+		_i("NVDATA %s is %lld bytes instead of %zu, not using it", path,
+			(long long)st.st_size, size);
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	//without writeback repairs only touch a copy-on-write private mapping
+	nv->map = mmap(0, size, PROT_READ | PROT_WRITE,
+		writeback ? MAP_SHARED : MAP_PRIVATE, nv->fd, 0);
+	if (nv->map == MAP_FAILED) {
+		ret = -errno;
+		nv->map = NULL;
+		_e("failed to mmap NVDATA %s: %s", path, strerror(errno));
+		goto fail;
+	}
+
+	if ((ret = nvdata_check(nv)) < 0) {
+		goto fail;
+	}
+
+	_d("NVDATA %s mapped, 0x%zx bytes", path, size);
+	return 0;
+
+fail:
+	nvdata_close(nv);
+	return ret;
+}
+
+void nvdata_close(nvdata_image *nv) {
+	if (nv->map) {
+		munmap(nv->map, nv->size);
+		nv->map = NULL;
+	}
+
+	if (nv->fd >= 0) {
+		close(nv->fd);
+	}
+	nv->fd = -1;
+}
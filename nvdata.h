@@ -0,0 +1,113 @@
+/*
+ * nvdata.h: NVDATA from the EFS partition, verified and repaired per block
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __NVDATA_H__
+#define __NVDATA_H__
+
+#include "common.h"
+#include "md5.h"
+
+#include <limits.h>
+
+/*
+ * The modem keeps its calibration, IMEI and settings in a 2 MiB NVDATA
+ * file on the EFS partition. Next to it the Samsung RIL keeps a .md5
+ * sidecar and a backup copy with its own .md5, both holding the hex MD5
+ * of the data followed by NVDATA_MD5_SECRET. The block table written
+ * here holds the plain digest of every NVDATA_BLOCK_SIZE block so that
+ * a damaged file can be repaired one block at a time.
+ *
+ * The file is never created or resized. Unless writeback is asked for
+ * it is only read, repairs go into a private copy which is sent to the
+ * modem, and nothing is written next to it.
+ */
+#define NVDATA_MD5_SUFFIX ".md5"
+#define NVDATA_BLOCKS_SUFFIX ".blocks"
+#define NVDATA_BACKUP_NAME ".nv_data.bak"
+#define NVDATA_MD5_SECRET "Samsung_Android_RIL"
+#define NVDATA_BLOCK_SIZE (64 << 10)
+
+typedef struct {
+	int fd;
+	//sent to the modem as is, a private copy unless writeback is set
+	char *map;
+	size_t size;
+	//write repairs back to the file and keep the sidecars up to date
+	bool writeback;
+	//what damaged blocks fall back to when the backup does not have them
+	const char *defaults;
+	//plain digest of the data, and salted as in the .md5 sidecars
+	uint8_t digest[MD5_DIGEST_SIZE];
+	uint8_t salted[MD5_DIGEST_SIZE];
+	//blocks restored from the backup and from the defaults by the last check
+	unsigned restored;
+	unsigned regenerated;
+	//leaves room for the sidecar suffixes
+	char path[PATH_MAX - 32];
+} nvdata_image;
+
+/*
+ * @brief Maps the NVDATA file and checks it
+ *
+ * A missing file or one of the wrong size is not used. See
+ * nvdata_check() for the verification.
+ *
+ * @param nv [out] the NVDATA image
+ * @param path [in] path of the NVDATA file
+ * @param defaults [in] factory NVDATA, e.g. from the radio partition
+ * @param size [in] size of the NVDATA component
+ * @param writeback [in] whether repairs may be written to the file
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int nvdata_open(nvdata_image *nv, const char *path, const char *defaults,
+	size_t size, bool writeback);
+
+/*
+ * @brief Verifies the NVDATA against its sidecars and repairs it
+ *
+ * The whole file is hashed once and its salted digest compared with
+ * the .md5 sidecar. When both the sidecar and the block table describe
+ * the same older contents, every block whose digest differs from the
+ * table is restored from the backup, or from the defaults when the
+ * backup does not have a good copy either. A file that only fails its
+ * .md5 is replaced with a backup that passes its own, or else sent as
+ * it is for the RIL to deal with; the defaults never replace it whole.
+ * With writeback the result is written to the file and the sidecars.
+ *
+ * @param nv [in,out] the NVDATA image, the digests are updated
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int nvdata_check(nvdata_image *nv);
+
+/*
+ * @brief Unmaps and closes the NVDATA file
+ *
+ * @param nv [in] the NVDATA image, may be unopened
+ */
+void nvdata_close(nvdata_image *nv);
+
+#endif //__NVDATA_H__
@@ -0,0 +1,354 @@
+/*
+ * ramdump.c: streams a modem RAM dump from the boot device to storage
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ramdump.h"
+#include "lz4.h"
+#include "timing.h"
+#include "log.h"
+
+#include <poll.h>
+#include <pthread.h>
+
+//room for a compressed buffer behind the unaligned rest of the previous one
+#define RAMDUMP_STAGE_SIZE ((RAMDUMP_ALIGN + LZ4_FRAME_HEADER_SIZE \
+	+ LZ4_FRAME_BLOCK_BOUND(RAMDUMP_BUFFER_SIZE) + LZ4_FRAME_END_SIZE \
+	+ RAMDUMP_ALIGN - 1) & ~(RAMDUMP_ALIGN - 1))
+
+typedef struct {
+	char *data;
+	size_t length;
+	//owned by the writer until it is emptied again
+	bool full;
+	bool last;
+} ramdump_buffer;
+
+typedef struct {
+	int fd;
+	bool direct;
+	bool compress;
+	//output not written yet because it does not fill an aligned unit
+	char *stage;
+	size_t staged;
+	uint32_t *table;
+	ramdump_buffer buffers[RAMDUMP_BUFFERS];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	//first error of the writer, which stops the capture
+	int error;
+	ramdump_stats *stats;
+} ramdump_pipe;
+
+static void ramdump_no_direct(ramdump_pipe *pipe) {
+	fcntl(pipe->fd, F_SETFL, fcntl(pipe->fd, F_GETFL) & ~O_DIRECT);
+	pipe->direct = false;
+}
+
+static int ramdump_write(ramdump_pipe *pipe, const char *data, size_t size) {
+	while (size) {
+		ssize_t ret = write(pipe->fd, data, size);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			//some filesystems accept O_DIRECT at open time only
+			if (errno == EINVAL && pipe->direct) {
+				_d("O_DIRECT write refused, writing through the page cache");
+				ramdump_no_direct(pipe);
+				continue;
+			}
+			_e("failed to write the ramdump: %s", strerror(errno));
+			return -errno;
+		}
+
+		data += ret;
+		size -= ret;
+		pipe->stats->bytes_written += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes the staged output in whole RAMDUMP_ALIGN units and keeps the
+ * rest for the next buffer, everything when this is the last one
+ */
+static int ramdump_flush(ramdump_pipe *pipe, bool last) {
+	size_t size = pipe->staged;
+	int ret;
+
+	if (!last) {
+		size &= ~(size_t)(RAMDUMP_ALIGN - 1);
+	}
+	else if (pipe->direct && size % RAMDUMP_ALIGN) {
+		pipe->stats->direct = true;
+		ramdump_no_direct(pipe);
+	}
+
+	if ((ret = ramdump_write(pipe, pipe->stage, size)) < 0) {
+		return ret;
+	}
+
+	memmove(pipe->stage, pipe->stage + size, pipe->staged - size);
+	pipe->staged -= size;
+	return 0;
+}
+
+static int ramdump_store(ramdump_pipe *pipe, ramdump_buffer *buf) {
+	char *out = pipe->stage + pipe->staged;
+	int ret;
+
+	if (pipe->compress) {
+		if (buf->length) {
+			pipe->staged += lz4_frame_block(pipe->table, buf->data,
+				buf->length, out);
+		}
+		if (buf->last) {
+			pipe->staged += lz4_frame_end(pipe->stage + pipe->staged);
+		}
+	}
+	//whole buffers go out as they are, straight from where they were read
+	else if (!pipe->staged && !(buf->length % RAMDUMP_ALIGN)) {
+		if ((ret = ramdump_write(pipe, buf->data, buf->length)) < 0) {
+			return ret;
+		}
+	}
+	else {
+		memcpy(out, buf->data, buf->length);
+		pipe->staged += buf->length;
+	}
+
+	return ramdump_flush(pipe, buf->last);
+}
+
+static void *ramdump_writer_main(void *arg) {
+	ramdump_pipe *pipe = (ramdump_pipe*)arg;
+	unsigned next = 0;
+	bool last = false;
+
+	while (!last) {
+		ramdump_buffer *buf = pipe->buffers + next;
+		uint64_t start = timing_now_us();
+		int ret;
+
+		pthread_mutex_lock(&pipe->lock);
+		while (!buf->full) {
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+		}
+		pthread_mutex_unlock(&pipe->lock);
+		pipe->stats->writer_wait_us += timing_now_us() - start;
+
+		last = buf->last;
+		ret = ramdump_store(pipe, buf);
+
+		pthread_mutex_lock(&pipe->lock);
+		buf->full = false;
+		if (ret < 0) {
+			pipe->error = ret;
+			last = true;
+		}
+		pthread_cond_broadcast(&pipe->cond);
+		pthread_mutex_unlock(&pipe->lock);
+
+		next = (next + 1) % RAMDUMP_BUFFERS;
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads until the buffer is full or the dump has ended
+ */
+static int ramdump_fill(int fd, ramdump_buffer *buf, ramdump_update_fn update,
+	void *arg, ramdump_stats *stats, bool *done)
+{
+	unsigned quiet_ms = 0;
+
+	buf->length = 0;
+	while (buf->length < RAMDUMP_BUFFER_SIZE) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN, };
+		ssize_t ret;
+		int ready = poll(&pfd, 1, RAMDUMP_POLL_MS);
+
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			_e("failed to poll the dump device: %s", strerror(errno));
+			return -errno;
+		}
+
+		if (!ready) {
+			if ((quiet_ms += RAMDUMP_POLL_MS) >= RAMDUMP_IDLE_MS) {
+				_d("no dump data for %u ms, done", quiet_ms);
+				stats->idle_us = quiet_ms * 1000ULL;
+				*done = true;
+				return 0;
+			}
+			if (update && update(arg) < 0) {
+				_d("dump update failed");
+			}
+			continue;
+		}
+
+		ret = read(fd, buf->data + buf->length,
+			RAMDUMP_BUFFER_SIZE - buf->length);
+		if (ret > 0) {
+			buf->length += ret;
+			quiet_ms = 0;
+		}
+		//a hung up tty reads EIO once it is drained
+		else if (!ret || (pfd.revents & POLLHUP)) {
+			_d("dump device closed");
+			*done = true;
+			return 0;
+		}
+		else if (errno != EAGAIN && errno != EINTR) {
+			_e("failed to read the dump: %s", strerror(errno));
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+int ramdump_capture(int fd, const char *path, bool compress,
+	ramdump_update_fn update, void *arg, ramdump_stats *stats)
+{
+	ramdump_pipe pipe;
+	pthread_t writer;
+	uint64_t start = timing_now_us();
+	unsigned i, next;
+	bool done = false;
+	int ret = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	memset(&pipe, 0, sizeof(pipe));
+	pipe.compress = compress;
+	pipe.stats = stats;
+	pthread_mutex_init(&pipe.lock, NULL);
+	pthread_cond_init(&pipe.cond, NULL);
+
+	pipe.direct = true;
+	pipe.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0600);
+	if (pipe.fd < 0 && errno == EINVAL) {
+		pipe.direct = false;
+		pipe.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	}
+	if (pipe.fd < 0) {
+		_e("failed to create ramdump %s: %s", path, strerror(errno));
+		ret = -errno;
+		goto fail;
+	}
+
+	for (i = 0; i < RAMDUMP_BUFFERS; i++) {
+		if (posix_memalign((void**)&pipe.buffers[i].data, RAMDUMP_ALIGN,
+			RAMDUMP_BUFFER_SIZE))
+		{
+			pipe.buffers[i].data = NULL;
+			ret = -ENOMEM;
+		}
+	}
+	if (posix_memalign((void**)&pipe.stage, RAMDUMP_ALIGN, RAMDUMP_STAGE_SIZE)) {
+		pipe.stage = NULL;
+		ret = -ENOMEM;
+	}
+	if (compress && !(pipe.table = calloc(1, LZ4_TABLE_SIZE))) {
+		ret = -ENOMEM;
+	}
+	if (ret < 0) {
+		_e("failed to allocate the ramdump buffers");
+		goto fail;
+	}
+
+	if (compress) {
+		pipe.staged = lz4_frame_header(pipe.stage);
+	}
+
+	if ((ret = pthread_create(&writer, NULL, ramdump_writer_main, &pipe))) {
+		_e("failed to start the ramdump writer: %s", strerror(ret));
+		ret = -ret;
+		goto fail;
+	}
+
+	for (next = 0; !done; next = (next + 1) % RAMDUMP_BUFFERS) {
+		ramdump_buffer *buf = pipe.buffers + next;
+		uint64_t wait_start = timing_now_us();
+		int error;
+
+		pthread_mutex_lock(&pipe.lock);
+		while (buf->full && !pipe.error) {
+			pthread_cond_wait(&pipe.cond, &pipe.lock);
+		}
+		error = pipe.error;
+		pthread_mutex_unlock(&pipe.lock);
+		stats->reader_wait_us += timing_now_us() - wait_start;
+
+		//the writer has already left
+		if (error) {
+			break;
+		}
+
+		//a failed read still hands over what it got, as the last buffer
+		ret = ramdump_fill(fd, buf, update, arg, stats, &done);
+		done = done || ret < 0;
+		stats->bytes_read += buf->length;
+		stats->buffers++;
+
+		pthread_mutex_lock(&pipe.lock);
+		buf->last = done;
+		buf->full = true;
+		pthread_cond_broadcast(&pipe.cond);
+		pthread_mutex_unlock(&pipe.lock);
+	}
+
+	pthread_join(writer, NULL);
+	if (!stats->direct) {
+		stats->direct = pipe.direct;
+	}
+
+	if (!ret) {
+		ret = pipe.error;
+	}
+	if (fsync(pipe.fd) < 0 && !ret) {
+		_e("failed to sync ramdump %s: %s", path, strerror(errno));
+		ret = -errno;
+	}
+
+fail:
+	stats->elapsed_us = timing_now_us() - start;
+
+	if (pipe.fd >= 0) {
+		close(pipe.fd);
+	}
+	for (i = 0; i < RAMDUMP_BUFFERS; i++) {
+		free(pipe.buffers[i].data);
+	}
+	free(pipe.stage);
+	free(pipe.table);
+	pthread_mutex_destroy(&pipe.lock);
+	pthread_cond_destroy(&pipe.cond);
+
+	return ret;
+}
@@ -0,0 +1,83 @@
+/*
+ * ramdump.h: streams a modem RAM dump from the boot device to storage
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RAMDUMP_H__
+#define __RAMDUMP_H__
+
+#include "common.h"
+
+/*
+ * The dump is read into one buffer while the other one is compressed
+ * and written on a second thread, so the link never waits for storage
+ * as long as storage keeps up on average. Only the two buffers and the
+ * write staging area are ever held in memory.
+ */
+#define RAMDUMP_BUFFERS 2
+#define RAMDUMP_BUFFER_SIZE (1 << 20)
+//alignment of every write but the last one, O_DIRECT is used where it works
+#define RAMDUMP_ALIGN 4096
+//the dump is complete once the link stays quiet this long
+#define RAMDUMP_IDLE_MS 2000
+//how often the driver is asked for more data while the link is quiet
+#define RAMDUMP_POLL_MS 100
+
+typedef struct {
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t elapsed_us;
+	//the quiet time at the end which told that the dump was complete
+	uint64_t idle_us;
+	//reader waiting for a free buffer, i.e. storage was the bottleneck
+	uint64_t reader_wait_us;
+	//writer waiting for a full buffer, i.e. the link was the bottleneck
+	uint64_t writer_wait_us;
+	unsigned buffers;
+	bool direct;
+} ramdump_stats;
+
+/*
+ * Asks the driver for the next part of the dump, may be NULL
+ */
+typedef int (*ramdump_update_fn)(void *arg);
+
+/*
+ * @brief Copies a RAM dump from fd to a file
+ *
+ * Reads until fd reports end of file or hangs up, or stays quiet for
+ * RAMDUMP_IDLE_MS. A partial dump is kept when reading fails.
+ *
+ * @param fd [in] the device the dump arrives on
+ * @param path [in] the dump file, replaced if it exists
+ * @param compress [in] write an LZ4 frame instead of the raw dump
+ * @param update [in] called whenever the link was quiet for RAMDUMP_POLL_MS
+ * @param arg [in] argument of update
+ * @param stats [out] throughput of the capture
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int ramdump_capture(int fd, const char *path, bool compress,
+	ramdump_update_fn update, void *arg, ramdump_stats *stats);
+
+#endif //__RAMDUMP_H__
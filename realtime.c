@@ -0,0 +1,118 @@
+/*
+ * realtime.c: real-time scheduling and memory locking around the upload
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "realtime.h"
+#include "log.h"
+
+#include <sys/mman.h>
+
+void realtime_enter(realtime_window *rt, unsigned priority, bool pin,
+	unsigned cpu)
+{
+	memset(rt, 0, sizeof(*rt));
+	rt->active = true;
+
+	if (priority) {
+		struct sched_param param = { .sched_priority = priority, };
+
+		rt->policy = sched_getscheduler(0);
+		if (rt->policy < 0 || sched_getparam(0, &rt->param) < 0) {
+			_i("failed to read the scheduling policy: %s", strerror(errno));
+		}
+		else if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			_i("failed to switch to SCHED_FIFO %u: %s", priority,
+				strerror(errno));
+		}
+		else {
+			rt->sched_changed = true;
+			_d("running SCHED_FIFO %u", priority);
+		}
+	}
+
+	if (pin && cpu >= CPU_SETSIZE) {
+		_i("CPU %u is out of range, not pinning", cpu);
+	}
+	else if (pin) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (sched_getaffinity(0, sizeof(rt->cpus), &rt->cpus) < 0) {
+			_i("failed to read the CPU affinity: %s", strerror(errno));
+		}
+		else if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			_i("failed to pin to CPU %u: %s", cpu, strerror(errno));
+		}
+		else {
+			rt->affinity_changed = true;
+			_d("pinned to CPU %u", cpu);
+		}
+	}
+}
+
+void realtime_lock(realtime_window *rt, void *addr, size_t length) {
+	if (!rt->active || !addr || !length) {
+		return;
+	}
+
+	if (rt->lock_count == REALTIME_LOCK_MAX) {
+		_i("too many regions to lock, leaving %p unlocked", addr);
+		return;
+	}
+
+	if (mlock(addr, length) < 0) {
+		_i("failed to lock %zu bytes: %s", length, strerror(errno));
+		return;
+	}
+
+	rt->locked[rt->lock_count].addr = addr;
+	rt->locked[rt->lock_count].length = length;
+	rt->lock_count++;
+}
+
+void realtime_leave(realtime_window *rt) {
+	unsigned i;
+
+	if (!rt->active) {
+		return;
+	}
+
+	for (i = 0; i < rt->lock_count; i++) {
+		munlock(rt->locked[i].addr, rt->locked[i].length);
+	}
+
+	if (rt->affinity_changed
+		&& sched_setaffinity(0, sizeof(rt->cpus), &rt->cpus) < 0)
+	{
+		_e("failed to restore the CPU affinity: %s", strerror(errno));
+	}
+
+	if (rt->sched_changed
+		&& sched_setscheduler(0, rt->policy, &rt->param) < 0)
+	{
+		_e("failed to restore the scheduling policy: %s", strerror(errno));
+	}
+
+	rt->active = false;
+}
@@ -0,0 +1,81 @@
+/*
+ * realtime.h: real-time scheduling and memory locking around the upload
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include "common.h"
+
+#include <sched.h>
+
+#define REALTIME_LOCK_MAX 8
+
+/*
+ * Scheduling and memory state of the calling thread before
+ * realtime_enter(), so that realtime_leave() can put back exactly what
+ * was changed. Whatever cannot be changed (no CAP_SYS_NICE, a small
+ * RLIMIT_MEMLOCK) is logged and left alone, the upload runs regardless.
+ */
+typedef struct {
+	bool active;
+	bool sched_changed;
+	int policy;
+	struct sched_param param;
+	bool affinity_changed;
+	cpu_set_t cpus;
+	struct {
+		void *addr;
+		size_t length;
+	} locked[REALTIME_LOCK_MAX];
+	unsigned lock_count;
+} realtime_window;
+
+/*
+ * @brief Moves the calling thread to SCHED_FIFO and/or pins it to a CPU
+ *
+ * @param rt [out] the state to restore later
+ * @param priority [in] SCHED_FIFO priority, 0 to keep the scheduling
+ * @param pin [in] whether to pin the thread
+ * @param cpu [in] the CPU to pin to, none at or above CPU_SETSIZE
+ */
+void realtime_enter(realtime_window *rt, unsigned priority, bool pin,
+	unsigned cpu);
+
+/*
+ * @brief Locks a memory region until realtime_leave()
+ *
+ * @param rt [in] the state set up by realtime_enter()
+ * @param addr [in] start of the region, NULL is ignored
+ * @param length [in] length of the region in bytes
+ */
+void realtime_lock(realtime_window *rt, void *addr, size_t length);
+
+/*
+ * @brief Unlocks the regions and restores the scheduling and affinity
+ *
+ * @param rt [in] the state set up by realtime_enter()
+ */
+void realtime_leave(realtime_window *rt);
+
+#endif //__REALTIME_H__
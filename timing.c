@@ -0,0 +1,187 @@
+/*
+ * timing.c: boot phase timing for the firmware loader
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timing.h"
+#include "log.h"
+#include "trace.h"
+
+#include <time.h>
+
+static const char *boot_phase_names[] = {
+	[PHASE_HARD_RESET] = "hard reset",
+	[PHASE_ATAT] = "ATAT handshake",
+	[PHASE_PSI] = "PSI upload",
+	[PHASE_EBL] = "EBL upload",
+	[PHASE_BOOT_INFO] = "BootInfo",
+	[PHASE_SEC_START] = "ReqSecStart",
+	[PHASE_FIRMWARE] = "FIRMWARE",
+	[PHASE_NVDATA] = "NVDATA",
+	[PHASE_MPS] = "MPS",
+	[PHASE_SEC_END] = "ReqSecEnd",
+	[PHASE_WAIT_ONLINE] = "wait online",
+};
+
+uint64_t timing_now_us(void) {
+	struct timespec ts = {};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void timing_init(boot_timing *timing) {
+	memset(timing, 0, sizeof(*timing));
+	timing->boot_start_us = timing_now_us();
+	timing->current = PHASE_MAX;
+}
+
+void timing_begin(boot_timing *timing, enum boot_phase phase) {
+	if (phase >= PHASE_MAX) {
+		return;
+	}
+
+	trace(TRACE_PHASE_BEGIN, -1, phase, NULL, 0);
+	timing->phases[phase].start_us = timing_now_us();
+	timing->phases[phase].started = true;
+	timing->phases[phase].done = false;
+	timing->phases[phase].retries = 0;
+	timing->phases[phase].skipped = 0;
+	memset(&timing->phases[phase].blocks, 0, sizeof(block_timing));
+	timing->current = phase;
+}
+
+void timing_end(boot_timing *timing, enum boot_phase phase) {
+	if (phase >= PHASE_MAX || !timing->phases[phase].started) {
+		return;
+	}
+
+	trace(TRACE_PHASE_END, -1, phase, NULL, 0);
+	timing->phases[phase].end_us = timing_now_us();
+	timing->phases[phase].done = true;
+}
+
+void timing_retry(boot_timing *timing) {
+	if (timing->current < PHASE_MAX) {
+		timing->phases[timing->current].retries++;
+	}
+}
+
+void timing_skip(boot_timing *timing, uint64_t bytes) {
+	if (timing->current < PHASE_MAX) {
+		timing->phases[timing->current].skipped += bytes;
+	}
+}
+
+void timing_block(boot_timing *timing) {
+	if (timing->current >= PHASE_MAX) {
+		return;
+	}
+
+	boot_phase_timing *p = timing->phases + timing->current;
+	block_timing *b = &p->blocks;
+	uint64_t now = timing_now_us();
+	uint64_t took = now - (b->count ? b->mark_us : p->start_us);
+
+	if (b->count) {
+		b->jitter_sum_us += took > b->last_us ? took - b->last_us
+			: b->last_us - took;
+	}
+	if (!b->count || took < b->min_us) {
+		b->min_us = took;
+	}
+	if (took > b->max_us) {
+		b->max_us = took;
+	}
+	b->sum_us += took;
+	b->last_us = took;
+	b->mark_us = now;
+	b->count++;
+}
+
+uint64_t timing_block_jitter(const block_timing *blocks) {
+	return blocks->count > 1 ? blocks->jitter_sum_us / (blocks->count - 1) : 0;
+}
+
+const char *timing_phase_name(unsigned phase) {
+	return phase < PHASE_MAX ? boot_phase_names[phase] : NULL;
+}
+
+void timing_report(boot_timing *timing, const char *board) {
+	uint64_t now = timing_now_us();
+	uint64_t accounted = 0, skipped = 0;
+	unsigned i;
+
+	_r("boot timing (%s)", board);
+	_r("  %-16s %12s %12s  %s", "phase", "start ms", "took ms", "status");
+
+	for (i = 0; i < PHASE_MAX; i++) {
+		boot_phase_timing *p = timing->phases + i;
+		if (!p->started) {
+			continue;
+		}
+
+		uint64_t end = p->done ? p->end_us : now;
+		uint64_t took = end - p->start_us;
+		uint64_t at = p->start_us - timing->boot_start_us;
+		accounted += took;
+		skipped += p->skipped;
+
+		char retries[64] = "";
+		if (p->retries) {
+			snprintf(retries, sizeof(retries), ", %u retries", p->retries);
+		}
+		if (p->skipped) {
+			size_t used = strlen(retries);
+			snprintf(retries + used, sizeof(retries) - used,
+				", %llu KiB skipped", (unsigned long long)p->skipped >> 10);
+		}
+
+		_r("  %-16s %8llu.%03llu %8llu.%03llu  %s%s", boot_phase_names[i],
+			(unsigned long long)(at / 1000),
+			(unsigned long long)(at % 1000),
+			(unsigned long long)(took / 1000),
+			(unsigned long long)(took % 1000),
+			p->done ? "ok" : "FAILED", retries);
+
+		if (p->blocks.count > 1) {
+			_r("  %-16s %u blocks, min/avg/max %llu/%llu/%llu us, jitter %llu us",
+				"", p->blocks.count,
+				(unsigned long long)p->blocks.min_us,
+				(unsigned long long)(p->blocks.sum_us / p->blocks.count),
+				(unsigned long long)p->blocks.max_us,
+				(unsigned long long)timing_block_jitter(&p->blocks));
+		}
+	}
+
+	uint64_t total = now - timing->boot_start_us;
+	uint64_t other = total > accounted ? total - accounted : 0;
+	_r("  %-16s %12s %8llu.%03llu", "other", "",
+		(unsigned long long)(other / 1000),
+		(unsigned long long)(other % 1000));
+	_r("  %-16s %12s %8llu.%03llu", "total", "",
+		(unsigned long long)(total / 1000),
+		(unsigned long long)(total % 1000));
+	if (skipped) {
+		_r("  sparse upload left out %llu bytes", (unsigned long long)skipped);
+	}
+}
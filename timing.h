@@ -0,0 +1,165 @@
+/*
+ * timing.h: boot phase timing for the firmware loader
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include "common.h"
+
+/*
+ * Phases of the modem boot sequence that are timed individually.
+ * Not every board goes through every phase (e.g. MPS is I9250 only).
+ */
+enum boot_phase {
+	PHASE_HARD_RESET,
+	PHASE_ATAT,
+	PHASE_PSI,
+	PHASE_EBL,
+	PHASE_BOOT_INFO,
+	PHASE_SEC_START,
+	PHASE_FIRMWARE,
+	PHASE_NVDATA,
+	PHASE_MPS,
+	PHASE_SEC_END,
+	PHASE_WAIT_ONLINE,
+	PHASE_MAX,
+};
+
+/*
+ * Time between consecutive bootloader blocks of a phase, the first one
+ * counted from the start of the phase
+ */
+typedef struct {
+	unsigned count;
+	uint64_t mark_us;
+	uint64_t last_us;
+	uint64_t min_us;
+	uint64_t max_us;
+	uint64_t sum_us;
+	//sum of the differences between consecutive intervals
+	uint64_t jitter_sum_us;
+} block_timing;
+
+typedef struct {
+	uint64_t start_us;
+	uint64_t end_us;
+	bool started;
+	bool done;
+	//blocks resent after a failure, see modemctl_block_retry()
+	unsigned retries;
+	//bytes the sparse upload left out
+	uint64_t skipped;
+	block_timing blocks;
+} boot_phase_timing;
+
+typedef struct {
+	uint64_t boot_start_us;
+	//the phase most recently started, PHASE_MAX before the first one
+	enum boot_phase current;
+	boot_phase_timing phases[PHASE_MAX];
+} boot_timing;
+
+/*
+ * @brief Returns the CLOCK_MONOTONIC time
+ *
+ * @return current monotonic time in microseconds
+ */
+uint64_t timing_now_us(void);
+
+/*
+ * @brief Resets the phase table and records the boot start time
+ *
+ * @param timing [out] timing table to initialize
+ */
+void timing_init(boot_timing *timing);
+
+/*
+ * @brief Records the start of a boot phase
+ *
+ * @param timing [in] timing table
+ * @param phase [in] the phase being started
+ */
+void timing_begin(boot_timing *timing, enum boot_phase phase);
+
+/*
+ * @brief Records the successful end of a boot phase
+ *
+ * @param timing [in] timing table
+ * @param phase [in] the phase being finished
+ */
+void timing_end(boot_timing *timing, enum boot_phase phase);
+
+/*
+ * @brief Counts a retry against the phase in progress
+ *
+ * @param timing [in] timing table
+ */
+void timing_retry(boot_timing *timing);
+
+/*
+ * @brief Counts bytes left out against the phase in progress
+ *
+ * @param timing [in] timing table
+ * @param bytes [in] number of bytes not sent
+ */
+void timing_skip(boot_timing *timing, uint64_t bytes);
+
+/*
+ * @brief Records that a block of the phase in progress went through
+ *
+ * Called once per ACKed (or, without ACKs, written) block, the report
+ * then shows how evenly the blocks went out.
+ *
+ * @param timing [in] timing table
+ */
+void timing_block(boot_timing *timing);
+
+/*
+ * @brief Returns the average difference between consecutive block times
+ *
+ * @param blocks [in] block times of a phase
+ * @return jitter in microseconds, zero with fewer than two blocks
+ */
+uint64_t timing_block_jitter(const block_timing *blocks);
+
+/*
+ * @brief Returns the printable name of a boot phase
+ *
+ * @param phase [in] enum boot_phase
+ * @return phase name or NULL for unknown phases
+ */
+const char *timing_phase_name(unsigned phase);
+
+/*
+ * @brief Prints the per-phase summary table
+ *
+ * Phases which were started but never finished are reported as
+ * failed with the time spent in them up to now.
+ *
+ * @param timing [in] timing table
+ * @param board [in] board name to print in the table header
+ */
+void timing_report(boot_timing *timing, const char *board);
+
+#endif //__TIMING_H__
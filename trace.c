@@ -0,0 +1,191 @@
+/*
+ * trace.c: binary trace ring for the Firmware Loader
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+bool trace_enabled = false;
+
+static trace_record *trace_ring;
+static uint32_t trace_next;
+static char trace_path[PATH_MAX];
+
+static const char *trace_event_names[] = {
+	[TRACE_TX] = "tx",
+	[TRACE_RX] = "rx",
+	[TRACE_ERROR] = "error",
+	[TRACE_DEBUG] = "debug",
+	[TRACE_DUMP] = "dump",
+	[TRACE_PHASE_BEGIN] = "begin",
+	[TRACE_PHASE_END] = "end",
+};
+
+static trace_record *trace_claim(unsigned event, int fd, unsigned arg, size_t len) {
+	uint32_t seq = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+	trace_record *rec = trace_ring + (seq & (TRACE_RECORDS - 1));
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->time_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	rec->seq = seq;
+	rec->event = event;
+	rec->arg = arg;
+	rec->fd = fd;
+	rec->len = len;
+	return rec;
+}
+
+void trace_record_event(unsigned event, int fd, unsigned arg,
+	const void *data, size_t len)
+{
+	trace_record *rec = trace_claim(event, fd, arg, len);
+	size_t n = len < TRACE_DATA_SIZE ? len : TRACE_DATA_SIZE;
+
+	memset(rec->data, 0, sizeof(rec->data));
+	if (data) {
+		memcpy(rec->data, data, n);
+	}
+}
+
+void trace_record_iov(unsigned event, int fd,
+	const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	if (!trace_enabled) {
+		return;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	trace_record *rec = trace_claim(event, fd, 0, len);
+	size_t done = 0;
+
+	memset(rec->data, 0, sizeof(rec->data));
+	for (i = 0; i < iovcnt && done < TRACE_DATA_SIZE; i++) {
+		size_t n = TRACE_DATA_SIZE - done;
+		if (n > iov[i].iov_len) {
+			n = iov[i].iov_len;
+		}
+		memcpy(rec->data + done, iov[i].iov_base, n);
+		done += n;
+	}
+}
+
+static int trace_write(int fd, const void *data, size_t size) {
+	const char *ptr = data;
+	while (size) {
+		ssize_t ret = write(fd, ptr, size);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		ptr += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+int trace_dump(void) {
+	int ret = 0;
+	int fd;
+
+	if (!trace_enabled) {
+		return 0;
+	}
+
+	uint32_t total = __atomic_load_n(&trace_next, __ATOMIC_RELAXED);
+	uint32_t count = total < TRACE_RECORDS ? total : TRACE_RECORDS;
+	uint32_t first = (total - count) & (TRACE_RECORDS - 1);
+
+	trace_file_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(trace_record),
+		.count = count,
+		.dropped = total - count,
+	};
+
+	if ((fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		return -errno;
+	}
+
+	//the ring wraps at most once, so the records are in two runs
+	uint32_t head = TRACE_RECORDS - first < count ? TRACE_RECORDS - first : count;
+	if ((ret = trace_write(fd, &header, sizeof(header))) < 0
+		|| (ret = trace_write(fd, trace_ring + first, head * sizeof(trace_record))) < 0
+		|| (ret = trace_write(fd, trace_ring, (count - head) * sizeof(trace_record))) < 0)
+	{
+		goto fail;
+	}
+
+fail:
+	close(fd);
+	return ret;
+}
+
+static void trace_signal(int sig) {
+	int saved = errno;
+	trace_dump();
+	errno = saved;
+}
+
+int trace_init(const char *dump_path) {
+	struct sigaction sa;
+
+	if (strlen(dump_path) >= sizeof(trace_path)) {
+		return -ENAMETOOLONG;
+	}
+
+	if (!(trace_ring = calloc(TRACE_RECORDS, sizeof(trace_record)))) {
+		return -ENOMEM;
+	}
+	strcpy(trace_path, dump_path);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL) < 0) {
+		return -errno;
+	}
+
+	trace_enabled = true;
+	return 0;
+}
+
+const char *trace_event_name(unsigned event) {
+	if (event >= ARRAY_SIZE(trace_event_names)) {
+		return NULL;
+	}
+	return trace_event_names[event];
+}
@@ -0,0 +1,149 @@
+/*
+ * trace.h: binary trace ring for the Firmware Loader
+ * This file is part of:
+ *
+ * Firmware loader for Samsung I9100 and I9250
+ * Copyright (C) 2012 Alexander Tarasikov <alexander.tarasikov@gmail.com>
+ *
+ * based on the incomplete C++ implementation which is
+ * Copyright (C) 2012 Sergey Gridasov <grindars@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "common.h"
+
+/*
+ * Fixed-size binary records written into a preallocated in-memory ring,
+ * so that tracing can stay on in the field. Nothing is formatted while
+ * the loader runs; the ring is dumped to a file on failure or on SIGUSR1
+ * and decoded offline with modem-trace.
+ *
+ * Writers claim slots with an atomic counter and never block. A record
+ * being written while the ring is dumped may come out torn, the decoder
+ * marks records with an unknown event instead of trusting them.
+ */
+
+#define TRACE_DATA_SIZE 16
+//must be a power of two
+#define TRACE_RECORDS 4096
+#define TRACE_MAGIC "XMMTRACE"
+#define TRACE_VERSION 1
+
+enum trace_event {
+	TRACE_NONE,
+	//bytes written to an fd, arg is unused
+	TRACE_TX,
+	//bytes read from an fd, arg is unused
+	TRACE_RX,
+	//_e() call site, arg is the line and data the function name
+	TRACE_ERROR,
+	//_d() call site when tracing replaces the debug printf
+	TRACE_DEBUG,
+	//hexdump() payload
+	TRACE_DUMP,
+	//arg is the enum boot_phase
+	TRACE_PHASE_BEGIN,
+	TRACE_PHASE_END,
+	TRACE_EVENT_MAX,
+};
+
+typedef struct {
+	uint64_t time_ns;
+	uint32_t seq;
+	uint16_t event;
+	uint16_t arg;
+	int32_t fd;
+	//full length of the traced buffer, data holds its first bytes
+	uint32_t len;
+	uint8_t data[TRACE_DATA_SIZE];
+} trace_record;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t count;
+	uint32_t dropped;
+} trace_file_header;
+
+extern bool trace_enabled;
+
+#define trace(event, fd, arg, data, len) \
+	do { \
+		if (trace_enabled) { \
+			trace_record_event(event, fd, arg, data, len); \
+		} \
+	} while (0)
+
+//records the calling function and line, used by the log macros
+#define trace_site(event) \
+	trace(event, -1, __LINE__, __func__, sizeof(__func__) - 1)
+
+/*
+ * @brief Allocates the ring and enables tracing
+ *
+ * Installs a SIGUSR1 handler which dumps the ring on demand.
+ *
+ * @param dump_path [in] file the ring is dumped to
+ * @return Negative value indicating error code
+ * @return zero on success
+ */
+int trace_init(const char *dump_path);
+
+/*
+ * @brief Appends one record to the ring, use the trace() macro instead
+ *
+ * @param event [in] enum trace_event
+ * @param fd [in] file descriptor the event refers to or -1
+ * @param arg [in] event specific argument
+ * @param data [in] traced buffer, may be NULL
+ * @param len [in] length of the traced buffer
+ */
+void trace_record_event(unsigned event, int fd, unsigned arg,
+	const void *data, size_t len);
+
+/*
+ * @brief Records the first bytes of a scattered buffer
+ *
+ * @param event [in] enum trace_event
+ * @param fd [in] file descriptor the event refers to
+ * @param iov [in] buffer segments
+ * @param iovcnt [in] number of segments
+ */
+void trace_record_iov(unsigned event, int fd,
+	const struct iovec *iov, int iovcnt);
+
+/*
+ * @brief Writes the ring, oldest record first, to the dump file
+ *
+ * Only uses async-signal-safe calls.
+ *
+ * @return Negative value indicating error code
+ * @return zero on success or when tracing is off
+ */
+int trace_dump(void);
+
+/*
+ * @brief Returns a short name for an event id
+ *
+ * @param event [in] enum trace_event
+ * @return event name or NULL for unknown ids
+ */
+const char *trace_event_name(unsigned event);
+
+#endif //__TRACE_H__